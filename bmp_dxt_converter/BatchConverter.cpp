@@ -0,0 +1,259 @@
+/**
+BatchConverter.cpp
+Purpose: Non-interactive conversion of many files
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include "BatchConverter.h"
+#include "BlockPacker.h"
+#include "IncrementalEncoder.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <glob.h>
+#endif
+
+// lower case extension of a path ("" if none)
+static string extensionOf(const string& path)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		return "";
+
+	string ext = path.substr(dot + 1);
+	for (size_t i = 0; i < ext.size(); ++i)
+		ext[i] = (char)tolower((unsigned char)ext[i]);
+	return ext;
+}
+
+BatchConverter::BatchConverter(Compressor& compressor) : compressor(compressor), printMetrics(false), mipLevel(0), incremental(false), pack(false)
+{
+	region.x = region.y = region.width = region.height = 0;
+}
+
+bool BatchConverter::expandPattern(const string& pattern, vector<string>& inputPaths) const
+{
+	size_t nBefore = inputPaths.size();
+
+#ifdef _WIN32
+	size_t slash = pattern.find_last_of("/\\");
+	string dir = slash == string::npos ? "" : pattern.substr(0, slash + 1);
+
+	WIN32_FIND_DATAA findData;
+	HANDLE find = FindFirstFileA(pattern.c_str(), &findData);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				inputPaths.push_back(dir + findData.cFileName);
+		} while (FindNextFileA(find, &findData));
+
+		FindClose(find);
+	}
+#else
+	glob_t matches;
+	if (glob(pattern.c_str(), 0, 0, &matches) == 0)
+	{
+		for (size_t i = 0; i < matches.gl_pathc; ++i)
+			inputPaths.push_back(matches.gl_pathv[i]);
+	}
+	globfree(&matches);
+#endif
+
+	return inputPaths.size() > nBefore;
+}
+
+bool BatchConverter::readManifest(const string& manifestPath, vector<string>& inputPaths) const
+{
+	ifstream manifest(manifestPath);
+	if (!manifest.good())
+		return false;
+
+	string line;
+	while (getline(manifest, line))
+	{
+		// trim spaces and the \r of Windows line endings
+		size_t first = line.find_first_not_of(" \t\r");
+		size_t last = line.find_last_not_of(" \t\r");
+		if (first == string::npos || line[first] == '#')
+			continue;
+
+		string path = line.substr(first, last - first + 1);
+		if (path.find_first_of("*?") == string::npos || !expandPattern(path, inputPaths))
+			inputPaths.push_back(path);
+	}
+
+	return true;
+}
+
+string BatchConverter::outputPathFor(const string& inputPath) const
+{
+	string ext = extensionOf(inputPath);
+	if (ext != "bmp" && ext != "dds" && ext != "ddz")
+		return "";
+
+	string outputExt = ext == "dds" ? (pack ? "ddz" : "bmp") : "dds";
+
+	size_t slash = inputPath.find_last_of("/\\");
+	string name = slash == string::npos ? inputPath : inputPath.substr(slash + 1);
+	name = name.substr(0, name.size() - ext.size()) + outputExt;
+
+	if (outputDir.empty())
+		return slash == string::npos ? name : inputPath.substr(0, slash + 1) + name;
+
+	char last = outputDir[outputDir.size() - 1];
+	return (last == '/' || last == '\\') ? outputDir + name : outputDir + "/" + name;
+}
+
+int BatchConverter::run(const vector<string>& inputs)
+{
+	int nFailed = 0;
+
+	// expand manifests and patterns (the Windows shell doesn't expand wildcards)
+	vector<string> inputPaths;
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		if (inputs[i].size() > 1 && inputs[i][0] == '@')
+		{
+			if (!readManifest(inputs[i].substr(1), inputPaths))
+			{
+				cout << "- can't read manifest " << inputs[i].substr(1) << endl;
+				++nFailed;
+			}
+		}
+		else if (inputs[i].find_first_of("*?") != string::npos)
+		{
+			if (!expandPattern(inputs[i], inputPaths))
+				cout << "- no files match " << inputs[i] << endl;
+		}
+		else
+		{
+			inputPaths.push_back(inputs[i]);
+		}
+	}
+
+	// the same file may be listed more than once (e.g. by a pattern and a manifest)
+	set<string> inputSet;
+	vector<string> uniquePaths;
+	for (size_t i = 0; i < inputPaths.size(); ++i)
+	{
+		if (inputSet.insert(inputPaths[i]).second)
+			uniquePaths.push_back(inputPaths[i]);
+	}
+	inputPaths.swap(uniquePaths);
+
+	// name the outputs, two inputs can't write the same file and an output can't overwrite an input
+	vector<string> outputPaths(inputPaths.size());
+	set<string> usedOutputs;
+	for (size_t i = 0; i < inputPaths.size(); ++i)
+	{
+		string outputPath = outputPathFor(inputPaths[i]);
+		if (outputPath.empty())
+			cout << "- not a .bmp/.dds/.ddz file: " << inputPaths[i] << endl;
+		else if (inputSet.count(outputPath))
+			cout << "- skipped " << inputPaths[i] << ", " << outputPath << " is also an input" << endl;
+		else if (!usedOutputs.insert(outputPath).second)
+			cout << "- skipped " << inputPaths[i] << ", " << outputPath << " is already generated from another input" << endl;
+		else
+			outputPaths[i] = outputPath;
+
+		if (outputPaths[i].empty())
+			++nFailed;
+	}
+
+	// convert the files concurrently, the compressor threads also share each file's block rows,
+	// so a few large files among many small ones still keep all threads busy
+	mutex printMutex;
+	int nConverted = 0;
+	IncrementalEncoder updater(compressor);
+	BlockPacker packer(compressor);
+	compressor.setVerbose(false);
+	compressor.runParallel((int)inputPaths.size(), [&](int i)
+	{
+		if (outputPaths[i].empty())
+			return;
+
+		string ext = extensionOf(inputPaths[i]);
+		bool isBMP = ext == "bmp";
+		ErrorMetrics metrics;
+		bool converted;
+		if (ext == "ddz")
+			converted = packer.unpack(inputPaths[i], outputPaths[i]);
+		else if (!isBMP && pack)
+			converted = packer.pack(inputPaths[i], outputPaths[i]);
+		else if (isBMP && incremental)
+			converted = updater.update(inputPaths[i], outputPaths[i]);
+		else if (isBMP)
+			converted = compressor.compress(inputPaths[i], outputPaths[i], printMetrics ? &metrics : 0);
+		else if (region.width != 0)
+			converted = compressor.decompressRegion(inputPaths[i], region, outputPaths[i], mipLevel);
+		else
+			converted = compressor.decompress(inputPaths[i], outputPaths[i], mipLevel);
+
+		lock_guard<mutex> lock(printMutex);
+		if (converted)
+		{
+			cout << "- " << inputPaths[i] << " -> " << outputPaths[i] << endl;
+			if (isBMP && printMetrics && !incremental)
+			{
+				size_t worst = metrics.getMaxErrorBlock();
+				cout << "  rmse " << metrics.getRMSE() << ", psnr " << metrics.getPSNR() << " dB, max block error "
+					<< metrics.getMaxBlockError() << " (block " << worst % metrics.getBlocksPerRow() << ","
+					<< worst / metrics.getBlocksPerRow() << ")" << endl;
+			}
+			++nConverted;
+		}
+		else
+		{
+			cout << "- failed to convert " << inputPaths[i] << endl;
+			++nFailed;
+		}
+	});
+	compressor.setVerbose(true);
+
+	cout << "- " << nConverted << " of " << inputPaths.size() << " file(s) converted" << endl;
+
+	long long nChecked = updater.getCheckedBlocks(), nDirty = updater.getDirtyBlocks();
+	if (nChecked > 0)
+		cout << "- incremental update: " << nDirty << " of " << nChecked << " blocks changed and recompressed" << endl;
+
+	long long nDDSBytes = packer.getDDSBytes(), nPackedBytes = packer.getPackedBytes();
+	if (nDDSBytes > 0)
+		cout << "- packed files: " << nPackedBytes << " of " << nDDSBytes << " DDS bytes ("
+			<< nPackedBytes * 100 / nDDSBytes << "%)" << endl;
+
+	long long nUnchanged = compressor.getConversionCacheHits(), nMissed = compressor.getConversionCacheMisses();
+	if (nUnchanged + nMissed > 0)
+		cout << "- conversion cache: " << nUnchanged << " of " << nUnchanged + nMissed << " files reused ("
+			<< nUnchanged * 100 / (nUnchanged + nMissed) << "%)" << endl;
+
+	long long nCached = compressor.getBlockCacheHits(), nCompressed = compressor.getBlockCacheMisses();
+	if (nCached + nCompressed > 0)
+		cout << "- block cache: " << nCached << " of " << nCached + nCompressed << " blocks reused ("
+			<< nCached * 100 / (nCached + nCompressed) << "%)" << endl;
+
+	// estimated LZ compressed size of the blocks against their error, with and without the optimization
+	RdoStats rdo = compressor.getRdoStats();
+	if (rdo.nBlocks > 0)
+		cout << "- rdo: " << rdo.nChanged << " of " << rdo.nBlocks << " blocks changed, estimated LZ size " << rdo.baseBits / 8
+			<< " -> " << rdo.bits / 8 << " bytes (" << rdo.bits * 100 / rdo.baseBits << "%), rmse " << sqrt(rdo.baseError / (rdo.nBlocks * 48.0))
+			<< " -> " << sqrt(rdo.error / (rdo.nBlocks * 48.0)) << endl;
+
+	long long nReused = compressor.getPaletteCacheHits(), nExpanded = compressor.getPaletteCacheMisses();
+	if (nReused + nExpanded > 0)
+		cout << "- palette cache: " << nReused << " of " << nReused + nExpanded << " block palettes reused ("
+			<< nReused * 100 / (nReused + nExpanded) << "%)" << endl;
+	return nFailed;
+}
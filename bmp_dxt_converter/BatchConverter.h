@@ -0,0 +1,115 @@
+/**
+BatchConverter.h
+Purpose: Non-interactive conversion of many files. Inputs are file paths, wildcard patterns or
+@manifest files (one path per line), outputs are named after the inputs and the files are converted
+concurrently on the compressor threads.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Compressor.h"
+
+using namespace std;
+
+class BatchConverter
+{
+private:
+	Compressor& compressor;
+
+	// directory of the generated files, empty to write them next to their input
+	string outputDir;
+
+	// print the compression error of every compressed file
+	bool printMetrics;
+
+	// mip level extracted from the .dds files
+	int mipLevel;
+
+	// rectangle extracted from the .dds files, used if its width is not 0
+	ImageRegion region;
+
+	// update the existing .dds files, recompressing only the blocks that changed (see IncrementalEncoder)
+	bool incremental;
+
+	// pack the .dds inputs into .ddz files instead of decompressing them (see BlockPacker)
+	bool pack;
+
+	/**
+	Add the files matching a wildcard pattern (* and ? in the file name part)
+
+	@param pattern wildcard pattern
+	@param inputPaths paths list to add the matches to
+	@return false if nothing matched
+	*/
+	bool expandPattern(const string& pattern, vector<string>& inputPaths) const;
+
+	/**
+	Add the paths listed in a manifest file, one per line. Empty lines and lines starting with # are skipped,
+	lines may be wildcard patterns
+
+	@param manifestPath manifest file path
+	@param inputPaths paths list to add the paths to
+	@return false if the manifest can't be read
+	*/
+	bool readManifest(const string& manifestPath, vector<string>& inputPaths) const;
+
+	/**
+	Generated file path of an input: the input name with a .dds (for .bmp and .ddz inputs) or .bmp (for .dds inputs,
+	.ddz if packing) extension, in outputDir or next to the input
+
+	@param inputPath input file path
+	@return output path, empty if the input is not a .bmp, .dds or .ddz file
+	*/
+	string outputPathFor(const string& inputPath) const;
+
+public:
+	/**
+	@param compressor compressor doing the conversions, its threads are used for the files and their blocks
+	*/
+	explicit BatchConverter(Compressor& compressor);
+
+	/**
+	@param dir directory of the generated files, empty (default) to write them next to their input
+	*/
+	void setOutputDir(const string& dir) { outputDir = dir; }
+
+	/**
+	@param enabled true to print the RMSE, PSNR and worst block error of every compressed file (false by default)
+	*/
+	void setPrintMetrics(const bool enabled) { printMetrics = enabled; }
+
+	/**
+	@param level mip level extracted from the .dds files, 0 (default) for the full size image
+	*/
+	void setMipLevel(const int level) { mipLevel = level; }
+
+	/**
+	@param rect rectangle extracted from the .dds files (only its blocks are read), a width of 0 (default) for the whole image
+	*/
+	void setRegion(const ImageRegion& rect) { region = rect; }
+
+	/**
+	@param enabled true to update the .dds files of the .bmp inputs in place, recompressing only the blocks changed
+	since the last update (false by default, the metrics are not computed)
+	*/
+	void setIncremental(const bool enabled) { incremental = enabled; }
+
+	/**
+	@param enabled true to pack the .dds inputs into .ddz files, losslessly, instead of decompressing them (false by default)
+	*/
+	void setPack(const bool enabled) { pack = enabled; }
+
+	/**
+	Convert all the inputs, .bmp files are compressed to .dds, .dds files decompressed to .bmp (or packed to .ddz)
+	and .ddz files expanded to .dds
+
+	@param inputs file paths, wildcard patterns and @manifest files
+	@return number of inputs that failed to convert
+	*/
+	int run(const vector<string>& inputs);
+};
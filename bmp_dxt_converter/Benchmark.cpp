@@ -0,0 +1,318 @@
+/**
+Benchmark.cpp
+Purpose: Speed and quality measurements of the encoders and decoders
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+#include <thread>
+#include "Benchmark.h"
+#include "EncoderContext.h"
+#include "MappedFile.h"
+
+// small deterministic generator, the synthetic images are the same on every platform
+static unsigned int nextRandom(unsigned int& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+static byte clampColor(const double value)
+{
+	return (byte)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+Benchmark::Benchmark(Compressor& compressor) : compressor(compressor), minSeconds(0.25)
+{
+	setMaxThreads(0);
+}
+
+void Benchmark::setMaxThreads(const int nThreads)
+{
+	maxThreads = nThreads > 0 ? nThreads : max(1, (int)thread::hardware_concurrency());
+}
+
+void Benchmark::addSyntheticImages(const int width, const int height)
+{
+	unsigned int seed = 12345;
+	Image image;
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height);
+
+	// gradient: red across, green down, blue diagonally
+	image.name = "gradient";
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+			image.pixels[y * width + x] = RGBTriplet(x * 255 / (width - 1), y * 255 / (height - 1), (x + y) * 255 / (width + height - 2));
+	images.push_back(image);
+
+	// noise: every channel random, the worst case for DXT1
+	image.name = "noise";
+	for (size_t i = 0; i < image.pixels.size(); ++i)
+	{
+		unsigned int bits = nextRandom(seed);
+		image.pixels[i] = RGBTriplet(bits & 0xFF, (bits >> 8) & 0xFF, (bits >> 16) & 0xFF);
+	}
+	images.push_back(image);
+
+	// flat: one color, every block takes the single color path
+	image.name = "flat";
+	for (size_t i = 0; i < image.pixels.size(); ++i)
+		image.pixels[i] = RGBTriplet(90, 140, 200);
+	images.push_back(image);
+
+	// photo-like: smooth low frequency shading, a few hard edged shapes and some grain
+	image.name = "photo";
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			double u = (double)x / width, v = (double)y / height;
+			double shade = 0.5 + 0.25 * sin(u * 7.0 + v * 3.0) + 0.25 * cos(v * 5.0 - u * 2.0);
+			double r = 200 * shade + 40 * v, g = 160 * shade + 50 * u, b = 120 * (1 - shade) + 60;
+
+			double dx = u - 0.35, dy = v - 0.55;
+			if (dx * dx + dy * dy < 0.04) // disc
+			{
+				r = 230 - 60 * dy; g = 70; b = 50;
+			}
+			else if (u > 0.6 && u < 0.85 && v > 0.15 && v < 0.4) // rectangle
+			{
+				r = 30; g = 90 + 80 * u; b = 160;
+			}
+
+			double grain = (int)(nextRandom(seed) % 17) - 8;
+			image.pixels[y * width + x] = RGBTriplet(clampColor(r + grain), clampColor(g + grain), clampColor(b + grain));
+		}
+	}
+	images.push_back(image);
+}
+
+bool Benchmark::addImageFile(const string& filePath)
+{
+	MappedFile bmpFile;
+	if (!bmpFile.openRead(filePath))
+	{
+		cout << "- file not found: " << filePath << endl;
+		return false;
+	}
+
+	BMP_HEADER bmpHeader;
+	if (bmpFile.size() < sizeof(bmpHeader))
+	{
+		cout << "* file is not a BMP file." << endl;
+		return false;
+	}
+	memcpy(&bmpHeader, bmpFile.data(), sizeof(bmpHeader));
+
+	if (!compressor.isValidBMPFile(bmpHeader))
+		return false;
+
+	Image image;
+	image.name = filePath.substr(filePath.find_last_of("/\\") + 1);
+	image.width = bmpHeader.imageWidth;
+	image.height = abs(bmpHeader.imageHeight);
+	bool isBottomUp = bmpHeader.imageHeight > 0;
+
+	size_t rowBytes = (size_t)Compressor::bmpRowBytes(bmpHeader);
+	if ((long long)rowBytes * image.height > INT_MAX || image.width <= 0 || image.height <= 0 ||
+		bmpHeader.dataOffset > bmpFile.size() || bmpFile.size() - bmpHeader.dataOffset < rowBytes * image.height)
+	{
+		cout << "* BMP file is truncated." << endl;
+		return false;
+	}
+
+	// store the scanlines top to bottom as 24bit colors
+	PixelFormat format = Compressor::bmpPixelFormat(bmpHeader);
+	const byte* bmpPixels = bmpFile.data() + bmpHeader.dataOffset;
+	ImageView view = isBottomUp ? ImageView::bottomUp(bmpPixels, (ptrdiff_t)rowBytes, image.width, image.height, format) :
+		ImageView(bmpPixels, (ptrdiff_t)rowBytes, image.width, image.height, format);
+
+	image.pixels.resize((size_t)image.width * image.height);
+	for (int y = 0; y < image.height; ++y)
+	{
+		if (format == PIXEL_BGRA32)
+			loadScanline<FormatBGRA32>(view.scanline(y), image.width, &image.pixels[(size_t)y * image.width]);
+		else
+			loadScanline<FormatBGR24>(view.scanline(y), image.width, &image.pixels[(size_t)y * image.width]);
+	}
+
+	images.push_back(image);
+	return true;
+}
+
+template <class Fn>
+double Benchmark::timeRuns(const Fn& fn) const
+{
+	fn(); // warm up
+
+	int nRuns = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	double elapsed;
+	do
+	{
+		fn();
+		++nRuns;
+		elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	} while (elapsed < minSeconds);
+
+	return elapsed / nRuns;
+}
+
+void Benchmark::run()
+{
+	cout << fixed << setprecision(2);
+	cout << "best instruction set: " << SimdEncoder::levelName(SimdEncoder::detectLevel()) << ", threads: up to " << maxThreads << endl;
+
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		const Image& image = images[i];
+		cout << endl << "== " << image.name << " (" << image.width << "x" << image.height << ")" << endl;
+
+		benchBlockEncoders(image);
+		benchCompress(image);
+		benchDecompress(image);
+		measureQuality(image);
+	}
+}
+
+void Benchmark::benchBlockEncoders(const Image& image)
+{
+	int nBlocks = (image.width / 4) * (image.height / 4);
+	double mPixels = (double)image.width * image.height / 1e6;
+
+	// gather the blocks colors once, 16 consecutive colors per block
+	vector<RGBTriplet> blockColors((size_t)nBlocks * 16);
+	int block = 0;
+	for (int y = 0; y < image.height; y += 4)
+		for (int x = 0; x < image.width; x += 4, ++block)
+			for (int h = 0; h < 4; ++h)
+				for (int w = 0; w < 4; ++w)
+					blockColors[block * 16 + h * 4 + w] = image.pixels[(y + h) * image.width + x + w];
+
+	vector<Dxt1Block> blocks(nBlocks);
+
+	cout << "block encoder (1 thread)" << endl;
+
+	compressor.setEncoderTier(TIER_INTENSITY);
+	for (int level = SIMD_SCALAR; level <= SimdEncoder::detectLevel(); ++level)
+	{
+		compressor.setSimdLevel((SimdLevel)level);
+		double seconds = timeRuns([&] { compressor.compressDxt1Blocks(&blockColors[0], &blocks[0], nBlocks); });
+		cout << "  intensity " << setw(8) << SimdEncoder::levelName((SimdLevel)level) << ": "
+			<< setw(9) << mPixels / seconds << " MPix/s " << setw(8) << nBlocks / seconds / 1e6 << " Mblocks/s" << endl;
+	}
+
+	compressor.setEncoderTier(TIER_RANGE_FIT);
+	double seconds = timeRuns([&] { compressor.compressDxt1Blocks(&blockColors[0], &blocks[0], nBlocks); });
+	cout << "  range fit " << setw(8) << "scalar" << ": "
+		<< setw(9) << mPixels / seconds << " MPix/s " << setw(8) << nBlocks / seconds / 1e6 << " Mblocks/s" << endl;
+
+	compressor.setEncoderTier(TIER_INTENSITY);
+}
+
+void Benchmark::benchCompress(const Image& image)
+{
+	int nBlocks = (image.width / 4) * (image.height / 4);
+	double mPixels = (double)image.width * image.height / 1e6;
+	vector<Dxt1Block> blocks(nBlocks);
+
+	cout << "compressBMP" << endl;
+
+	for (int level = SIMD_SCALAR; level <= SimdEncoder::detectLevel(); ++level)
+	{
+		compressor.setSimdLevel((SimdLevel)level);
+
+		for (int nThreads = 1; ; nThreads = min(nThreads * 2, maxThreads))
+		{
+			compressor.setThreadCount(nThreads);
+			EncoderContext context(compressor);
+
+			double seconds = timeRuns([&] { context.compress(&image.pixels[0], image.width * 3, image.width, image.height, &blocks[0]); });
+			cout << "  " << setw(8) << SimdEncoder::levelName((SimdLevel)level) << " x" << setw(2) << nThreads << ": "
+				<< setw(9) << mPixels / seconds << " MPix/s " << setw(8) << nBlocks / seconds / 1e6 << " Mblocks/s" << endl;
+
+			if (nThreads == maxThreads)
+				break;
+		}
+	}
+}
+
+void Benchmark::benchDecompress(const Image& image)
+{
+	int nBlocks = (image.width / 4) * (image.height / 4);
+	double mPixels = (double)image.width * image.height / 1e6;
+	vector<Dxt1Block> blocks(nBlocks);
+	vector<RGBTriplet> decoded(image.pixels.size());
+
+	compressor.setSimdLevel(SimdEncoder::detectLevel());
+	EncoderContext context(compressor);
+	context.compress(&image.pixels[0], image.width * 3, image.width, image.height, &blocks[0]);
+
+	// one decompression alone gives the share of blocks reusing a memoized palette
+	long long hits = compressor.getPaletteCacheHits(), misses = compressor.getPaletteCacheMisses();
+	context.decompress(&blocks[0], image.width, image.height, &decoded[0], image.width * 3);
+	hits = compressor.getPaletteCacheHits() - hits;
+	misses = compressor.getPaletteCacheMisses() - misses;
+
+	cout << "decompressDDS (palette reuse " << 100.0 * hits / max(1LL, hits + misses) << "%)" << endl;
+
+	// the decoder has less kernels than the encoder, skip the levels falling back to the same kernel
+	SimdLevel previous = (SimdLevel)-1;
+	for (int level = SIMD_SCALAR; level <= SimdEncoder::detectLevel(); ++level)
+	{
+		compressor.setSimdLevel((SimdLevel)level);
+		if (compressor.simdDecoder.getLevel() == previous)
+			continue;
+		previous = compressor.simdDecoder.getLevel();
+
+		double seconds = timeRuns([&] { context.decompress(&blocks[0], image.width, image.height, &decoded[0], image.width * 3); });
+		cout << "  " << setw(8) << SimdEncoder::levelName(previous) << "    : "
+			<< setw(9) << mPixels / seconds << " MPix/s " << setw(8) << nBlocks / seconds / 1e6 << " Mblocks/s" << endl;
+	}
+}
+
+void Benchmark::measureQuality(const Image& image)
+{
+	vector<Dxt1Block> blocks((image.width / 4) * (image.height / 4));
+	vector<RGBTriplet> decoded(image.pixels.size());
+
+	compressor.setSimdLevel(SimdEncoder::detectLevel());
+	EncoderContext context(compressor);
+
+	cout << "quality" << endl;
+
+	const EncoderTier tiers[] = { TIER_INTENSITY, TIER_RANGE_FIT };
+	const char* tierNames[] = { "intensity", "range fit" };
+	for (int t = 0; t < 2; ++t)
+	{
+		compressor.setEncoderTier(tiers[t]);
+		context.compress(&image.pixels[0], image.width * 3, image.width, image.height, &blocks[0]);
+		context.decompress(&blocks[0], image.width, image.height, &decoded[0], image.width * 3);
+
+		double sumSq = 0;
+		for (size_t i = 0; i < decoded.size(); ++i)
+		{
+			int dr = decoded[i].r - image.pixels[i].r, dg = decoded[i].g - image.pixels[i].g, db = decoded[i].b - image.pixels[i].b;
+			sumSq += dr * dr + dg * dg + db * db;
+		}
+
+		double rmse = sqrt(sumSq / (decoded.size() * 3));
+		cout << "  " << setw(9) << tierNames[t] << "   : RMSE " << setw(6) << rmse << "  PSNR ";
+		if (rmse > 0)
+			cout << setw(6) << 20 * log10(255 / rmse) << " dB" << endl;
+		else
+			cout << "   inf" << endl;
+	}
+
+	compressor.setEncoderTier(TIER_INTENSITY);
+}
@@ -0,0 +1,114 @@
+/**
+Benchmark.h
+Purpose: Speed and quality measurements of the encoders and decoders. Synthetic images (gradient, noise, flat,
+photo-like) and BMP files are converted with every instruction set level and thread count, reporting MPix/s,
+blocks/s and the RMSE/PSNR of the decoded images
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Compressor.h"
+
+using namespace std;
+
+class Benchmark
+{
+private:
+	// an image to measure, pixels stored top to bottom without padding
+	struct Image
+	{
+		string name;
+		int width;
+		int height;
+		vector<RGBTriplet> pixels;
+	};
+
+	Compressor& compressor;
+	vector<Image> images;
+
+	// the thread counts measured are the powers of 2 below maxThreads, and maxThreads
+	int maxThreads;
+
+	// every measurement is repeated for at least this long
+	double minSeconds;
+
+	/**
+	Run fn until minSeconds elapsed (at least twice, the first run warms up the caches and is not timed)
+
+	@param fn function to time
+	@return average seconds per run
+	*/
+	template <class Fn>
+	double timeRuns(const Fn& fn) const;
+
+	/**
+	Time the block encoders alone on the image blocks (colors already gathered), on one thread
+
+	@param image the image
+	*/
+	void benchBlockEncoders(const Image& image);
+
+	/**
+	Time compressBMP for every instruction set level and thread count
+
+	@param image the image
+	*/
+	void benchCompress(const Image& image);
+
+	/**
+	Time decompressDDS for every decoder kernel
+
+	@param image the image
+	*/
+	void benchDecompress(const Image& image);
+
+	/**
+	Print the RMSE and PSNR of the image compressed with each encoder tier
+
+	@param image the image
+	*/
+	void measureQuality(const Image& image);
+
+public:
+	/**
+	@param compressor compressor to measure, its settings are changed by run()
+	*/
+	explicit Benchmark(Compressor& compressor);
+
+	/**
+	@param nThreads highest thread count measured, 0 (default) for one per hardware thread
+	*/
+	void setMaxThreads(const int nThreads);
+
+	/**
+	@param seconds minimum duration of every measurement, 0.25 by default
+	*/
+	void setMinSeconds(const double seconds) { minSeconds = seconds; }
+
+	/**
+	Add the synthetic images: a smooth gradient, random noise, a flat color and a photo-like image
+	(smooth shading, edges and grain)
+
+	@param width images width, divisible by 4
+	@param height images height, divisible by 4
+	*/
+	void addSyntheticImages(const int width, const int height);
+
+	/**
+	Add a 24bit or 32bit BMP file
+
+	@param filePath BMP file path
+	@return false if the file can't be read or is not a valid BMP file
+	*/
+	bool addImageFile(const string& filePath);
+
+	/**
+	Run all the measurements on all the images and print the results
+	*/
+	void run();
+};
@@ -0,0 +1,105 @@
+/**
+BlockCache.cpp
+Purpose: Cache of compressed blocks keyed by their 16 colors
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <string.h>
+#include "BlockCache.h"
+
+unsigned int BlockCache::hashColors(const RGBTriplet* colors)
+{
+	// 6 x 64bit words, multiply-xorshift mixing
+	unsigned long long hash = 0;
+	for (int i = 0; i < 6; ++i)
+	{
+		unsigned long long word;
+		memcpy(&word, (const byte*)colors + i * 8, 8);
+		hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 29;
+	}
+	return (unsigned int)(hash ^ (hash >> 32));
+}
+
+void BlockCache::init(ScratchArena& arena, const int nEntries, const int maxRowBlocks)
+{
+	unsigned int size = 1;
+	while (size * 2 <= (unsigned int)nEntries)
+		size *= 2;
+
+	// only the state of an empty entry is read
+	entries = arena.allocateArray<Entry>(size);
+	for (unsigned int i = 0; i < size; ++i)
+		entries[i].state = 0;
+	mask = size - 1;
+
+	missColors = arena.allocateArray<RGBTriplet>((size_t)maxRowBlocks * 16);
+	missBlocks = arena.allocateArray<Dxt1Block>(maxRowBlocks);
+	missEntries = arena.allocateArray<Entry*>(maxRowBlocks);
+	blockSources = arena.allocateArray<int>(maxRowBlocks);
+	nMisses = 0;
+
+	hits = 0;
+	misses = 0;
+}
+
+int BlockCache::collectMisses(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks)
+{
+	nMisses = 0;
+
+	for (int i = 0; i < nBlocks; ++i)
+	{
+		const RGBTriplet* colors = blockColors + i * 16;
+		unsigned int hash = hashColors(colors);
+		Entry& entry = entries[hash & mask];
+
+		if (entry.state != 0 && entry.hash == hash && memcmp(entry.colors, colors, sizeof(entry.colors)) == 0)
+		{
+			++hits;
+			if (entry.state == 1)
+			{
+				blocks[i] = entry.block;
+				blockSources[i] = -1;
+			}
+			else // same colors as a miss of this row
+			{
+				blockSources[i] = entry.state - 2;
+			}
+			continue;
+		}
+
+		// miss: compress it, the entry (evicted if used) will hold it
+		++misses;
+		memcpy(missColors + nMisses * 16, colors, sizeof(entry.colors));
+		memcpy(entry.colors, colors, sizeof(entry.colors));
+		entry.hash = hash;
+		entry.state = 2 + nMisses;
+		missEntries[nMisses] = &entry;
+		blockSources[i] = nMisses;
+		++nMisses;
+	}
+
+	return nMisses;
+}
+
+void BlockCache::storeMisses(Dxt1Block* blocks, const int nBlocks)
+{
+	for (int i = 0; i < nBlocks; ++i)
+	{
+		if (blockSources[i] >= 0)
+			blocks[i] = missBlocks[blockSources[i]];
+	}
+
+	// a miss entry may have been taken by a later miss of the row, only the last one is kept
+	for (int k = 0; k < nMisses; ++k)
+	{
+		Entry* entry = missEntries[k];
+		if (entry->state == 2 + k)
+		{
+			entry->block = missBlocks[k];
+			entry->state = 1;
+		}
+	}
+}
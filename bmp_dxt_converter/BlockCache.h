@@ -0,0 +1,94 @@
+/**
+BlockCache.h
+Purpose: Cache of compressed blocks keyed by their 16 colors, so the repeated blocks of atlases, sprite sheets
+and tiled textures are compressed once. A cache is used by a single thread (one per thread of a compression)
+and works a row of blocks at a time: the hits are copied, the misses gathered for the encoder, then stored.
+Duplicates inside the row are only compressed once too.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include "bmp_dxt1_headers.h"
+#include "ScratchArena.h"
+
+// entries per thread used by Compressor::setBlockCache, 256KB (fits in the L2 cache)
+#define BLOCK_CACHE_ENTRIES 4096
+
+class BlockCache
+{
+private:
+	// one cached block, 64 bytes
+	struct Entry
+	{
+		RGBTriplet colors[16];
+		Dxt1Block block;
+		unsigned int hash;
+		int state; // 0: empty, 1: block ready, 2 + k: being compressed as miss k of the current row
+	};
+
+	// direct mapped table, nEntries is a power of 2
+	Entry* entries;
+	unsigned int mask;
+
+	// misses of the current row: colors and blocks (consecutive, for the encoder) and their table entries
+	RGBTriplet* missColors;
+	Dxt1Block* missBlocks;
+	Entry** missEntries;
+	int nMisses;
+
+	// source of every block of the current row: -1 cache hit, k >= 0 miss k
+	int* blockSources;
+
+	long long hits;
+	long long misses;
+
+	/**
+	Hash of a block colors (48 bytes)
+	*/
+	static unsigned int hashColors(const RGBTriplet* colors);
+
+public:
+	/**
+	Set up an empty cache, all memory comes from the arena
+
+	@param arena scratch memory
+	@param nEntries table size, rounded down to a power of 2
+	@param maxRowBlocks largest number of blocks passed to collectMisses
+	*/
+	void init(ScratchArena& arena, const int nEntries, const int maxRowBlocks);
+
+	/**
+	Look a row of blocks up: the blocks found are written to their target, the others are gathered
+	(without duplicates) in getMissColors() for the encoder
+
+	@param blockColors source colors, 16 consecutive colors per block
+	@param blocks target blocks
+	@param nBlocks number of blocks, at most maxRowBlocks
+	@return number of blocks to compress
+	*/
+	int collectMisses(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks);
+
+	/**
+	Colors of the blocks to compress, 16 consecutive colors per block
+	*/
+	const RGBTriplet* getMissColors() const { return missColors; }
+
+	/**
+	Target of the compressed blocks, in the same order as getMissColors()
+	*/
+	Dxt1Block* getMissBlocks() { return missBlocks; }
+
+	/**
+	Copy the compressed misses to their targets in the row and store them in the cache
+
+	@param blocks target blocks passed to collectMisses
+	@param nBlocks number of blocks passed to collectMisses
+	*/
+	void storeMisses(Dxt1Block* blocks, const int nBlocks);
+
+	long long getHits() const { return hits; }
+	long long getMisses() const { return misses; }
+};
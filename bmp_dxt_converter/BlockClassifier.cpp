@@ -0,0 +1,426 @@
+/**
+BlockClassifier.cpp
+Purpose: Block classes and the encoders of the solid, two-color and low-variance blocks
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdlib.h>
+#include <string.h>
+#include "BlockClassifier.h"
+#include "SimdDecoder.h"
+
+#ifdef BLOCK_CLASSIFIER_SSE2
+#include <emmintrin.h>
+#endif
+
+// bit 3 * i of the compare masks, for each pixel i of a block
+#define PIXEL_BITS	0x249249249249ull
+
+// power iterations of the principal axis of the low-variance blocks (from a covariance matrix row)
+#define LOW_VARIANCE_ITERATIONS	2
+
+BlockClassifier::BlockClassifier()
+{
+	for (int value = 0; value < 256; ++value)
+	{
+		// c2 of every pair of end points, ties go to the closest end points (a == b needs no interpolation)
+		int bestError = INT_MAX;
+		for (int a = 0; a < 32; ++a)
+		{
+			for (int b = 0; b < 32; ++b)
+			{
+				int error = abs((2 * expand5To8[a] + expand5To8[b]) / 3 - value);
+				if (error < bestError || (error == bestError && abs(a - b) < abs(solid5[value][0] - solid5[value][1])))
+				{
+					bestError = error;
+					solid5[value][0] = a;
+					solid5[value][1] = b;
+				}
+			}
+		}
+
+		bestError = INT_MAX;
+		for (int a = 0; a < 64; ++a)
+		{
+			for (int b = 0; b < 64; ++b)
+			{
+				int error = abs((2 * expand6To8[a] + expand6To8[b]) / 3 - value);
+				if (error < bestError || (error == bestError && abs(a - b) < abs(solid6[value][0] - solid6[value][1])))
+				{
+					bestError = error;
+					solid6[value][0] = a;
+					solid6[value][1] = b;
+				}
+			}
+		}
+
+		round5[value] = 0;
+		for (int q = 1; q < 32; ++q)
+			round5[value] = abs(expand5To8[q] - value) < abs(expand5To8[round5[value]] - value) ? q : round5[value];
+
+		round6[value] = 0;
+		for (int q = 1; q < 64; ++q)
+			round6[value] = abs(expand6To8[q] - value) < abs(expand6To8[round6[value]] - value) ? q : round6[value];
+	}
+}
+
+#ifdef BLOCK_CLASSIFIER_SSE2
+
+// pixels of a block (rows: its 48 bytes) with the same color, bit 3 * i set for pixel i
+static inline unsigned long long equalPixels(const __m128i* rows, const RGBTriplet& color)
+{
+	// the color repeated from its first, second and third byte (8 bytes each), built in registers: bytes stored
+	// one by one and loaded 16 at a time would stall the loads
+	unsigned long long channels0 = color.b | color.g << 8 | color.r << 16;
+	unsigned long long channels1 = color.g | color.r << 8 | color.b << 16;
+	unsigned long long channels2 = color.r | color.b << 8 | color.g << 16;
+	long long repeat0 = (long long)(channels0 * 0x0001000001000001ull);
+	long long repeat1 = (long long)(channels1 * 0x0001000001000001ull);
+	long long repeat2 = (long long)(channels2 * 0x0001000001000001ull);
+
+	// bytes 0, 8, 16, 24, 32 and 40 of the block start at the first, third, second, first, third and second channel
+	unsigned long long mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(rows[0], _mm_set_epi64x(repeat2, repeat0)));
+	mask |= (unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8(rows[1], _mm_set_epi64x(repeat0, repeat1))) << 16;
+	mask |= (unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8(rows[2], _mm_set_epi64x(repeat1, repeat2))) << 32;
+
+	// the 3 bytes of a pixel
+	return mask & mask >> 1 & mask >> 2 & PIXEL_BITS;
+}
+
+// BLOCK_SOLID, BLOCK_TWO_COLOR (and the index of a pixel of the second color) or BLOCK_GENERAL
+static inline BlockClass fewColorsClass(const RGBTriplet* blockColors, int& secondColor)
+{
+	const byte* bytes = (const byte*)blockColors;
+	__m128i rows[3];
+	rows[0] = _mm_loadu_si128((const __m128i*)bytes);
+	rows[1] = _mm_loadu_si128((const __m128i*)(bytes + 16));
+	rows[2] = _mm_loadu_si128((const __m128i*)(bytes + 32));
+
+	unsigned long long equalFirst = equalPixels(rows, blockColors[0]);
+	if (equalFirst == PIXEL_BITS)
+		return BLOCK_SOLID;
+
+	int second = 1;
+	while (equalFirst >> second * 3 & 1)
+		++second;
+
+	if ((equalFirst | equalPixels(rows, blockColors[second])) != PIXEL_BITS)
+		return BLOCK_GENERAL;
+
+	secondColor = second;
+	return BLOCK_TWO_COLOR;
+}
+
+// every channel range within BLOCK_LOW_VARIANCE_RANGE
+static inline bool lowVarianceBlock(const RGBTriplet* blockColors)
+{
+	// byte i of the 4 loads (at bytes 0, 15, 30 and 33) is channel i % 3, the last one ends with a 0 byte
+	const byte* bytes = (const byte*)blockColors;
+	const __m128i ones = _mm_set1_epi8(-1);
+	__m128i load0 = _mm_loadu_si128((const __m128i*)bytes);
+	__m128i load15 = _mm_loadu_si128((const __m128i*)(bytes + 15));
+	__m128i load30 = _mm_loadu_si128((const __m128i*)(bytes + 30));
+	__m128i load33 = _mm_srli_si128(_mm_loadu_si128((const __m128i*)(bytes + 32)), 1);
+	__m128i high = _mm_max_epu8(_mm_max_epu8(load0, load15), _mm_max_epu8(load30, load33));
+	__m128i low = _mm_min_epu8(_mm_min_epu8(load0, load15), _mm_min_epu8(load30, _mm_or_si128(load33, _mm_slli_si128(ones, 15))));
+
+	// the maximum of the bytes 3 apart into bytes 0..2, the minimum as the maximum of the complements
+	// (the bytes shifted in are 0)
+	low = _mm_xor_si128(low, ones);
+	high = _mm_max_epu8(high, _mm_srli_si128(high, 3));
+	low = _mm_max_epu8(low, _mm_srli_si128(low, 3));
+	high = _mm_max_epu8(high, _mm_srli_si128(high, 6));
+	low = _mm_max_epu8(low, _mm_srli_si128(low, 6));
+	high = _mm_max_epu8(high, _mm_srli_si128(high, 12));
+	low = _mm_max_epu8(low, _mm_srli_si128(low, 12));
+
+	__m128i range = _mm_subs_epu8(high, _mm_xor_si128(low, ones));
+	__m128i over = _mm_subs_epu8(range, _mm_set1_epi8(BLOCK_LOW_VARIANCE_RANGE));
+	return (_mm_movemask_epi8(_mm_cmpeq_epi8(over, _mm_setzero_si128())) & 0x7) == 0x7;
+}
+
+#else
+
+static inline bool sameColor(const RGBTriplet& color0, const RGBTriplet& color1)
+{
+	return color0.r == color1.r && color0.g == color1.g && color0.b == color1.b;
+}
+
+static inline BlockClass fewColorsClass(const RGBTriplet* blockColors, int& secondColor)
+{
+	int second = 1;
+	while (second < 16 && sameColor(blockColors[second], blockColors[0]))
+		++second;
+
+	if (second == 16)
+		return BLOCK_SOLID;
+
+	for (int i = second + 1; i < 16; ++i)
+	{
+		if (!sameColor(blockColors[i], blockColors[0]) && !sameColor(blockColors[i], blockColors[second]))
+			return BLOCK_GENERAL;
+	}
+
+	secondColor = second;
+	return BLOCK_TWO_COLOR;
+}
+
+static inline bool lowVarianceBlock(const RGBTriplet* blockColors)
+{
+	int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		low[0] = min(low[0], (int)blockColors[i].r);
+		low[1] = min(low[1], (int)blockColors[i].g);
+		low[2] = min(low[2], (int)blockColors[i].b);
+		high[0] = max(high[0], (int)blockColors[i].r);
+		high[1] = max(high[1], (int)blockColors[i].g);
+		high[2] = max(high[2], (int)blockColors[i].b);
+	}
+
+	return high[0] - low[0] <= BLOCK_LOW_VARIANCE_RANGE && high[1] - low[1] <= BLOCK_LOW_VARIANCE_RANGE
+		&& high[2] - low[2] <= BLOCK_LOW_VARIANCE_RANGE;
+}
+
+#endif
+
+static inline unsigned int colorKey(const RGBTriplet& color)
+{
+	return color.b | color.g << 8 | color.r << 16;
+}
+
+BlockClass BlockClassifier::classify(const RGBTriplet* blockColors, const bool lowVariance, int& secondColor)
+{
+	// three colors among the first 4 pixels (most blocks of photos) rule out the solid and two-color blocks
+	// before comparing all the pixels
+	unsigned int key0 = colorKey(blockColors[0]), key2 = colorKey(blockColors[2]), key3 = colorKey(blockColors[3]);
+	unsigned int other = colorKey(blockColors[1]);
+	other = other != key0 ? other : key2 != key0 ? key2 : key3;
+	bool threeColors = (key2 != key0 && key2 != other) || (key3 != key0 && key3 != other);
+
+	if (!threeColors)
+	{
+		BlockClass blockClass = fewColorsClass(blockColors, secondColor);
+		if (blockClass != BLOCK_GENERAL)
+			return blockClass;
+	}
+
+	return lowVariance && lowVarianceBlock(blockColors) ? BLOCK_LOW_VARIANCE : BLOCK_GENERAL;
+}
+
+bool BlockClassifier::compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& block, const bool lowVariance) const
+{
+	int secondColor;
+	switch (classify(blockColors, lowVariance, secondColor))
+	{
+	case BLOCK_SOLID:
+		compressSolid(blockColors[0], block);
+		return true;
+
+	case BLOCK_TWO_COLOR:
+		compressTwoColor(blockColors, 0, secondColor, block);
+		return true;
+
+	case BLOCK_LOW_VARIANCE:
+		compressLowVariance(blockColors, block);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void BlockClassifier::compressSolid(const RGBTriplet& color, Dxt1Block& block) const
+{
+	unsigned short c0 = solid5[color.r][0] << 11 | solid6[color.g][0] << 5 | solid5[color.b][0];
+	unsigned short c1 = solid5[color.r][1] << 11 | solid6[color.g][1] << 5 | solid5[color.b][1];
+
+	// every pixel takes c2 = (2 * c0 + c1) / 3, which is c3 once c0 and c1 are swapped to keep c0 bigger,
+	// and c0 if the end points are the same
+	byte indices = 0xAA;
+	if (c0 < c1)
+	{
+		swap(c0, c1);
+		indices = 0xFF;
+	}
+	else if (c0 == c1)
+	{
+		indices = 0;
+	}
+
+	block.c0 = c0;
+	block.c1 = c1;
+	memset(block.indices, indices, 4);
+}
+
+void BlockClassifier::compressTwoColor(const RGBTriplet* blockColors, const int first, const int second, Dxt1Block& block) const
+{
+	// the two colors are the end points
+	unsigned short c0 = round565(blockColors[first]), c1 = round565(blockColors[second]);
+	if (c0 == c1)
+	{
+		// both round to the same color, c2 or c3 may still tell them apart
+		compressLowVariance(blockColors, block);
+		return;
+	}
+
+	block.c0 = max(c0, c1);
+	block.c1 = min(c0, c1);
+	fitIndices(blockColors, block);
+}
+
+void BlockClassifier::compressLowVariance(const RGBTriplet* blockColors, Dxt1Block& block) const
+{
+	// colors by channel (r, g, b) scaled by 16, so the mean (the sum) is an integer
+	int colors[3][16], sum[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		colors[0][i] = blockColors[i].r * 16;
+		colors[1][i] = blockColors[i].g * 16;
+		colors[2][i] = blockColors[i].b * 16;
+		sum[0] += blockColors[i].r;
+		sum[1] += blockColors[i].g;
+		sum[2] += blockColors[i].b;
+	}
+
+	// covariance matrix of the colors (the deviations from the mean scaled by 16 fit in 13 bits, the sums in 32)
+	int covariance[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+	for (int i = 0; i < 16; ++i)
+	{
+		int dr = colors[0][i] - sum[0], dg = colors[1][i] - sum[1], db = colors[2][i] - sum[2];
+		covariance[0][0] += dr * dr;
+		covariance[0][1] += dr * dg;
+		covariance[0][2] += dr * db;
+		covariance[1][1] += dg * dg;
+		covariance[1][2] += dg * db;
+		covariance[2][2] += db * db;
+	}
+	covariance[1][0] = covariance[0][1];
+	covariance[2][0] = covariance[0][2];
+	covariance[2][1] = covariance[1][2];
+
+	// the end points are the pixel extremes along the principal axis of the colors: LOW_VARIANCE_ITERATIONS power
+	// iterations from the covariance matrix row of the channel with the largest variance
+	int major = 0;
+	for (int c = 1; c < 3; ++c)
+		major = covariance[c][c] > covariance[major][major] ? c : major;
+
+	// (without normalization: LOW_VARIANCE_ITERATIONS products of covariances below 2^28 stay in float range)
+	float axis[3] = { (float)covariance[major][0], (float)covariance[major][1], (float)covariance[major][2] };
+	for (int iteration = 0; iteration < LOW_VARIANCE_ITERATIONS; ++iteration)
+	{
+		float next[3];
+		for (int c = 0; c < 3; ++c)
+			next[c] = covariance[c][0] * axis[0] + covariance[c][1] * axis[1] + covariance[c][2] * axis[2];
+
+		axis[0] = next[0];
+		axis[1] = next[1];
+		axis[2] = next[2];
+	}
+
+	// the axis in fixed point (largest component 1024) for the projections
+	float norm = max(fabs(axis[0]), max(fabs(axis[1]), fabs(axis[2])));
+	float axisScale = norm > 0 ? 1024 / norm : 0;
+	int fixedAxis[3] = { (int)(axis[0] * axisScale), (int)(axis[1] * axisScale), (int)(axis[2] * axisScale) };
+
+	int minProjection = 0, maxProjection = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int projection = (colors[0][i] - sum[0]) * fixedAxis[0] + (colors[1][i] - sum[1]) * fixedAxis[1] + (colors[2][i] - sum[2]) * fixedAxis[2];
+		minProjection = min(minProjection, projection);
+		maxProjection = max(maxProjection, projection);
+	}
+
+	int axisLength2 = fixedAxis[0] * fixedAxis[0] + fixedAxis[1] * fixedAxis[1] + fixedAxis[2] * fixedAxis[2];
+	float scale = axisLength2 > 0 ? 1.0f / (axisLength2 * 16.0f) : 0;
+	int end0[3], end1[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		end0[c] = (int)(min(max(sum[c] / 16.0f + fixedAxis[c] * (maxProjection * scale), 0.0f), 255.0f) + 0.5f);
+		end1[c] = (int)(min(max(sum[c] / 16.0f + fixedAxis[c] * (minProjection * scale), 0.0f), 255.0f) + 0.5f);
+	}
+
+	unsigned short c0 = round565(RGBTriplet(end0[0], end0[1], end0[2]));
+	unsigned short c1 = round565(RGBTriplet(end1[0], end1[1], end1[2]));
+	if (c0 == c1)
+	{
+		// a single 565 color, the best one for the mean color
+		compressSolid(RGBTriplet((sum[0] + 8) / 16, (sum[1] + 8) / 16, (sum[2] + 8) / 16), block);
+		return;
+	}
+
+	block.c0 = max(c0, c1);
+	block.c1 = min(c0, c1);
+
+	// the pixels projected on the decoded c0 -> c1 line fall between 2 consecutive colors of c0, c2, c3, c1,
+	// the closest of the two (decoded, as ErrorMetrics::blockError) is the index
+	int r[4], g[4], b[4];
+	r[0] = expand5To8[block.c0 >> 11];
+	g[0] = expand6To8[(block.c0 >> 5) & 0x3F];
+	b[0] = expand5To8[block.c0 & 0x1F];
+	r[3] = expand5To8[block.c1 >> 11];
+	g[3] = expand6To8[(block.c1 >> 5) & 0x3F];
+	b[3] = expand5To8[block.c1 & 0x1F];
+	r[1] = (2 * r[0] + r[3]) / 3;
+	g[1] = (2 * g[0] + g[3]) / 3;
+	b[1] = (2 * b[0] + b[3]) / 3;
+	r[2] = (r[0] + 2 * r[3]) / 3;
+	g[2] = (g[0] + 2 * g[3]) / 3;
+	b[2] = (b[0] + 2 * b[3]) / 3;
+
+	int dr = r[3] - r[0], dg = g[3] - g[0], db = b[3] - b[0];
+	float stepScale = 3.0f / (dr * dr + dg * dg + db * db);
+	static const byte stepToIndex[4] = { 0, 2, 3, 1 };
+
+	unsigned int indices = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int projection = (blockColors[i].r - r[0]) * dr + (blockColors[i].g - g[0]) * dg + (blockColors[i].b - b[0]) * db;
+		int step = min(max((int)(projection * stepScale), 0), 2);
+
+		int er = blockColors[i].r - r[step], eg = blockColors[i].g - g[step], eb = blockColors[i].b - b[step];
+		int nr = blockColors[i].r - r[step + 1], ng = blockColors[i].g - g[step + 1], nb = blockColors[i].b - b[step + 1];
+		step += nr * nr + ng * ng + nb * nb < er * er + eg * eg + eb * eb;
+		indices |= stepToIndex[step] << i * 2;
+	}
+
+	for (int i = 0; i < 4; ++i)
+		block.indices[i] = (byte)(indices >> i * 8);
+}
+
+void BlockClassifier::fitIndices(const RGBTriplet* blockColors, Dxt1Block& block)
+{
+	// decoded palette, same integer math as ErrorMetrics::blockError and the decoder
+	int r[4], g[4], b[4];
+	r[0] = expand5To8[block.c0 >> 11];
+	g[0] = expand6To8[(block.c0 >> 5) & 0x3F];
+	b[0] = expand5To8[block.c0 & 0x1F];
+	r[1] = expand5To8[block.c1 >> 11];
+	g[1] = expand6To8[(block.c1 >> 5) & 0x3F];
+	b[1] = expand5To8[block.c1 & 0x1F];
+	r[2] = (2 * r[0] + r[1]) / 3;
+	g[2] = (2 * g[0] + g[1]) / 3;
+	b[2] = (2 * b[0] + b[1]) / 3;
+	r[3] = (r[0] + 2 * r[1]) / 3;
+	g[3] = (g[0] + 2 * g[1]) / 3;
+	b[3] = (b[0] + 2 * b[1]) / 3;
+
+	memset(block.indices, 0, 4);
+	for (int i = 0; i < 16; ++i)
+	{
+		int bestIndex = 0, bestDistance = INT_MAX;
+		for (int j = 0; j < 4; ++j)
+		{
+			int dr = blockColors[i].r - r[j], dg = blockColors[i].g - g[j], db = blockColors[i].b - b[j];
+			int distance = dr * dr + dg * dg + db * db;
+			bestIndex = distance < bestDistance ? j : bestIndex;
+			bestDistance = distance < bestDistance ? distance : bestDistance;
+		}
+		block.indices[i / 4] |= bestIndex << (i % 4) * 2;
+	}
+}
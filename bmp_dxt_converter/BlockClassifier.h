@@ -0,0 +1,108 @@
+/**
+BlockClassifier.h
+Purpose: Cheap pre-classification of the blocks before the encoders. Solid blocks (a single color) take their end
+points from tables of the optimal single color end points of every 8 bit value, two-color blocks take the two colors
+(rounded) as end points. Low-variance blocks (every channel within BLOCK_LOW_VARIANCE_RANGE) have a lighter principal
+axis fit than RangeEncoder, they only skip the range fit (the SIMD intensity kernels are faster). Only the general
+blocks go through the fit of the encoder tier.
+The classification is SSE2 compares and byte min/max (scalar on other CPUs), the results are the same on both paths.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include "bmp_dxt1_headers.h"
+#include "SimdEncoder.h"
+
+using namespace std;
+
+#if defined(SIMD_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BLOCK_CLASSIFIER_SSE2
+#endif
+
+// largest range (max - min) of every channel of a low-variance block
+#define BLOCK_LOW_VARIANCE_RANGE	24
+
+// blocks by the colors of their 16 pixels
+enum BlockClass
+{
+	BLOCK_SOLID = 0,		// a single color
+	BLOCK_TWO_COLOR,		// two colors
+	BLOCK_LOW_VARIANCE,		// more colors, close to each other
+	BLOCK_GENERAL,			// more colors
+	BLOCK_CLASS_COUNT
+};
+
+class BlockClassifier
+{
+private:
+	// optimal end points (5 or 6 bit values, c0 then c1) of a channel of a single color: c2 = (2 * c0 + c1) / 3,
+	// decoded, is the closest to the 8 bit value
+	byte solid5[256][2];
+	byte solid6[256][2];
+
+	// closest 5 and 6 bit values of an 8 bit value (decoded)
+	byte round5[256];
+	byte round6[256];
+
+	/**
+	Classify a block
+
+	@param blockColors the 16 pixel colors
+	@param lowVariance false to skip the low-variance test (those blocks are then general)
+	@param secondColor receives the index of a pixel of the second color of a two-color block
+	*/
+	static BlockClass classify(const RGBTriplet* blockColors, const bool lowVariance, int& secondColor);
+
+	/**
+	Closest 565 color of an 8 bit color
+	*/
+	unsigned short round565(const RGBTriplet& color) const
+	{
+		return round5[color.r] << 11 | round6[color.g] << 5 | round5[color.b];
+	}
+
+	/**
+	Fill the indices of a block with its closest palette colors, c0 must be bigger than c1
+	*/
+	static void fitIndices(const RGBTriplet* blockColors, Dxt1Block& block);
+
+public:
+	/**
+	Build the tables
+	*/
+	BlockClassifier();
+
+	/**
+	Classify the 16 pixel colors of a block
+	*/
+	static BlockClass classify(const RGBTriplet* blockColors)
+	{
+		int secondColor;
+		return classify(blockColors, true, secondColor);
+	}
+
+	/**
+	Compress a block with the encoder of its class
+
+	@param blockColors the 16 pixel colors
+	@param block target block
+	@param lowVariance false to leave the low-variance blocks to the encoder tier, when it is faster
+	@return false (block untouched) for a block left to the encoder tier
+	*/
+	bool compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& block, const bool lowVariance) const;
+
+	/**
+	Specialized encoders
+
+	@param color color of the solid block
+	@param blockColors the 16 pixel colors
+	@param first, second indices of a pixel of each color of a two-color block
+	@param block target block
+	*/
+	void compressSolid(const RGBTriplet& color, Dxt1Block& block) const;
+	void compressTwoColor(const RGBTriplet* blockColors, const int first, const int second, Dxt1Block& block) const;
+	void compressLowVariance(const RGBTriplet* blockColors, Dxt1Block& block) const;
+};
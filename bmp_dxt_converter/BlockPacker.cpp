@@ -0,0 +1,415 @@
+/**
+BlockPacker.cpp
+Purpose: Packs DDS files into a smaller container (.ddz) and expands them back
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include "BlockPacker.h"
+#include "MappedFile.h"
+#include "Pipeline.h"
+#include "RansCoder.h"
+
+// delta of a channel from its previous value, wrapped to the channel bits then zigzag mapped (0, -1, 1, -2... -> 0, 1, 2, 3...).
+// Branchless: the deltas of noisy images are unpredictable.
+static inline byte encodeDelta(const int value, const int previous, const int bits)
+{
+	int delta = (int)((unsigned int)(value - previous) << (32 - bits)) >> (32 - bits);
+	return (byte)((unsigned int)delta << 1 ^ (unsigned int)(delta >> 31));
+}
+
+// inverse of encodeDelta
+static inline int decodeDelta(const byte zigzag, const int previous, const int bits)
+{
+	int delta = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+	return (previous + delta) & ((1 << bits) - 1);
+}
+
+// the 3 channel deltas of an end point (red, green, blue), previous: the channels of the same end point in the previous block
+static inline void encodeEndpoint(const unsigned short color, int* previous, byte* endpoints)
+{
+	int red = color >> 11, green = (color >> 5) & 0x3F, blue = color & 0x1F;
+	endpoints[0] = encodeDelta(red, previous[0], 5);
+	endpoints[1] = encodeDelta(green, previous[1], 6);
+	endpoints[2] = encodeDelta(blue, previous[2], 5);
+	previous[0] = red;
+	previous[1] = green;
+	previous[2] = blue;
+}
+
+// inverse of encodeEndpoint
+static inline unsigned short decodeEndpoint(const byte* endpoints, int* previous)
+{
+	previous[0] = decodeDelta(endpoints[0], previous[0], 5);
+	previous[1] = decodeDelta(endpoints[1], previous[1], 6);
+	previous[2] = decodeDelta(endpoints[2], previous[2], 5);
+	return (unsigned short)(previous[0] << 11 | previous[1] << 5 | previous[2]);
+}
+
+void BlockPacker::splitBlocks(const Dxt1Block* blocks, const int nBlocks, byte* endpoints, byte* indices)
+{
+	// channels of the previous block end points (c0 red, green, blue then c1), neighbor blocks have close colors
+	int previous[6] = { 0 };
+
+	for (int i = 0; i < nBlocks; ++i, endpoints += DDZ_ENDPOINT_BYTES)
+	{
+		encodeEndpoint(blocks[i].c0, previous, endpoints);
+		encodeEndpoint(blocks[i].c1, previous + 3, endpoints + 3);
+		memcpy(indices + i * 4, blocks[i].indices, 4);
+	}
+}
+
+void BlockPacker::mergeBlocks(const byte* endpoints, const byte* indices, const int nBlocks, Dxt1Block* blocks)
+{
+	int previous[6] = { 0 };
+
+	for (int i = 0; i < nBlocks; ++i, endpoints += DDZ_ENDPOINT_BYTES)
+	{
+		blocks[i].c0 = decodeEndpoint(endpoints, previous);
+		blocks[i].c1 = decodeEndpoint(endpoints + 3, previous + 3);
+		memcpy(blocks[i].indices, indices + i * 4, 4);
+	}
+}
+
+size_t BlockPacker::packStream(const byte* symbols, const size_t nSymbols, byte* target)
+{
+	DDZ_STREAM header;
+	byte* data = target + sizeof(DDZ_STREAM);
+
+	size_t size = nSymbols > 0 ? RansCoder::encode(symbols, nSymbols, data) : 0;
+	header.coded = size < nSymbols;
+	if (!header.coded)
+	{
+		memcpy(data, symbols, nSymbols);
+		size = nSymbols;
+	}
+
+	header.size = (unsigned int)size;
+	memcpy(target, &header, sizeof(DDZ_STREAM));
+	return sizeof(DDZ_STREAM) + size;
+}
+
+size_t BlockPacker::unpackStream(const byte* source, const size_t sourceSize, byte* symbols, const size_t nSymbols)
+{
+	DDZ_STREAM header;
+	if (sourceSize < sizeof(DDZ_STREAM))
+		return 0;
+
+	memcpy(&header, source, sizeof(DDZ_STREAM));
+	if (header.size > sourceSize - sizeof(DDZ_STREAM))
+		return 0;
+
+	const byte* data = source + sizeof(DDZ_STREAM);
+	if (header.coded)
+	{
+		if (!RansCoder::decode(data, header.size, symbols, nSymbols))
+			return 0;
+	}
+	else
+	{
+		if (header.size != nSymbols)
+			return 0;
+		memcpy(symbols, data, nSymbols);
+	}
+
+	return sizeof(DDZ_STREAM) + header.size;
+}
+
+unsigned long long BlockPacker::hashChunk(const Dxt1Block* blocks, const int nBlocks)
+{
+	ContentHash hash;
+	hash.update((const byte*)blocks, (size_t)nBlocks * sizeof(Dxt1Block));
+	return hash.digest().low;
+}
+
+unsigned long long BlockPacker::checksum(const DDS_HEADER& ddsHeader, const unsigned long long* chunkHashes, const int nChunks)
+{
+	ContentHash hash;
+	hash.update((const byte*)&ddsHeader, sizeof(DDS_HEADER));
+	hash.update((const byte*)chunkHashes, (size_t)nChunks * sizeof(unsigned long long));
+	return hash.digest().low;
+}
+
+bool BlockPacker::pack(const string& filePath, const string& outputPath)
+{
+	// the blocks are read straight from the mapping
+	MappedFile ddsFile;
+	if (!ddsFile.openRead(filePath))
+	{
+		cout << "- file not found." << endl;
+		return false;
+	}
+
+	DDS_HEADER ddsHeader;
+	if (ddsFile.size() < sizeof(DDS_HEADER))
+	{
+		cout << "Invalid DDS file." << endl;
+		return false;
+	}
+
+	memcpy(&ddsHeader, ddsFile.data(), sizeof(DDS_HEADER));
+	if (!compressor.isValidDDSFile(ddsHeader))
+		return false;
+
+	// only the blocks are kept, whatever follows them would be lost
+	size_t blocksSize = ddsFile.size() - sizeof(DDS_HEADER);
+	if (blocksSize % sizeof(Dxt1Block) != 0)
+	{
+		cout << "* " << filePath << " has data after its blocks, it can't be packed." << endl;
+		return false;
+	}
+
+	DDZ_HEADER header;
+	memset(&header, 0, sizeof(DDZ_HEADER));
+	header.magic = DDZ_MAGIC;
+	header.chunkBlocks = DDZ_CHUNK_BLOCKS;
+	header.nBlocks = blocksSize / sizeof(Dxt1Block);
+	header.nChunks = (unsigned int)((header.nBlocks + DDZ_CHUNK_BLOCKS - 1) / DDZ_CHUNK_BLOCKS);
+	header.ddsHeader = ddsHeader;
+
+	const Dxt1Block* blocks = (const Dxt1Block*)(ddsFile.data() + sizeof(DDS_HEADER));
+	int nChunks = (int)header.nChunks;
+
+	// header and chunk table first, the table is written again once the chunk sizes are known
+	vector<DDZ_CHUNK> chunks(nChunks);
+	memset(chunks.data(), 0, chunks.size() * sizeof(DDZ_CHUNK));
+	vector<unsigned long long> chunkHashes(nChunks);
+
+	ofstream packedFile;
+	packedFile.open(outputPath, ofstream::out | ofstream::binary);
+	packedFile.write((char*)&header, sizeof(DDZ_HEADER));
+	packedFile.write((char*)chunks.data(), (streamsize)chunks.size() * sizeof(DDZ_CHUNK));
+	if (!packedFile)
+	{
+		cout << "- can't create " << outputPath << endl;
+		return false;
+	}
+
+	// the chunks are coded in groups of one chunk per thread going through a pipeline: a group is read from the
+	// mapping while the previous one is coded and the one before is written
+	int nThreads = compressor.threadPool->size();
+	int groupChunks = nThreads;
+	int nGroups = (nChunks + groupChunks - 1) / groupChunks;
+	size_t maxChunkSize = 2 * sizeof(DDZ_STREAM) + RansCoder::maxEncodedSize((size_t)DDZ_CHUNK_BLOCKS * DDZ_ENDPOINT_BYTES) +
+		RansCoder::maxEncodedSize((size_t)DDZ_CHUNK_BLOCKS * 4);
+
+	// groupBuffers: the coded chunks of each slot's group, splitBuffers: the streams of each thread's chunk
+	ScratchArena arena;
+	Pipeline pipeline;
+	byte* groupBuffers[PIPELINE_SLOTS];
+	for (int slot = 0; slot < pipeline.slotCount(); ++slot)
+		groupBuffers[slot] = arena.allocateArray<byte>(maxChunkSize * groupChunks);
+	size_t splitBytes = (size_t)DDZ_CHUNK_BLOCKS * (DDZ_ENDPOINT_BYTES + 4);
+	byte* splitBuffers = arena.allocateArray<byte>(splitBytes * nThreads);
+
+	unsigned long long offset = sizeof(DDZ_HEADER) + chunks.size() * sizeof(DDZ_CHUNK);
+	bool written = pipeline.run(nGroups,
+		[&](int group, int /*slot*/)
+		{
+			size_t firstBlock = (size_t)group * groupChunks * DDZ_CHUNK_BLOCKS;
+			size_t nGroupBlocks = min((size_t)groupChunks * DDZ_CHUNK_BLOCKS, (size_t)header.nBlocks - firstBlock);
+			ddsFile.prefetch((const byte*)(blocks + firstBlock), nGroupBlocks * sizeof(Dxt1Block));
+			return true;
+		},
+		[&](int group, int slot)
+		{
+			int firstChunk = group * groupChunks;
+			compressor.threadPool->parallelFor(min(groupChunks, nChunks - firstChunk), [&](int task, int thread)
+			{
+				int chunk = firstChunk + task;
+				size_t firstBlock = (size_t)chunk * DDZ_CHUNK_BLOCKS;
+				int nBlocks = (int)min((unsigned long long)DDZ_CHUNK_BLOCKS, header.nBlocks - firstBlock);
+
+				byte* endpoints = splitBuffers + splitBytes * thread;
+				byte* indices = endpoints + (size_t)DDZ_CHUNK_BLOCKS * DDZ_ENDPOINT_BYTES;
+				splitBlocks(blocks + firstBlock, nBlocks, endpoints, indices);
+
+				byte* target = groupBuffers[slot] + maxChunkSize * task;
+				size_t size = packStream(endpoints, (size_t)nBlocks * DDZ_ENDPOINT_BYTES, target);
+				size += packStream(indices, (size_t)nBlocks * 4, target + size);
+
+				// blocks the streams don't make smaller (noise) are stored, a packed file is never larger than its DDS file
+				size_t blocksSize = (size_t)nBlocks * sizeof(Dxt1Block);
+				chunks[chunk].stored = size >= blocksSize;
+				if (chunks[chunk].stored)
+				{
+					memcpy(target, blocks + firstBlock, blocksSize);
+					size = blocksSize;
+				}
+
+				chunks[chunk].size = (unsigned int)size;
+				chunkHashes[chunk] = hashChunk(blocks + firstBlock, nBlocks);
+			});
+			return true;
+		},
+		[&](int group, int slot)
+		{
+			int firstChunk = group * groupChunks;
+			for (int chunk = firstChunk; chunk < min(firstChunk + groupChunks, nChunks); ++chunk)
+			{
+				chunks[chunk].offset = offset;
+				offset += chunks[chunk].size;
+				packedFile.write((char*)groupBuffers[slot] + maxChunkSize * (chunk - firstChunk), chunks[chunk].size);
+			}
+			return (bool)packedFile;
+		});
+
+	// the header again with the checksum, then the chunk table
+	header.ddsChecksum = checksum(ddsHeader, chunkHashes.data(), nChunks);
+	packedFile.seekp(0, ios::beg);
+	packedFile.write((char*)&header, sizeof(DDZ_HEADER));
+	packedFile.write((char*)chunks.data(), (streamsize)chunks.size() * sizeof(DDZ_CHUNK));
+	packedFile.close();
+
+	if (!written || !packedFile)
+	{
+		cout << "- can't write " << outputPath << endl;
+		return false;
+	}
+
+	ddsBytes += ddsFile.size();
+	packedBytes += offset;
+
+	if (compressor.verbose)
+		cout << "- file packed and saved successfully to " << outputPath << endl;
+
+	return true;
+}
+
+bool BlockPacker::unpack(const string& filePath, const string& outputPath)
+{
+	// the chunks are decoded straight from the mapping
+	MappedFile packedFile;
+	if (!packedFile.openRead(filePath))
+	{
+		cout << "- file not found." << endl;
+		return false;
+	}
+
+	DDZ_HEADER header;
+	if (packedFile.size() < sizeof(DDZ_HEADER))
+	{
+		cout << "* " << filePath << " is not a packed DDS file." << endl;
+		return false;
+	}
+
+	memcpy(&header, packedFile.data(), sizeof(DDZ_HEADER));
+	unsigned long long tableEnd = sizeof(DDZ_HEADER) + (unsigned long long)header.nChunks * sizeof(DDZ_CHUNK);
+	if (header.magic != DDZ_MAGIC || header.chunkBlocks == 0 || header.chunkBlocks > DDZ_CHUNK_BLOCKS ||
+		header.nBlocks > ((size_t)-1 - sizeof(DDS_HEADER)) / sizeof(Dxt1Block) ||
+		header.nChunks != (header.nBlocks + header.chunkBlocks - 1) / header.chunkBlocks || tableEnd > packedFile.size())
+	{
+		cout << "* " << filePath << " is not a packed DDS file." << endl;
+		return false;
+	}
+
+	if (!compressor.isValidDDSFile(header.ddsHeader))
+		return false;
+
+	const DDZ_CHUNK* chunks = (const DDZ_CHUNK*)(packedFile.data() + sizeof(DDZ_HEADER));
+	int nChunks = (int)header.nChunks;
+	for (int chunk = 0; chunk < nChunks; ++chunk)
+	{
+		if (chunks[chunk].offset < tableEnd || chunks[chunk].offset > packedFile.size() || chunks[chunk].size > packedFile.size() - chunks[chunk].offset)
+		{
+			cout << "* " << filePath << " is corrupt." << endl;
+			return false;
+		}
+	}
+
+	// create the pre-sized DDS file, the blocks are decoded in place after the header
+	size_t ddsSize = sizeof(DDS_HEADER) + (size_t)header.nBlocks * sizeof(Dxt1Block);
+	MappedFile ddsFile;
+	byte* ddsData = 0;
+	if (ddsFile.create(outputPath, ddsSize))
+		ddsData = ddsFile.data();
+	else
+		ddsData = new byte[ddsSize]; // output can't be mapped: expand to memory and write the file
+
+	memcpy(ddsData, &header.ddsHeader, sizeof(DDS_HEADER));
+	Dxt1Block* blocks = (Dxt1Block*)(ddsData + sizeof(DDS_HEADER));
+
+	// the streams of each thread's chunk, and the hashes of the expanded chunks
+	int nThreads = compressor.threadPool->size();
+	size_t splitBytes = (size_t)header.chunkBlocks * (DDZ_ENDPOINT_BYTES + 4);
+	ScratchArena arena;
+	byte* splitBuffers = arena.allocateArray<byte>(splitBytes * nThreads);
+	atomic<bool> corrupt(false);
+	vector<unsigned long long> chunkHashes(nChunks);
+
+	compressor.threadPool->parallelFor(nChunks, [&](int chunk, int thread)
+	{
+		size_t firstBlock = (size_t)chunk * header.chunkBlocks;
+		int nBlocks = (int)min((unsigned long long)header.chunkBlocks, header.nBlocks - firstBlock);
+
+		byte* endpoints = splitBuffers + splitBytes * thread;
+		byte* indices = endpoints + (size_t)header.chunkBlocks * DDZ_ENDPOINT_BYTES;
+		const byte* source = packedFile.data() + chunks[chunk].offset;
+		size_t sourceSize = chunks[chunk].size;
+
+		if (chunks[chunk].stored)
+		{
+			if (sourceSize != (size_t)nBlocks * sizeof(Dxt1Block))
+			{
+				corrupt = true;
+				return;
+			}
+			memcpy(blocks + firstBlock, source, sourceSize);
+		}
+		else
+		{
+			size_t endpointsSize = unpackStream(source, sourceSize, endpoints, (size_t)nBlocks * DDZ_ENDPOINT_BYTES);
+			if (!endpointsSize || !unpackStream(source + endpointsSize, sourceSize - endpointsSize, indices, (size_t)nBlocks * 4))
+			{
+				corrupt = true;
+				return;
+			}
+
+			mergeBlocks(endpoints, indices, nBlocks, blocks + firstBlock);
+		}
+
+		chunkHashes[chunk] = hashChunk(blocks + firstBlock, nBlocks);
+	});
+
+	// streams decoded without error may still hold the wrong bytes (e.g. a flipped index byte of a stored stream)
+	if (!corrupt && checksum(header.ddsHeader, chunkHashes.data(), nChunks) != header.ddsChecksum)
+		corrupt = true;
+
+	bool saved = !corrupt;
+	if (corrupt)
+		cout << "* " << filePath << " is corrupt." << endl;
+
+	if (!ddsFile.isOpen())
+	{
+		if (saved)
+		{
+			ofstream output;
+			output.open(outputPath, ofstream::out | ofstream::binary);
+			output.write((char*)ddsData, (streamsize)ddsSize);
+			output.close();
+
+			saved = (bool)output;
+			if (!saved)
+				cout << "- can't write " << outputPath << endl;
+		}
+
+		delete[] ddsData;
+	}
+
+	if (!saved)
+		return false;
+
+	ddsBytes += ddsSize;
+	packedBytes += packedFile.size();
+
+	if (compressor.verbose)
+		cout << "- file expanded and saved successfully to " << outputPath << endl;
+
+	return true;
+}
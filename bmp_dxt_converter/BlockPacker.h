@@ -0,0 +1,155 @@
+/**
+BlockPacker.h
+Purpose: Packs DDS files into a smaller container (.ddz) and expands them back. The DXT1 blocks are split into
+chunks coded independently, so both ways run in parallel on the compressor threads. In a chunk the block end
+points are delta coded (per color channel, from the previous block) and separated from the indices, and both
+streams are entropy coded with RansCoder, a chunk the streams don't make smaller keeps its blocks as they are.
+The expanded DDS file is the same as the packed one, byte for byte: the header keeps a checksum of the DDS file,
+checked once it is expanded.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include "Compressor.h"
+
+using namespace std;
+
+// packed DDS file: the header, the chunk table (one DDZ_CHUNK per chunk) then the chunks
+#define DDZ_EXTENSION		".ddz"
+#define DDZ_MAGIC			0x325A4444 // "DDZ2"
+
+// blocks per chunk (the last chunk may be shorter), the unit of parallel work
+#define DDZ_CHUNK_BLOCKS	65536
+
+// end point bytes per block: the 6 color channel deltas of c0 and c1
+#define DDZ_ENDPOINT_BYTES	6
+
+struct DDZ_HEADER
+{
+	unsigned int magic;
+	unsigned int chunkBlocks;
+	unsigned long long nBlocks;
+	unsigned int nChunks;
+	unsigned int reserved;
+	unsigned long long ddsChecksum; // see BlockPacker::checksum
+	DDS_HEADER ddsHeader; // header of the expanded DDS file
+};
+
+struct DDZ_CHUNK
+{
+	unsigned long long offset; // from the start of the file
+	unsigned int size;
+	unsigned int stored; // 1 if the chunk holds its blocks as they are (the streams are not smaller), 0 for the streams
+};
+
+// a chunk holds 2 streams (end points then indices), each one a DDZ_STREAM and its bytes
+struct DDZ_STREAM
+{
+	unsigned int size;	// bytes following the stream header
+	unsigned int coded; // 1 if coded by RansCoder, 0 if stored (coding doesn't make it smaller)
+};
+
+class BlockPacker
+{
+private:
+	// threads and DDS header checks, verbose setting
+	Compressor& compressor;
+
+	// bytes of the DDS files and of the packed files of all the calls (pack and unpack)
+	atomic<long long> ddsBytes;
+	atomic<long long> packedBytes;
+
+	/**
+	Split blocks into their end point deltas and their indices
+
+	@param blocks the blocks of a chunk
+	@param nBlocks number of blocks
+	@param endpoints target end point deltas, DDZ_ENDPOINT_BYTES per block
+	@param indices target indices, 4 bytes per block
+	*/
+	static void splitBlocks(const Dxt1Block* blocks, const int nBlocks, byte* endpoints, byte* indices);
+
+	/**
+	Rebuild blocks from their end point deltas and their indices (inverse of splitBlocks)
+	*/
+	static void mergeBlocks(const byte* endpoints, const byte* indices, const int nBlocks, Dxt1Block* blocks);
+
+	/**
+	Code a stream, or store it if coding doesn't make it smaller
+
+	@param symbols the stream
+	@param nSymbols length of the stream
+	@param target target buffer of sizeof(DDZ_STREAM) + RansCoder::maxEncodedSize(nSymbols) bytes
+	@return bytes written, stream header included
+	*/
+	static size_t packStream(const byte* symbols, const size_t nSymbols, byte* target);
+
+	/**
+	Decode a stream written by packStream
+
+	@param source the stream, header included
+	@param sourceSize bytes left in the chunk from source
+	@param symbols target stream
+	@param nSymbols length of the stream
+	@return bytes read (stream header included), 0 if the stream is corrupt
+	*/
+	static size_t unpackStream(const byte* source, const size_t sourceSize, byte* symbols, const size_t nSymbols);
+
+	/**
+	Hash of the blocks of a chunk (see ContentHash), the chunk hashes are combined by checksum
+	*/
+	static unsigned long long hashChunk(const Dxt1Block* blocks, const int nBlocks);
+
+	/**
+	Checksum of a DDS file: the hash of its header and of its chunk hashes, in order
+
+	@param ddsHeader header of the DDS file
+	@param chunkHashes hashes of the chunks (see hashChunk)
+	@param nChunks number of chunks
+	*/
+	static unsigned long long checksum(const DDS_HEADER& ddsHeader, const unsigned long long* chunkHashes, const int nChunks);
+
+public:
+	/**
+	@param compressor compressor providing the threads, must outlive the packer
+	*/
+	explicit BlockPacker(Compressor& compressor) : compressor(compressor), ddsBytes(0), packedBytes(0) {}
+
+	BlockPacker(const BlockPacker&) = delete;
+	BlockPacker& operator=(const BlockPacker&) = delete;
+
+	/**
+	Pack a DDS file. The chunks are coded in parallel and written in order while the next ones are coded.
+
+	pack() and unpack() may be called from several threads at once for different output files.
+
+	@param filePath DXT1 DDS file path (mip levels included), without data after the blocks
+	@param outputPath packed file path
+	@return true if the packed file was saved
+	*/
+	bool pack(const string& filePath, const string& outputPath);
+
+	/**
+	Expand a packed file back to its DDS file, decoding the chunks in parallel straight into the mapped DDS file
+
+	@param filePath packed file path
+	@param outputPath DDS file path
+	@return true if the DDS file was saved (and matches the checksum of the packed file)
+	*/
+	bool unpack(const string& filePath, const string& outputPath);
+
+	/**
+	Bytes of the DDS files packed or expanded by all the calls
+	*/
+	long long getDDSBytes() const { return ddsBytes; }
+
+	/**
+	Bytes of the packed files written or read by all the calls
+	*/
+	long long getPackedBytes() const { return packedBytes; }
+};
@@ -11,7 +11,12 @@ Purpose: Converts from bmp to DXT1 dds and vice versa
 #include <bitset>
 
 #include <algorithm>    // std::max
+#include <string.h>
+#include <climits>
+#include <cstdlib>
 #include "Compressor.h"
+#include "MappedFile.h"
+#include "Pipeline.h"
 
 
 // convert a color to hex helper function
@@ -20,206 +25,1057 @@ inline int toHex(RGBTriplet c)
 	return c.r << 16 | c.g << 8 | c.b;
 }
 
-Compressor::Compressor(){}
-Compressor::~Compressor(){}
+bool parseNumber(const string& text, unsigned long long& value)
+{
+	if (text.empty() || text.size() > 18 || text.find_first_not_of("0123456789") != string::npos)
+		return false;
+
+	value = strtoull(text.c_str(), 0, 10);
+	return true;
+}
 
-void Compressor::compress(const string& filePath)
+bool parseRegion(const string& text, ImageRegion& region)
 {
-	ifstream bmpFile;
-	bmpFile.open(filePath, ios::binary);
+	int values[4];
+	size_t start = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		size_t end = text.find(',', start);
+		if ((end == string::npos) != (i == 3))
+			return false;
 
-	if (!bmpFile.good())
+		unsigned long long value;
+		if (!parseNumber(text.substr(start, end == string::npos ? string::npos : end - start), value) || value > INT_MAX)
+			return false;
+
+		values[i] = (int)value;
+		start = end + 1;
+	}
+
+	region.x = values[0];
+	region.y = values[1];
+	region.width = values[2];
+	region.height = values[3];
+	return region.width > 0 && region.height > 0;
+}
+
+Compressor::Compressor() : encoderTier(TIER_INTENSITY), streamingMode(false), verbose(true), mipmaps(false), blockCacheEntries(0),
+	rdoLambda(0), cacheHits(0), cacheMisses(0), paletteHits(0), paletteMisses(0), profiler(0), conversionCache(0)
+{
+	threadPool = new ThreadPool();
+}
+
+Compressor::~Compressor()
+{
+	delete threadPool;
+	delete profiler;
+	delete conversionCache;
+}
+
+void Compressor::setThreadCount(const int nThreads)
+{
+	delete threadPool;
+	threadPool = new ThreadPool(nThreads);
+}
+
+void Compressor::setSimdLevel(const SimdLevel level)
+{
+	simdEncoder.setLevel(level);
+	simdDecoder.setLevel(level);
+}
+
+void Compressor::setProfiling(const bool enabled)
+{
+	delete profiler;
+	profiler = enabled ? new Profiler : 0;
+}
+
+void Compressor::setConversionCache(const string& dir, const long long maxBytes, const bool link)
+{
+	delete conversionCache;
+	conversionCache = dir.empty() ? 0 : new ConversionCache(dir, maxBytes, link);
+}
+
+ConversionKey Compressor::conversionKey(ContentHash& inputHash, const int nLevels) const
+{
+	// the SIMD level and the number of threads don't change the blocks
+	long long settings[5] = { CONVERSION_CACHE_VERSION, encoderTier, nLevels, blockCacheEntries, rdoLambda };
+	inputHash.update((const byte*)settings, sizeof(settings));
+	return inputHash.digest();
+}
+
+bool Compressor::fetchConverted(const ConversionKey& key, const string& outputPath)
+{
+	if (!conversionCache->fetch(key, outputPath))
+		return false;
+
+	if (verbose)
+		cout << "- file unchanged, saved from the conversion cache to " << outputPath << endl;
+	return true;
+}
+
+bool Compressor::writeProfile(const string& path)
+{
+	if (!profiler)
+		return false;
+
+	const char* encoder = encoderTier == TIER_RANGE_FIT ? "range-fit" : "intensity";
+	const char* simdLevel = SimdEncoder::levelName(simdEncoder.getLevel());
+	if (path == "-")
 	{
-		cout << "- file not found." << endl;
-		bmpFile.close();
-		return;
+		profiler->writeJson(cout, threadPool->size(), simdLevel, encoder);
+		return true;
 	}
-	
+
+	ofstream file;
+	file.open(path, ofstream::out);
+	profiler->writeJson(file, threadPool->size(), simdLevel, encoder);
+	file.close();
+
+	if (!file)
+	{
+		cout << "- can't write " << path << endl;
+		return false;
+	}
+	return true;
+}
+
+int Compressor::mipLevelCount(const int imgWidth, const int imgHeight)
+{
+	int nLevels = 1;
+	for (int size = max(imgWidth, imgHeight); size > 1; size /= 2)
+		++nLevels;
+	return nLevels;
+}
+
+size_t Compressor::mipChainBlocks(const int imgWidth, const int imgHeight, const int nLevels)
+{
+	size_t nBlocks = 0;
+	int w = imgWidth, h = imgHeight;
+	for (int level = 0; level < nLevels; ++level)
+	{
+		nBlocks += (size_t)((w + 3) / 4) * ((h + 3) / 4);
+		w = Downsampler::halfSize(w);
+		h = Downsampler::halfSize(h);
+	}
+	return nBlocks;
+}
+
+void Compressor::runParallel(const int nTasks, const function<void(int)>& fn)
+{
+	threadPool->parallelFor(nTasks, [&fn](int task, int /*slot*/) { fn(task); });
+}
+
+bool Compressor::compress(const string& filePath, const string& outputPath, ErrorMetrics* metrics)
+{
+	// a cached compression is looked up before any pixel is compressed, only the mapped path can skip the encoder
+	if (streamingMode && !(conversionCache && !metrics))
+	{
+		return compressStreaming(filePath, outputPath, metrics);
+	}
+
+	// map the BMP file, the pixels are read straight from the mapping
+	StageTimer headerTimer(profiler, STAGE_HEADER);
+	MappedFile bmpFile;
+	if (!bmpFile.openRead(filePath))
+	{
+		// missing, or too large for the address space: the streaming encoder reads it piece by piece
+		// (and reports the missing file)
+		headerTimer.stop();
+		return compressStreaming(filePath, outputPath, metrics);
+	}
+
+	if (bmpFile.size() < sizeof(BMP_HEADER))
+	{
+		cout << "* file is not a BMP file." << endl;
+		return false;
+	}
+
 	// read the BMP file header (including info header)
 	BMP_HEADER bmpHeader;
-	bmpFile.seekg(0, ios::beg);
-	bmpFile.read((char*)&bmpHeader, sizeof(bmpHeader));
+	memcpy(&bmpHeader, bmpFile.data(), sizeof(bmpHeader));
 
-	// make sure the BMP file is valid, uncompressed, 24bit, divisible by 4
+	// make sure the BMP file is valid, uncompressed, 24bit or 32bit, divisible by 4
 	if (!isValidBMPFile(bmpHeader))
+		return false;
+
+	long long rowBytes = bmpRowBytes(bmpHeader); // scanlines are padded to 4 bytes
+	long long nPixelBytes = rowBytes * abs(bmpHeader.imageHeight); // number of pixel bytes
+	if (bmpHeader.dataOffset > bmpFile.size() || bmpFile.size() - bmpHeader.dataOffset < (unsigned long long)nPixelBytes)
 	{
-		bmpFile.close();
-		return;
+		cout << "* BMP file is truncated." << endl;
+		return false;
 	}
-	
+
+	// pixel counts over 2GB don't fit the in-memory path indices, the streaming encoder (without mipmaps) takes them
+	bool tooLarge = nPixelBytes > INT_MAX;
 	int imgWidth = bmpHeader.imageWidth;
 	int imgHeight = abs(bmpHeader.imageHeight);
 	bool isBottomUp = bmpHeader.imageHeight > 0; // pixels stored from the bottom to top
-	int nPixels = imgWidth * imgHeight; // number of image pixels
-	int nBlocks = nPixels / 16; // number of blocks
-	long nPixelBytes = nPixels * 3; // number of pixel bytes
+	int nLevels = mipmaps && !tooLarge ? mipLevelCount(imgWidth, imgHeight) : 1;
+	const byte* bmpBuffer = bmpFile.data() + bmpHeader.dataOffset;
+	headerTimer.stop();
+
+	// conversion cache: hashing the scanlines of the mapping reads its pages, the encoder finds them in memory on
+	// a miss (the error metrics need the encoder, they are not cached)
+	bool cached = conversionCache && !metrics;
+	ConversionKey cacheKey;
+	if (cached)
+	{
+		StageTimer readTimer(profiler, STAGE_READ);
+		ContentHash inputHash;
+		inputHash.update((const byte*)&bmpHeader, sizeof(bmpHeader));
+		for (int y = 0; y < imgHeight; ++y)
+			inputHash.update(bmpBuffer + (isBottomUp ? imgHeight - 1 - y : y) * rowBytes, (size_t)rowBytes);
+		cacheKey = conversionKey(inputHash, nLevels);
+		readTimer.stop();
+
+		if (fetchConverted(cacheKey, outputPath))
+			return true;
+	}
+
+	if (tooLarge)
+	{
+		bmpFile.close();
+		return compressStreaming(filePath, outputPath, metrics, cached ? &cacheKey : 0);
+	}
+
+	int nBlocks = (int)mipChainBlocks(imgWidth, imgHeight, nLevels); // the mip levels blocks follow the full size image blocks
 
 	// print image header data
 	//printBMPHeader(bmpHeader);
-	//cout << "nPixels: " << nPixels << '\n';
-	//cout << "nBlocks: " << nBlocks << '\n';
-	
-	// read BMP color data to a buffer
-	RGBTriplet* bmpBuffer = new RGBTriplet[nPixels];
-	bmpFile.seekg(bmpHeader.dataOffset, ios::beg);
-	bmpFile.read((char*)bmpBuffer, nPixelBytes);
 
-	// final compressed DXT1 blocks will be saved here
-	Dxt1Block* blocks = new Dxt1Block[nBlocks];
-	
-	// compress the bmpBuffer into the blocks
-	compressBMP(bmpBuffer, blocks, imgWidth, imgHeight, isBottomUp);
+	if (profiler)
+	{
+		profiler->countConversion();
+		profiler->countBytesRead(bmpHeader.dataOffset + nPixelBytes);
+	}
+
+	// BMP color data, read in place: a bottom-up BMP is walked from its last scanline backwards
+	PixelFormat format = bmpPixelFormat(bmpHeader);
+	ImageView image = isBottomUp ? ImageView::bottomUp(bmpBuffer, (ptrdiff_t)rowBytes, imgWidth, imgHeight, format) :
+		ImageView(bmpBuffer, (ptrdiff_t)rowBytes, imgWidth, imgHeight, format);
+
+	if (verbose)
+		cout << "- converting..." << endl;
 
-	// save the resulting DXT1 blocks to file
-	saveDDS(blocks, nBlocks, imgWidth, imgHeight);
+	ScratchArena arena;
+	unsigned int* blockErrors = metrics ? metrics->begin(imgWidth, imgHeight) : 0;
+
+	// create the pre-sized DDS file, the compressed DXT1 blocks are written in place after the header
+	MappedFile ddsFile;
+	if (ddsFile.create(outputPath, sizeof(DDS_HEADER) + (size_t)nBlocks * sizeof(Dxt1Block)))
+	{
+		fillDDSHeader(*(DDS_HEADER*)ddsFile.data(), imgWidth, imgHeight, nLevels);
+		Dxt1Block* blocks = (Dxt1Block*)(ddsFile.data() + sizeof(DDS_HEADER));
+
+		// compress the bmpBuffer into the blocks
+		compressMipChain(image, blocks, nLevels, arena, blockErrors, &bmpFile, &ddsFile);
+
+		if (profiler)
+			profiler->countBytesWritten(ddsFile.size());
+	}
+	else
+	{
+		// output can't be mapped (e.g. unsupported file system): compress to memory and write the file
+		Dxt1Block* blocks = new Dxt1Block[nBlocks];
+		compressMipChain(image, blocks, nLevels, arena, blockErrors, &bmpFile);
+		bool saved = saveDDS(blocks, nBlocks, imgWidth, imgHeight, nLevels, outputPath);
+		delete[] blocks;
+
+		if (!saved)
+			return false;
+	}
+
+	if (cached)
+	{
+		ddsFile.close();
+		conversionCache->store(cacheKey, outputPath);
+	}
+
+	if (metrics)
+		metrics->finish();
 	
-	cout << "- file converted and saved successfully to " << DDS_FILE_NAME << endl;
+	if (verbose)
+		cout << "- file converted and saved successfully to " << outputPath << endl;
 
-	// free memory
-	delete[] bmpBuffer;
-	delete[] blocks;
-	bmpFile.close();
+	return true;
+}
+
+bool Compressor::compressStreaming(const string& filePath, const string& outputPath, ErrorMetrics* metrics, const ConversionKey* cacheKey)
+{
+	StageTimer headerTimer(profiler, STAGE_HEADER);
+	ifstream bmpFile;
+	bmpFile.open(filePath, ios::binary);
+
+	if (!bmpFile.good())
+	{
+		cout << "- file not found." << endl;
+		return false;
+	}
+
+	// read the BMP file header (including info header)
+	BMP_HEADER bmpHeader;
+	if (!bmpFile.read((char*)&bmpHeader, sizeof(bmpHeader)))
+	{
+		cout << "* file is not a BMP file." << endl;
+		return false;
+	}
+
+	// make sure the BMP file is valid, uncompressed, 24bit or 32bit, divisible by 4
+	if (!isValidBMPFile(bmpHeader))
+		return false;
+
+	// 64bit sizes and offsets, the file may be larger than 4GB
+	int imgWidth = bmpHeader.imageWidth;
+	long long imgHeight = abs(bmpHeader.imageHeight);
+	bool isBottomUp = bmpHeader.imageHeight > 0; // pixels stored from the bottom to top
+	PixelFormat format = bmpPixelFormat(bmpHeader);
+	long long rowBytes = bmpRowBytes(bmpHeader); // scanlines are padded to 4 bytes
+	long long nBlockRows = imgHeight / 4;
+	int nBlocksPerRow = imgWidth / 4;
+
+	bmpFile.seekg(0, ios::end);
+	long long fileSize = (long long)bmpFile.tellg();
+	if (fileSize < (long long)bmpHeader.dataOffset + rowBytes * imgHeight)
+	{
+		cout << "* BMP file is truncated." << endl;
+		return false;
+	}
+
+	// the mip levels would have to be kept until the full size image is written
+	if (mipmaps)
+		cout << "* the streaming encoder doesn't generate mipmaps, only the full size image is saved." << endl;
+	headerTimer.stop();
+
+	// conversion cache: the read stage hashes the scanlines (top to bottom, as compress() does) and the DDS file
+	// is stored once written, unless compress() already has the key
+	bool cached = conversionCache && !metrics;
+	bool hashing = cached && !cacheKey;
+	ContentHash inputHash;
+	if (hashing)
+		inputHash.update((const byte*)&bmpHeader, sizeof(bmpHeader));
+
+	if (profiler)
+	{
+		profiler->countConversion();
+		profiler->countBytesRead(sizeof(bmpHeader));
+		profiler->countBytesWritten(sizeof(DDS_HEADER));
+	}
+
+	// create output file and write the header, the block rows are appended as they are compressed
+	DDS_HEADER ddsHeader;
+	fillDDSHeader(ddsHeader, imgWidth, (int)imgHeight, 1);
+
+	ofstream ddsFile;
+	ddsFile.open(outputPath, ofstream::out | ofstream::binary);
+	if (!ddsFile.write((char*)&ddsHeader, sizeof(DDS_HEADER)))
+	{
+		cout << "- can't create " << outputPath << endl;
+		return false;
+	}
+
+	if (verbose)
+		cout << "- converting..." << endl;
+
+	// the block rows go through the pipeline in chunks of about PIPELINE_CHUNK_BYTES of pixels: a chunk is read
+	// while the one before it is compressed and the one before that is appended to the DDS file
+	int chunkRows = (int)max(1LL, PIPELINE_CHUNK_BYTES / (rowBytes * 4));
+	int nChunks = (int)((nBlockRows + chunkRows - 1) / chunkRows);
+	unsigned int* blockErrors = metrics ? metrics->begin(imgWidth, (int)imgHeight) : 0;
+
+	// the rows are split into pieces compressed in parallel (a multiple of every SIMD batch width,
+	// and of RDO_SEGMENT_BLOCKS so the optimized blocks are the same as compress())
+	const int pieceBlocks = 1024;
+	int nPieces = (nBlocksPerRow + pieceBlocks - 1) / pieceBlocks;
+
+	// chunkPixels: the scanlines of each slot's chunk (in file order), chunkBlocks: its compressed blocks
+	// pieceColors: the block colors of the piece compressed by each thread (16 colors per block)
+	ScratchArena arena;
+	Pipeline pipeline;
+	byte* chunkPixels[PIPELINE_SLOTS];
+	Dxt1Block* chunkBlocks[PIPELINE_SLOTS];
+	for (int slot = 0; slot < pipeline.slotCount(); ++slot)
+	{
+		chunkPixels[slot] = arena.allocateArray<byte>((size_t)rowBytes * 4 * chunkRows);
+		chunkBlocks[slot] = arena.allocateArray<Dxt1Block>((size_t)nBlocksPerRow * chunkRows);
+	}
+	RGBTriplet* pieceColors = arena.allocateArray<RGBTriplet>((size_t)pieceBlocks * 16 * threadPool->size());
+	BlockCache* caches = createBlockCaches(arena, pieceBlocks, nBlockRows * nBlocksPerRow);
+	RdoOptimizer* optimizers = createRdoOptimizers(arena);
+
+	bool readOk = true;
+	bool converted = pipeline.run(nChunks,
+		[&](int chunk, int slot)
+		{
+			// the chunk scanlines are contiguous, a bottom-up file stores the top block row in the last 4 of them
+			long long firstRow = (long long)chunk * chunkRows;
+			int nRows = (int)min((long long)chunkRows, nBlockRows - firstRow);
+			long long firstScanline = isBottomUp ? imgHeight - (firstRow + nRows) * 4 : firstRow * 4;
+			StageTimer timer(profiler, STAGE_READ);
+			bmpFile.seekg(bmpHeader.dataOffset + firstScanline * rowBytes, ios::beg);
+			readOk = (bool)bmpFile.read((char*)chunkPixels[slot], rowBytes * 4 * nRows);
+			if (profiler)
+				profiler->countBytesRead(rowBytes * 4 * nRows);
+
+			for (int h = 0; hashing && readOk && h < nRows * 4; ++h)
+				inputHash.update(chunkPixels[slot] + (isBottomUp ? nRows * 4 - 1 - h : h) * rowBytes, (size_t)rowBytes);
+			return readOk;
+		},
+		[&](int chunk, int slot)
+		{
+			long long firstRow = (long long)chunk * chunkRows;
+			int nRows = (int)min((long long)chunkRows, nBlockRows - firstRow);
+			ImageView image = isBottomUp ? ImageView::bottomUp(chunkPixels[slot], (ptrdiff_t)rowBytes, imgWidth, nRows * 4, format) :
+				ImageView(chunkPixels[slot], (ptrdiff_t)rowBytes, imgWidth, nRows * 4, format);
+
+			threadPool->parallelFor(nRows * nPieces, [&](int task, int thread)
+			{
+				int row = task / nPieces;
+				int firstBlock = task % nPieces * pieceBlocks;
+				int endBlock = min(firstBlock + pieceBlocks, nBlocksPerRow);
+				RGBTriplet* colors = pieceColors + (size_t)thread * pieceBlocks * 16;
+
+				StageTimer timer(profiler, STAGE_GATHER);
+				gatherBlocks(image, row * 4, firstBlock, endBlock, colors);
+				timer.next(STAGE_ENCODE);
+				compressDxt1Blocks(colors, chunkBlocks[slot] + (size_t)row * nBlocksPerRow + firstBlock, endBlock - firstBlock,
+					blockErrors ? blockErrors + (firstRow + row) * nBlocksPerRow + firstBlock : 0, caches ? caches + thread : 0,
+					optimizers ? optimizers + thread : 0);
+				timer.stop();
+
+				if (profiler)
+					profiler->countEncodedBlocks(colors, endBlock - firstBlock);
+			});
+			return true;
+		},
+		[&](int chunk, int slot)
+		{
+			long long firstRow = (long long)chunk * chunkRows;
+			int nRows = (int)min((long long)chunkRows, nBlockRows - firstRow);
+			StageTimer timer(profiler, STAGE_WRITE);
+			if (profiler)
+				profiler->countBytesWritten((long long)nRows * nBlocksPerRow * sizeof(Dxt1Block));
+			return (bool)ddsFile.write((char*)chunkBlocks[slot], (streamsize)nRows * nBlocksPerRow * sizeof(Dxt1Block));
+		});
+
+	addBlockCacheStats(caches);
+	addRdoStats(optimizers);
+	ddsFile.close();
+
+	if (!readOk)
+	{
+		cout << "* can't read " << filePath << endl;
+		return false;
+	}
+
+	if (!converted || !ddsFile)
+	{
+		cout << "- can't write " << outputPath << endl;
+		return false;
+	}
+
+	if (cached)
+		conversionCache->store(hashing ? conversionKey(inputHash, 1) : *cacheKey, outputPath);
+
+	if (metrics)
+		metrics->finish();
+
+	if (verbose)
+		cout << "- file converted and saved successfully to " << outputPath << endl;
+
+	return true;
 }
 
-void Compressor::decompress(const string& filePath)
+bool Compressor::decompress(const string& filePath, const string& outputPath, const int mipLevel)
 {
+	// only the chunks going through the pipeline are in memory, the blocks are read and the scanlines appended
+	StageTimer headerTimer(profiler, STAGE_HEADER);
 	ifstream ddsFile;
 	ddsFile.open(filePath, ios::binary);
-
 	if (!ddsFile.good())
 	{
 		cout << "- file not found." << endl;
-		ddsFile.close();
-		return;
+		return false;
 	}
 
 	// read DDS file header (including the magic number)
 	DDS_HEADER ddsHeader;
-	ddsFile.seekg(0, ios::beg);
-	ddsFile.read((char*)&ddsHeader, sizeof(ddsHeader));
+	if (!ddsFile.read((char*)&ddsHeader, sizeof(ddsHeader)))
+	{
+		cout << "Invalid DDS file." << endl;
+		return false;
+	}
 
-	// check valid DDS file, DXT1-compressed, divisible by 4
+	// check valid DDS file, DXT1-compressed, divisible by 4, not empty (the chunks need a block row)
 	if (!isValidDDSFile(ddsHeader))
+		return false;
+
+	if (ddsHeader.dwWidth == 0 || ddsHeader.dwHeight == 0)
 	{
-		ddsFile.close();
-		return;
+		cout << "Invalid DDS file." << endl;
+		return false;
 	}
 
-	int imgWidth = ddsHeader.dwWidth;
-	int imgHeight = ddsHeader.dwHeight;
-	int nBlocks = (imgWidth * imgHeight) / 16; // number of blocks
+	ddsFile.seekg(0, ios::end);
+	unsigned long long fileSize = (unsigned long long)ddsFile.tellg();
+
+	int imgWidth, imgHeight;
+	unsigned long long levelOffset;
+	if (!locateMipLevel(ddsHeader, fileSize, mipLevel, imgWidth, imgHeight, levelOffset))
+		return false;
+	headerTimer.stop();
 
 	//printDdsHeader(ddsHeader);
-	//cout << "nBlocks: " << nBlocks << endl;
 
-	// read DDS DXT1 blocks to a buffer
-	Dxt1Block* blocks = new Dxt1Block[nBlocks];
-	ddsFile.seekg(ddsHeader.dwSize + 4, ios::beg); // 4b for the DDS magic number
-	ddsFile.read((char*)blocks, nBlocks * 8); // each DXT1 block is 8b
+	if (profiler)
+	{
+		profiler->countConversion();
+		profiler->countBytesRead(sizeof(DDS_HEADER));
+		profiler->countBytesWritten(sizeof(BMP_HEADER));
+	}
+
+	// create output file and write the header, the scanlines are appended as they are decompressed
+	BMP_HEADER bmpHeader;
+	fillBMPHeader(bmpHeader, imgWidth, imgHeight);
+
+	ofstream bmpFile;
+	bmpFile.open(outputPath, ofstream::out | ofstream::binary);
+	if (!bmpFile.write((char*)&bmpHeader, sizeof(BMP_HEADER)))
+	{
+		cout << "- can't create " << outputPath << endl;
+		return false;
+	}
+
+	if (verbose)
+		cout << "- converting..." << endl;
+
+	// the block rows go through the pipeline in chunks of about PIPELINE_CHUNK_BYTES of pixels, and at least a block
+	// row per thread: a chunk is read while the one before it is decompressed (a block row per thread at a time)
+	// and the one before that is appended to the BMP file
+	int nThreads = threadPool->size();
+	int nBlocksPerRow = (imgWidth + 3) / 4;
+	int nBlockRows = (imgHeight + 3) / 4;
+	size_t rowBytes = (imgWidth * 3 + 3) & ~3; // scanlines are padded to 4 bytes
+	int chunkRows = (int)max((size_t)1, min((size_t)nBlockRows, max((size_t)nThreads, PIPELINE_CHUNK_BYTES / (rowBytes * 4))));
+	int nChunks = (nBlockRows + chunkRows - 1) / chunkRows;
+
+	// chunkBlocks: the blocks of each slot's chunk, chunkPixels: its scanlines (the padding bytes stay 0)
+	// caches: the palette cache of each thread, paddedRows: the whole blocks of a partial blocks row, for each thread
+	ScratchArena arena;
+	Pipeline pipeline;
+	Dxt1Block* chunkBlocks[PIPELINE_SLOTS];
+	byte* chunkPixels[PIPELINE_SLOTS];
+	for (int slot = 0; slot < pipeline.slotCount(); ++slot)
+	{
+		chunkBlocks[slot] = arena.allocateArray<Dxt1Block>((size_t)nBlocksPerRow * chunkRows);
+		chunkPixels[slot] = arena.allocateArray<byte>(rowBytes * 4 * chunkRows);
+		memset(chunkPixels[slot], 0, rowBytes * 4 * chunkRows);
+	}
+	PaletteCache* caches = arena.allocateArray<PaletteCache>(nThreads);
+	for (int thread = 0; thread < nThreads; ++thread)
+		caches[thread].init();
+	bool partialBlocks = imgWidth % 4 != 0 || imgHeight % 4 != 0;
+	RGBTriplet* paddedRows = partialBlocks ? arena.allocateArray<RGBTriplet>((size_t)nBlocksPerRow * 16 * nThreads) : 0;
+
+	bool readOk = true;
+	bool converted = pipeline.run(nChunks,
+		[&](int chunk, int slot)
+		{
+			int firstRow = chunk * chunkRows, nRows = min(chunkRows, nBlockRows - firstRow);
+			streamsize chunkBytes = (streamsize)nRows * nBlocksPerRow * sizeof(Dxt1Block);
+			StageTimer timer(profiler, STAGE_READ);
+			ddsFile.seekg(levelOffset + (unsigned long long)firstRow * nBlocksPerRow * sizeof(Dxt1Block), ios::beg);
+			readOk = (bool)ddsFile.read((char*)chunkBlocks[slot], chunkBytes);
+			if (profiler)
+				profiler->countBytesRead(chunkBytes);
+			return readOk;
+		},
+		[&](int chunk, int slot)
+		{
+			int firstRow = chunk * chunkRows, nRows = min(chunkRows, nBlockRows - firstRow);
+			threadPool->parallelFor(nRows, [&](int row, int thread)
+			{
+				StageTimer timer(profiler, STAGE_DECODE);
+				decompressDDSRow(chunkBlocks[slot] + (size_t)row * nBlocksPerRow, (RGBTriplet*)(chunkPixels[slot] + rowBytes * 4 * row),
+					(ptrdiff_t)rowBytes, imgWidth, min(4, imgHeight - (firstRow + row) * 4), caches[thread],
+					paddedRows ? paddedRows + (size_t)thread * nBlocksPerRow * 16 : 0);
+			});
+
+			if (profiler)
+				profiler->countDecodedBlocks((long long)nRows * nBlocksPerRow);
+			return true;
+		},
+		[&](int chunk, int slot)
+		{
+			int firstRow = chunk * chunkRows, nRows = min(chunkRows, nBlockRows - firstRow);
+			streamsize chunkBytes = (streamsize)rowBytes * min(nRows * 4, imgHeight - firstRow * 4);
+			StageTimer timer(profiler, STAGE_WRITE);
+			if (profiler)
+				profiler->countBytesWritten(chunkBytes);
+			return (bool)bmpFile.write((char*)chunkPixels[slot], chunkBytes);
+		});
+
+	for (int thread = 0; thread < nThreads; ++thread)
+	{
+		paletteHits += caches[thread].hits;
+		paletteMisses += caches[thread].misses;
+	}
+	bmpFile.close();
+
+	if (!readOk)
+	{
+		cout << "* can't read " << filePath << endl;
+		return false;
+	}
 
-	// final expanded BMP pixels colors will be saved here
-	RGBTriplet* outputColors = new RGBTriplet[imgWidth * imgHeight];
+	if (!converted || !bmpFile)
+	{
+		cout << "- can't write " << outputPath << endl;
+		return false;
+	}
 
-	// decompress the DXT1 blocks and saved the generated pixel colors to outputColors
-	decompressDDS(blocks, outputColors, nBlocks, imgWidth);
+	if (verbose)
+		cout << "- file coverted and saved successfully to " << outputPath << endl;
 
-	// save the outputColors to a BMP file
-	saveBMP(outputColors, imgWidth, imgHeight);
+	return true;
+}
 
-	// free memory
-	delete[] outputColors;
+bool Compressor::decompressRegion(const string& filePath, const ImageRegion& region, RGBTriplet* pixels, const ptrdiff_t stride,
+	const int mipLevel)
+{
+	// only the header and the covered blocks are read, nothing is mapped
+	StageTimer timer(profiler, STAGE_HEADER);
+	ifstream ddsFile;
+	ddsFile.open(filePath, ios::binary);
+	if (!ddsFile.good())
+	{
+		cout << "- file not found." << endl;
+		return false;
+	}
+
+	DDS_HEADER ddsHeader;
+	if (!ddsFile.read((char*)&ddsHeader, sizeof(ddsHeader)))
+	{
+		cout << "Invalid DDS file." << endl;
+		return false;
+	}
+
+	if (!isValidDDSFile(ddsHeader))
+		return false;
+
+	ddsFile.seekg(0, ios::end);
+	unsigned long long fileSize = (unsigned long long)ddsFile.tellg();
+
+	int imgWidth, imgHeight;
+	unsigned long long levelOffset;
+	if (!locateMipLevel(ddsHeader, fileSize, mipLevel, imgWidth, imgHeight, levelOffset))
+		return false;
+
+	if (region.width <= 0 || region.height <= 0 || region.x < 0 || region.y < 0 ||
+		region.x > imgWidth - region.width || region.y > imgHeight - region.height)
+	{
+		cout << "* the region is not inside the " << imgWidth << "x" << imgHeight << " image." << endl;
+		return false;
+	}
+
+	// the blocks covering the region: columns [firstColumn, endColumn) of the block rows [firstRow, endRow)
+	int nBlocksPerRow = (imgWidth + 3) / 4;
+	int firstColumn = region.x / 4, endColumn = (region.x + region.width + 3) / 4;
+	int firstRow = region.y / 4, endRow = (region.y + region.height + 3) / 4;
+	int nColumns = endColumn - firstColumn, nRows = endRow - firstRow;
+
+	// read the covered part of every block row, a single read if the region spans whole rows
+	timer.next(STAGE_READ);
+	Dxt1Block* blocks = new Dxt1Block[(size_t)nColumns * nRows];
+	bool readOk = true;
+	if (nColumns == nBlocksPerRow)
+	{
+		ddsFile.seekg(levelOffset + (unsigned long long)firstRow * nBlocksPerRow * 8, ios::beg);
+		readOk = (bool)ddsFile.read((char*)blocks, (streamsize)nColumns * nRows * 8);
+	}
+	else
+	{
+		for (int row = 0; row < nRows && readOk; ++row)
+		{
+			ddsFile.seekg(levelOffset + ((unsigned long long)(firstRow + row) * nBlocksPerRow + firstColumn) * 8, ios::beg);
+			readOk = (bool)ddsFile.read((char*)(blocks + (size_t)row * nColumns), (streamsize)nColumns * 8);
+		}
+	}
+
+	if (!readOk)
+	{
+		delete[] blocks;
+		cout << "Invalid DDS file." << endl;
+		return false;
+	}
+
+	if (profiler)
+	{
+		profiler->countBytesRead(sizeof(DDS_HEADER) + (long long)nColumns * nRows * sizeof(Dxt1Block));
+		profiler->countDecodedBlocks((long long)nColumns * nRows);
+	}
+
+	// expand each block row to 4 scanlines and keep the region part
+	timer.next(STAGE_DECODE);
+	int rowWidth = nColumns * 4;
+	RGBTriplet* rowPixels = new RGBTriplet[rowWidth * 4];
+	PaletteCache* cache = new PaletteCache;
+	cache->init();
+
+	for (int row = 0; row < nRows; ++row)
+	{
+		simdDecoder.decompressBlockRow(blocks + (size_t)row * nColumns, rowPixels, rowWidth, rowWidth * 3, *cache);
+
+		for (int h = 0; h < 4; ++h)
+		{
+			int y = (firstRow + row) * 4 + h;
+			if (y < region.y || y >= region.y + region.height)
+				continue;
+
+			memcpy((byte*)pixels + (ptrdiff_t)(y - region.y) * stride, rowPixels + h * rowWidth + (region.x - firstColumn * 4), region.width * 3);
+		}
+	}
+
+	paletteHits += cache->hits;
+	paletteMisses += cache->misses;
+	delete cache;
+	delete[] rowPixels;
 	delete[] blocks;
-	ddsFile.close();
+	return true;
+}
+
+bool Compressor::decompressRegion(const string& filePath, const ImageRegion& region, const string& outputPath, const int mipLevel)
+{
+	if (verbose)
+		cout << "- converting..." << endl;
+
+	if (profiler)
+		profiler->countConversion();
+
+	// scanlines padded to 4 bytes, as saved by saveBMP (the BMP sizes are 32bit, as the server limits them)
+	long long regionRowBytes = ((long long)max(region.width, 0) * 3 + 3) & ~3ll;
+	if (regionRowBytes * max(region.height, 0) > INT_MAX)
+	{
+		cout << "* the region is too large." << endl;
+		return false;
+	}
+
+	int rowBytes = (int)regionRowBytes;
+	byte* outputColors = new byte[(size_t)rowBytes * max(region.height, 0)]();
+	bool saved = decompressRegion(filePath, region, (RGBTriplet*)outputColors, rowBytes, mipLevel) &&
+		saveBMP((RGBTriplet*)outputColors, region.width, region.height, outputPath);
+	delete[] outputColors;
+
+	return saved;
+}
+
+bool Compressor::locateMipLevel(const DDS_HEADER& ddsHeader, const unsigned long long fileSize, const int mipLevel, int& imgWidth, int& imgHeight,
+	unsigned long long& levelOffset) const
+{
+	int nLevels = (ddsHeader.dwFlags & DDSD_MIPMAPCOUNT) && ddsHeader.dwMipMapCount > 1 ? ddsHeader.dwMipMapCount : 1;
+	if (mipLevel < 0 || mipLevel >= nLevels)
+	{
+		cout << "* the DDS file has " << nLevels << " mip level(s)." << endl;
+		return false;
+	}
+
+	// the blocks of the requested level follow the blocks of the larger levels
+	imgWidth = ddsHeader.dwWidth;
+	imgHeight = ddsHeader.dwHeight;
+	unsigned long long nLevelBlocks = mipChainBlocks(imgWidth, imgHeight, mipLevel);
+	for (int level = 0; level < mipLevel; ++level)
+	{
+		imgWidth = Downsampler::halfSize(imgWidth);
+		imgHeight = Downsampler::halfSize(imgHeight);
+	}
+	unsigned long long nBlocks = (unsigned long long)((imgWidth + 3) / 4) * ((imgHeight + 3) / 4); // number of blocks
+
+	unsigned long long blocksOffset = ddsHeader.dwSize + 4; // 4b for the DDS magic number
+	if (fileSize < blocksOffset || fileSize - blocksOffset < (nLevelBlocks + nBlocks) * 8) // each DXT1 block is 8b
+	{
+		cout << "Invalid DDS file." << endl;
+		return false;
+	}
+
+	levelOffset = blocksOffset + nLevelBlocks * 8;
+	return true;
+}
+
+void Compressor::compressBMP(const ImageView& image, Dxt1Block* blocks, ScratchArena& arena, unsigned int* blockErrors, RGBTriplet* nextLevel)
+{
+	// split the block rows into bands, several bands per thread so threads that finish early
+	// (e.g. on flat parts of the image) take over the remaining bands
+	int nThreads = threadPool->size();
+	int nBlockRows = (image.height + 3) / 4;
+	int bandRows = max(1, nBlockRows / (nThreads * 8));
+	int nBands = (nBlockRows + bandRows - 1) / bandRows;
+
+	// one row of block colors per thread (16 colors per block), a whole row is gathered so the SIMD encoder
+	// can take several blocks at once
+	int nRowColors = (image.width + 3) / 4 * 16;
+	RGBTriplet* rowColors = arena.allocateArray<RGBTriplet>((size_t)nRowColors * nThreads);
+	BlockCache* caches = createBlockCaches(arena, nRowColors / 16, (long long)(nRowColors / 16) * nBlockRows);
+	RdoOptimizer* optimizers = createRdoOptimizers(arena);
+
+	// the downsampler filters 24bit scanlines, other formats are converted first (4 scanlines per thread)
+	int nScanlineColors = image.width * 4;
+	RGBTriplet* scanlineColors = nextLevel && image.format != PIXEL_BGR24 ? arena.allocateArray<RGBTriplet>((size_t)nScanlineColors * nThreads) : 0;
+
+	// the block rows gather loop specialized for the image format
+	void (Compressor::*compressRows)(const ImageView&, Dxt1Block*, const int, const int, RGBTriplet*, RGBTriplet*, unsigned int*, RGBTriplet*,
+		BlockCache*, RdoOptimizer*) = &Compressor::compressBlockRows<FormatBGR24>;
+	if (image.format == PIXEL_BGRA32)
+		compressRows = &Compressor::compressBlockRows<FormatBGRA32>;
+	else if (image.format == PIXEL_RGB565)
+		compressRows = &Compressor::compressBlockRows<FormatRGB565>;
+	else if (image.format == PIXEL_GRAY8)
+		compressRows = &Compressor::compressBlockRows<FormatGray8>;
+
+	threadPool->parallelFor(nBands, [&](int band, int slot)
+	{
+		int firstRow = band * bandRows;
+		int endRow = min(firstRow + bandRows, nBlockRows);
+		(this->*compressRows)(image, blocks, firstRow, endRow, rowColors + slot * nRowColors,
+			scanlineColors ? scanlineColors + slot * nScanlineColors : 0, blockErrors, nextLevel, caches ? caches + slot : 0,
+			optimizers ? optimizers + slot : 0);
+	});
+
+	addBlockCacheStats(caches);
+	addRdoStats(optimizers);
+}
+
+void Compressor::compressBMPPipelined(const ImageView& image, Dxt1Block* blocks, unsigned int* blockErrors, RGBTriplet* nextLevel,
+	const MappedFile& input, const MappedFile* output)
+{
+	// a chunk must be a whole part of the image, including its half size rows
+	ScratchArena chunkArena;
+	if (image.height % 4 != 0)
+	{
+		compressBMP(image, blocks, chunkArena, blockErrors, nextLevel);
+		return;
+	}
+
+	int nBlocksPerRow = (image.width + 3) / 4;
+	int nBlockRows = image.height / 4;
+	size_t rowBytes = (size_t)(image.stride < 0 ? -image.stride : image.stride);
+	int chunkRows = (int)max((size_t)1, PIPELINE_CHUNK_BYTES / (rowBytes * 4));
+	int nChunks = (nBlockRows + chunkRows - 1) / chunkRows;
+	int nextWidth = Downsampler::halfSize(image.width);
+
+	Pipeline pipeline;
+	pipeline.run(nChunks,
+		[&](int chunk, int /*slot*/)
+		{
+			// the chunk scanlines are contiguous in the file, in reverse order for bottom-up BMPs
+			int firstRow = chunk * chunkRows, nRows = min(chunkRows, nBlockRows - firstRow);
+			const byte* top = image.scanline(firstRow * 4);
+			const byte* bottom = image.scanline(firstRow * 4 + nRows * 4 - 1);
+			StageTimer timer(profiler, STAGE_READ);
+			input.prefetch(min(top, bottom), rowBytes * nRows * 4);
+			return true;
+		},
+		[&](int chunk, int /*slot*/)
+		{
+			int firstRow = chunk * chunkRows, nRows = min(chunkRows, nBlockRows - firstRow);
+			size_t firstBlock = (size_t)firstRow * nBlocksPerRow;
+
+			chunkArena.reset();
+			compressBMP(image.rows(firstRow * 4, nRows * 4), blocks + firstBlock, chunkArena,
+				blockErrors ? blockErrors + firstBlock : 0, nextLevel ? nextLevel + (size_t)firstRow * 2 * nextWidth : 0);
+			return true;
+		},
+		[&](int chunk, int /*slot*/)
+		{
+			int firstRow = chunk * chunkRows, nRows = min(chunkRows, nBlockRows - firstRow);
+			StageTimer timer(profiler, STAGE_WRITE);
+			if (output)
+				output->flush((const byte*)(blocks + (size_t)firstRow * nBlocksPerRow), (size_t)nRows * nBlocksPerRow * sizeof(Dxt1Block));
+			return true;
+		});
+}
+
+BlockCache* Compressor::createBlockCaches(ScratchArena& arena, const int maxRowBlocks, const long long nBlocks)
+{
+	if (blockCacheEntries <= 0)
+		return 0;
+
+	// no need for more entries than blocks
+	int nEntries = (int)min((long long)blockCacheEntries, max(nBlocks, 16LL));
+	int nThreads = threadPool->size();
+
+	BlockCache* caches = arena.allocateArray<BlockCache>(nThreads);
+	for (int slot = 0; slot < nThreads; ++slot)
+		caches[slot].init(arena, nEntries, maxRowBlocks);
+	return caches;
+}
+
+void Compressor::addBlockCacheStats(const BlockCache* caches)
+{
+	if (!caches)
+		return;
+
+	for (int slot = 0; slot < threadPool->size(); ++slot)
+	{
+		cacheHits += caches[slot].getHits();
+		cacheMisses += caches[slot].getMisses();
+	}
+}
+
+RdoOptimizer* Compressor::createRdoOptimizers(ScratchArena& arena)
+{
+	if (rdoLambda <= 0)
+		return 0;
+
+	int nThreads = threadPool->size();
+	RdoOptimizer* optimizers = arena.allocateArray<RdoOptimizer>(nThreads);
+	for (int slot = 0; slot < nThreads; ++slot)
+		optimizers[slot].init(rdoLambda);
+	return optimizers;
+}
+
+void Compressor::addRdoStats(const RdoOptimizer* optimizers)
+{
+	if (!optimizers)
+		return;
+
+	lock_guard<mutex> lock(rdoStatsMutex);
+	for (int slot = 0; slot < threadPool->size(); ++slot)
+		rdoStats.add(optimizers[slot].getStats());
 }
 
-void Compressor::compressBMP(const RGBTriplet* bmpBuffer, Dxt1Block* blocks, const int imgWidth, const int imgHeight, const bool isBottomUp)
+RdoStats Compressor::getRdoStats()
 {
-	cout << "- converting..." << endl;
+	lock_guard<mutex> lock(rdoStatsMutex);
+	return rdoStats;
+}
 
-	// holds block colors to use to calculate DXT1 compressed colored c0 and c1 and pixel indices
-	RGBTriplet blockColors[16];
+template <class Format>
+void Compressor::compressBlockRows(const ImageView& image, Dxt1Block* blocks, const int firstRow, const int endRow, RGBTriplet* rowColors,
+	RGBTriplet* scanlineColors, unsigned int* blockErrors, RGBTriplet* nextLevel, BlockCache* cache, RdoOptimizer* rdo)
+{
+	int nBlocksPerRow = (image.width + 3) / 4;
 
-	// h4/w4: iterates over blocks (h4 vertically, w4 horizontally), a block has 4x4 pixels
-	// h/w are iterates over block pixels
-	// pixelIdx: pixel index in the bmpBuffer matching a block pixel at a block coordinate: w,h,w4,h4
-	// blockIdx: iterates over the blocks
-	int h4, w4, h, w, pixelIdx, blockIdx = 0;
-	for (h4 = 0; h4 < imgHeight; h4 += 4) // iterate blocks height-direction
+	// h4: iterates over blocks vertically, a block has 4x4 pixels
+	// blockIdx: index of the first block of the current row
+	int blockIdx = firstRow * nBlocksPerRow;
+	for (int h4 = firstRow * 4; h4 < endRow * 4; h4 += 4) // iterate blocks height-direction
 	{
-		for (w4 = 0; w4 < imgWidth; w4 += 4) // iterate blocks width-direction
+		// get and save the row's blocks pixel colors to rowColors (16 colors per block)
+		StageTimer timer(profiler, STAGE_GATHER);
+		gatherBlocks<Format>(image, h4, 0, nBlocksPerRow, rowColors);
+
+		// compress the row's 4x4 blocks of 24bit colors (48b) to 8byte DXT1 blocks
+		timer.next(STAGE_ENCODE);
+		compressDxt1Blocks(rowColors, blocks + blockIdx, nBlocksPerRow, blockErrors ? blockErrors + blockIdx : 0, cache, rdo);
+
+		// filter the next mip level rows from the scanlines just read
+		if (nextLevel)
 		{
-			for (h = 0; h < 4; ++h) // iterate block pixels height-direction
+			timer.next(STAGE_DOWNSAMPLE);
+			// scanlines[h]: the image scanline h4 + h (the last one repeated past the bottom) as 24bit colors
+			const RGBTriplet* scanlines[4];
+			for (int h = 0; h < 4; ++h)
 			{
-				for (w = 0; w < 4; ++w) // // iterate block pixels width-direction
+				const byte* scanline = image.scanline(min(h4 + h, image.height - 1));
+				if (scanlineColors)
 				{
-					if (isBottomUp) // pixel data are stored from bottom left to top right
-						pixelIdx = w4 + w + (imgHeight - h4 - h - 1) * imgWidth;
-					else // TL to BR
-						pixelIdx = w4 + w + (h4 + h) * imgWidth;
-					
-					// get and save the pixel color to the blockColors
-					blockColors[w + h * 4] = bmpBuffer[pixelIdx];
+					loadScanline<Format>(scanline, image.width, scanlineColors + h * image.width);
+					scanlines[h] = scanlineColors + h * image.width;
 				}
+				else
+					scanlines[h] = (const RGBTriplet*)scanline;
 			}
 
-			// compress a 4x4 block of 24bit colors (48b) to 8byte DXT1 block
-			compressDxt1Block(blockColors, blocks[blockIdx]);
-
-			++blockIdx;
+			int nextWidth = Downsampler::halfSize(image.width);
+			int nextHeight = Downsampler::halfSize(image.height);
+			for (int y = h4 / 2; y < h4 / 2 + 2 && y < nextHeight; ++y)
+				downsampler.downsampleRow(scanlines[(y * 2 - h4)], scanlines[(y * 2 - h4) + 1], image.width, nextLevel + y * nextWidth);
 		}
+		timer.stop();
+
+		if (profiler)
+			profiler->countEncodedBlocks(rowColors, nBlocksPerRow);
+
+		blockIdx += nBlocksPerRow;
 	}
 }
 
-void Compressor::decompressDDS(const Dxt1Block* blocks, RGBTriplet* outputColors, const int nBlocks, const int imgWidth)
+void Compressor::compressMipChain(const ImageView& image, Dxt1Block* blocks, const int nLevels, ScratchArena& arena, unsigned int* blockErrors,
+	const MappedFile* input, const MappedFile* output)
 {
-	cout << "- converting..." << endl;
+	// two level images used in turn: the one being compressed and the next one being filtered from it
+	RGBTriplet* levelPixels[2] = { 0, 0 };
+	int w = Downsampler::halfSize(image.width), h = Downsampler::halfSize(image.height);
+	if (nLevels > 1)
+		levelPixels[0] = arena.allocateArray<RGBTriplet>((size_t)w * h);
+	if (nLevels > 2)
+		levelPixels[1] = arena.allocateArray<RGBTriplet>((size_t)Downsampler::halfSize(w) * Downsampler::halfSize(h));
+
+	if (input)
+		compressBMPPipelined(image, blocks, blockErrors, levelPixels[0], *input, output);
+	else
+		compressBMP(image, blocks, arena, blockErrors, levelPixels[0]);
+	blocks += mipChainBlocks(image.width, image.height, 1);
+
+	for (int level = 1; level < nLevels; ++level)
+	{
+		RGBTriplet* pixels = levelPixels[(level - 1) % 2];
+		RGBTriplet* nextLevel = level + 1 < nLevels ? levelPixels[level % 2] : 0;
+		compressBMP(ImageView(pixels, (ptrdiff_t)w * 3, w, h), blocks, arena, 0, nextLevel);
 
+		blocks += mipChainBlocks(w, h, 1);
+		w = Downsampler::halfSize(w);
+		h = Downsampler::halfSize(h);
+	}
+}
+
+void Compressor::decompressDDS(const Dxt1Block* blocks, RGBTriplet* firstScanline, const ptrdiff_t stride, const int imgWidth, const int imgHeight)
+{
 	// nBlocksPerRow: number of blocks in one row of the image
-	// pixelIdx: pixel index in the outputColors space
-	// cIdx: color index, each of the 16 block pixels will use to map it to one of the 4 block colors c0, c1, c2, c3
-	// colors[4]: array of the 4 block colors c0, c1, c2, c3
-	int nBlocksPerRow = imgWidth / 4;
-	int pixelIdx, cIdx;
-	RGBTriplet colors[4];
+	// each row of blocks expands to 4 consecutive scanlines
+	int nBlocksPerRow = (imgWidth + 3) / 4;
+	int nBlockRows = (imgHeight + 3) / 4;
+
+	StageTimer timer(profiler, STAGE_DECODE);
+	if (profiler)
+		profiler->countDecodedBlocks((long long)nBlocksPerRow * nBlockRows);
+
+	// expanded palettes of this image, blocks sharing end points skip the expansion
+	PaletteCache* cache = new PaletteCache;
+	cache->init();
+
+	// partial blocks (small mip levels) are expanded whole first
+	RGBTriplet* paddedRow = imgWidth % 4 != 0 || imgHeight % 4 != 0 ? new RGBTriplet[nBlocksPerRow * 16] : 0;
 
-	for (int i = 0; i < nBlocks; ++i) // loop over blocks
+	for (int row = 0; row < nBlockRows; ++row)
 	{
-		// expand c0, c1 from RGB565 to RGB888, and calculate c2, c3
-		// (RGB565 to RGB888 source: http://forum.arduino.cc/index.php?topic=285303.0#/?)
-		colors[0].r = ((((blocks[i].c0 >> 11) & 0x1F) * 527) + 23) >> 6;
-		colors[0].g = ((((blocks[i].c0 >> 5) & 0x3F) * 259) + 33) >> 6;
-		colors[0].b = (((blocks[i].c0 & 0x1F) * 527) + 23) >> 6;
+		RGBTriplet* rowPixels = (RGBTriplet*)((byte*)firstScanline + (ptrdiff_t)row * 4 * stride);
+		decompressDDSRow(blocks + row * nBlocksPerRow, rowPixels, stride, imgWidth, min(4, imgHeight - row * 4), *cache, paddedRow);
+	}
 
-		colors[1].r = ((((blocks[i].c1 >> 11) & 0x1F) * 527) + 23) >> 6;
-		colors[1].g = ((((blocks[i].c1 >> 5) & 0x3F) * 259) + 33) >> 6;
-		colors[1].b = (((blocks[i].c1 & 0x1F) * 527) + 23) >> 6;
+	delete[] paddedRow;
 
-		colors[2].r = colors[0].r * (2.0f / 3.0f) + colors[1].r * (1.0f / 3.0f);
-		colors[2].g = colors[0].g * (2.0f / 3.0f) + colors[1].g * (1.0f / 3.0f);
-		colors[2].b = colors[0].b * (2.0f / 3.0f) + colors[1].b * (1.0f / 3.0f);
+	paletteHits += cache->hits;
+	paletteMisses += cache->misses;
+	delete cache;
+}
 
-		colors[3].r = colors[0].r * (1.0f / 3.0f) + colors[1].r * (2.0f / 3.0f);
-		colors[3].g = colors[0].g * (1.0f / 3.0f) + colors[1].g * (2.0f / 3.0f);
-		colors[3].b = colors[0].b * (1.0f / 3.0f) + colors[1].b * (2.0f / 3.0f);
-		
-		// loop over and update block pixels based on indices
-		for (int h = 0; h < 4; h++)
-		{
-			for (int w = 0; w < 4; w++)
-			{
-				// calc pixel index in the outputColors space
-				pixelIdx = w + h * imgWidth + (i % nBlocksPerRow) * 4 + (i / nBlocksPerRow) * 4 * imgWidth;
-
-				// calc the color index corresponding to c0, c1, c2 or c3
-				cIdx = (blocks[i].indices[h] >> (w % 4) * 2) & 0x3;
-				
-				// update the pixel color
-				outputColors[pixelIdx].r = colors[cIdx].r;
-				outputColors[pixelIdx].g = colors[cIdx].g;
-				outputColors[pixelIdx].b = colors[cIdx].b;
-			}
-		}
+void Compressor::decompressDDSRow(const Dxt1Block* blocks, RGBTriplet* rowPixels, const ptrdiff_t stride, const int imgWidth, const int nScanlines,
+	PaletteCache& cache, RGBTriplet* paddedRow)
+{
+	if (imgWidth % 4 == 0 && nScanlines == 4)
+	{
+		simdDecoder.decompressBlockRow(blocks, rowPixels, imgWidth, stride, cache);
+		return;
 	}
+
+	// partial blocks: expand whole blocks and keep the pixels inside the image
+	int paddedWidth = (imgWidth + 3) / 4 * 4;
+	simdDecoder.decompressBlockRow(blocks, paddedRow, paddedWidth, paddedWidth * 3, cache);
+
+	for (int h = 0; h < nScanlines; ++h)
+		memcpy((byte*)rowPixels + h * stride, paddedRow + h * paddedWidth, imgWidth * 3);
 }
 
 void Compressor::compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& block)
@@ -233,7 +1089,8 @@ void Compressor::compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& blo
 	{
 		// (intensity equation source: https://en.wikipedia.org/wiki/Relative_luminance)
 		// the intensity equation, generates better images but also generates unexpected alpha spots
-		intensity_i = (0.2125 * blockColors[i].r) + (0.7154 * blockColors[i].g) + (0.0721 * blockColors[i].b);
+		// (in fixed point, see LUMINANCE_R)
+		intensity_i = (LUMINANCE_R * blockColors[i].r + LUMINANCE_G * blockColors[i].g + LUMINANCE_B * blockColors[i].b) >> LUMINANCE_SHIFT;
 		
 		//cout << hex << " ci:" << toHex(blockColors[i]) << ", intensity:" << intensity_i << endl;
 		if (intensity_i < c1_intensity)
@@ -268,36 +1125,39 @@ void Compressor::compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& blo
 			swap(c0, c1);
 		}
 
-		// calculating c2 and c3
-		colors[2].r = colors[0].r * (2.0f / 3.0f) + colors[1].r * (1.0f / 3.0f);
-		colors[2].g = colors[0].g * (2.0f / 3.0f) + colors[1].g * (1.0f / 3.0f);
-		colors[2].b = colors[0].b * (2.0f / 3.0f) + colors[1].b * (1.0f / 3.0f);
-		colors[3].r = colors[0].r * (1.0f / 3.0f) + colors[1].r * (2.0f / 3.0f);
-		colors[3].g = colors[0].g * (1.0f / 3.0f) + colors[1].g * (2.0f / 3.0f);
-		colors[3].b = colors[0].b * (1.0f / 3.0f) + colors[1].b * (2.0f / 3.0f);
-
-		// calc pixels indices
-		float min_dis_sq; // minimum suqare distance
-		float curr_dis_sq; // current suqare distance
+		// calculating c2 and c3 (integers give exactly the same colors as the float 2/3, 1/3 weights)
+		colors[2].r = (2 * colors[0].r + colors[1].r) / 3;
+		colors[2].g = (2 * colors[0].g + colors[1].g) / 3;
+		colors[2].b = (2 * colors[0].b + colors[1].b) / 3;
+		colors[3].r = (colors[0].r + 2 * colors[1].r) / 3;
+		colors[3].g = (colors[0].g + 2 * colors[1].g) / 3;
+		colors[3].b = (colors[0].b + 2 * colors[1].b) / 3;
+
+		// calc pixels indices (the block may be reused, clear the previous indices first)
+		for (int i = 0; i < 4; ++i)
+			block.indices[i] = 0;
+
+		int min_dis_sq; // minimum suqare distance
+		int curr_dis_sq; // current suqare distance
 		int currIndex;	// current pixel index
 		for (int i = 0; i < 16; ++i) // loop over block pixels
 		{
 			//cout << hex << "bc:" << toHex(blockColors[i]);
 
-			min_dis_sq = FLT_MAX;
+			min_dis_sq = INT_MAX;
 			currIndex = -1;
 			for (int j = 0; j < 4; j++) // loop over the colors c0 to c3
 			{
 				// calc distance squared (didnt take square root to save some performance cycles)
-				curr_dis_sq = pow(blockColors[i].r - colors[j].r, 2) + pow(blockColors[i].g - colors[j].g, 2) + pow(blockColors[i].b - colors[j].b, 2);
+				int dr = blockColors[i].r - colors[j].r, dg = blockColors[i].g - colors[j].g, db = blockColors[i].b - colors[j].b;
+				curr_dis_sq = dr * dr + dg * dg + db * db;
 
 				//cout << ", dc" << j << ":" << curr_dis_sq;
 
-				if (curr_dis_sq < min_dis_sq)
-				{
-					min_dis_sq = curr_dis_sq;
-					currIndex = j;
-				}
+				// (selects instead of a branch, the compiler emits conditional moves)
+				bool closer = curr_dis_sq < min_dis_sq;
+				min_dis_sq = closer ? curr_dis_sq : min_dis_sq;
+				currIndex = closer ? j : currIndex;
 			}
 
 			//cout << ", idx:" << currIndex << endl;
@@ -320,9 +1180,103 @@ void Compressor::compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& blo
 	//cout << hex << "c0:" << block.c0 << ", c1:" << block.c1 << endl << endl;
 }
 
-void Compressor::saveDDS(const Dxt1Block* blocks, const int nBlocks, const int imageWidth, const int imageHeight)
+void Compressor::compressGeneralBlocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks)
+{
+	if (encoderTier == TIER_RANGE_FIT)
+	{
+		for (int i = 0; i < nBlocks; ++i)
+			rangeEncoder.compressDxt1Block(blockColors + i * 16, blocks[i]);
+	}
+	else
+	{
+		// whole batches go through the SIMD kernel, the tail (or everything on CPUs without SSE4.1) is scalar
+		int i = simdEncoder.compressBlocks(blockColors, blocks, nBlocks);
+
+		for (; i < nBlocks; ++i)
+			compressDxt1Block(blockColors + i * 16, blocks[i]);
+	}
+}
+
+void Compressor::compressDxt1Blocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks, unsigned int* blockErrors,
+	BlockCache* cache, RdoOptimizer* rdo)
+{
+	if (cache)
+	{
+		// only the blocks not seen before are compressed (consecutive, so they still go through the SIMD batches)
+		int nMisses = cache->collectMisses(blockColors, blocks, nBlocks);
+		compressDxt1Blocks(cache->getMissColors(), cache->getMissBlocks(), nMisses);
+		cache->storeMisses(blocks, nBlocks);
+	}
+	else
+	{
+		// the general blocks are gathered in batches for the encoder tier (so they still go through the SIMD kernel),
+		// the SIMD kernel is faster than the low-variance encoder, the range fit is not
+		bool lowVariance = encoderTier == TIER_RANGE_FIT;
+
+		// raw storage (aligned for the blocks' 16bit end points), the constructors of the typed arrays would clear it
+		alignas(RGBTriplet) byte batchColorBytes[CLASSIFIER_BATCH_BLOCKS * 16 * sizeof(RGBTriplet)];
+		alignas(Dxt1Block) byte batchBlockBytes[CLASSIFIER_BATCH_BLOCKS * sizeof(Dxt1Block)];
+		RGBTriplet* batchColors = (RGBTriplet*)batchColorBytes;
+		Dxt1Block* batchBlocks = (Dxt1Block*)batchBlockBytes;
+		int batchTargets[CLASSIFIER_BATCH_BLOCKS];
+		int nBatch = 0;
+
+		// the batch is a run of consecutive general blocks, compressed in place, until another block breaks it:
+		// only then are its colors copied
+		bool inPlace = true;
+
+		auto compressBatch = [&]()
+		{
+			if (inPlace)
+			{
+				compressGeneralBlocks(blockColors + batchTargets[0] * 16, blocks + batchTargets[0], nBatch);
+			}
+			else
+			{
+				compressGeneralBlocks(batchColors, batchBlocks, nBatch);
+				for (int j = 0; j < nBatch; ++j)
+					blocks[batchTargets[j]] = batchBlocks[j];
+			}
+			nBatch = 0;
+			inPlace = true;
+		};
+
+		for (int i = 0; i < nBlocks; ++i)
+		{
+			if (blockClassifier.compressDxt1Block(blockColors + i * 16, blocks[i], lowVariance))
+				continue;
+
+			if (inPlace && nBatch > 0 && i != batchTargets[nBatch - 1] + 1)
+			{
+				memcpy(batchColors, blockColors + batchTargets[0] * 16, nBatch * 16 * sizeof(RGBTriplet));
+				inPlace = false;
+			}
+
+			if (!inPlace)
+				memcpy(batchColors + nBatch * 16, blockColors + i * 16, 16 * sizeof(RGBTriplet));
+			batchTargets[nBatch++] = i;
+			if (nBatch == CLASSIFIER_BATCH_BLOCKS)
+				compressBatch();
+		}
+
+		if (nBatch > 0)
+			compressBatch();
+	}
+
+	// the cache holds the encoder blocks, the optimized blocks depend on the blocks before them
+	if (rdo)
+		rdo->optimizeBlocks(blockColors, blocks, nBlocks);
+
+	// the encoders distances are to the unquantized c0..c3, the error is measured on the decoded colors
+	if (blockErrors)
+	{
+		for (int i = 0; i < nBlocks; ++i)
+			blockErrors[i] = ErrorMetrics::blockError(blockColors + i * 16, blocks[i]);
+	}
+}
+
+void Compressor::fillDDSHeader(DDS_HEADER& ddsHeader, const int imageWidth, const int imageHeight, const int nMipLevels) const
 {
-	DDS_HEADER ddsHeader;
 	ddsHeader.dwMagic = 0x20534444; // 'DDS '
 	ddsHeader.dwSize = 124;
 	ddsHeader.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
@@ -330,7 +1284,7 @@ void Compressor::saveDDS(const Dxt1Block* blocks, const int nBlocks, const int i
 	ddsHeader.dwWidth = imageWidth;
 	ddsHeader.dwPitchOrLinearSize = max(1, ((imageWidth + 3) / 4)) * 8; // 8: block size in bytes for dxt1
 	ddsHeader.dwDepth = 0; // unused
-	ddsHeader.dwMipMapCount = 0; // unused
+	ddsHeader.dwMipMapCount = nMipLevels > 1 ? nMipLevels : 0; // unused without mipmaps
 
 	for (int i = 0; i < 11; ++i)
 		ddsHeader.dwReserved1[i] = 0; // unused
@@ -346,33 +1300,52 @@ void Compressor::saveDDS(const Dxt1Block* blocks, const int nBlocks, const int i
 	ddsHeader.ddspf.dwABitMask = 0x0;  // unused
 
 	ddsHeader.dwCaps = DDSCAPS_TEXTURE;
+
+	if (nMipLevels > 1)
+	{
+		ddsHeader.dwFlags |= DDSD_MIPMAPCOUNT;
+		ddsHeader.dwCaps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	}
 	ddsHeader.dwCaps2 = 0;  // unused
 	ddsHeader.dwCaps3 = 0;  // unused
 	ddsHeader.dwCaps4 = 0;  // unused
 	ddsHeader.dwReserved2 = 0;  // unused
+}
+
+bool Compressor::saveDDS(const Dxt1Block* blocks, const int nBlocks, const int imageWidth, const int imageHeight, const int nMipLevels,
+	const string& outputPath)
+{
+	StageTimer timer(profiler, STAGE_WRITE);
+	DDS_HEADER ddsHeader;
+	fillDDSHeader(ddsHeader, imageWidth, imageHeight, nMipLevels);
 	
 	// create output file
 	ofstream ddsFile;
-	ddsFile.open(DDS_FILE_NAME, ofstream::out | ofstream::binary);
+	ddsFile.open(outputPath, ofstream::out | ofstream::binary);
 
 	// write header data
 	ddsFile.write((char*)&ddsHeader, sizeof(DDS_HEADER));
 
 	// write DXT1 blocks data
-	for (int i = 0; i < nBlocks; ++i)
-	{
-		ddsFile.write((char*)blocks, sizeof(Dxt1Block));
-		blocks++;
-	}
+	ddsFile.write((char*)blocks, (streamsize)nBlocks * sizeof(Dxt1Block));
 	
 	ddsFile.close();
+
+	if (!ddsFile)
+	{
+		cout << "- can't write " << outputPath << endl;
+		return false;
+	}
+
+	if (profiler)
+		profiler->countBytesWritten(sizeof(DDS_HEADER) + (long long)nBlocks * sizeof(Dxt1Block));
+
+	return true;
 }
 
-void Compressor::saveBMP(const RGBTriplet* pixelColors, const int imageWidth, const int imageHeight)
+void Compressor::fillBMPHeader(BMP_HEADER& bmpHeader, const int imageWidth, const int imageHeight) const
 {
-	BMP_HEADER bmpHeader;
-
-	int pixelsSize = sizeof(RGBTriplet) * imageWidth * imageHeight;
+	int pixelsSize = ((imageWidth * 3 + 3) & ~3) * imageHeight; // scanlines padded to 4 bytes
 
 	// file header
 	bmpHeader.signature = 0x4d42; // 'BM'
@@ -392,20 +1365,39 @@ void Compressor::saveBMP(const RGBTriplet* pixelColors, const int imageWidth, co
 	bmpHeader.resY = 3;
 	bmpHeader.ncolours = 0;
 	bmpHeader.importantcolours = 0;
+}
+
+bool Compressor::saveBMP(const RGBTriplet* pixelColors, const int imageWidth, const int imageHeight, const string& outputPath)
+{
+	StageTimer timer(profiler, STAGE_WRITE);
+	BMP_HEADER bmpHeader;
+	fillBMPHeader(bmpHeader, imageWidth, imageHeight);
 
 	// create output file
 	ofstream bmpFile;
-	bmpFile.open(BMP_FILE_NAME, ofstream::out | ofstream::binary);
+	bmpFile.open(outputPath, ofstream::out | ofstream::binary);
 
 	// write header data
 	bmpFile.write((char*)&bmpHeader, sizeof(BMP_HEADER));
 
 	// write pixel data
-	bmpFile.write((char*)pixelColors, pixelsSize);
-
-	cout << "- file coverted and saved successfully to " << BMP_FILE_NAME << endl;
+	bmpFile.write((char*)pixelColors, bmpHeader.imageSize);
 
 	bmpFile.close();
+
+	if (!bmpFile)
+	{
+		cout << "- can't write " << outputPath << endl;
+		return false;
+	}
+
+	if (profiler)
+		profiler->countBytesWritten(bmpHeader.fileSize);
+
+	if (verbose)
+		cout << "- file coverted and saved successfully to " << outputPath << endl;
+
+	return true;
 }
 
 void Compressor::printBMPHeader(BMP_HEADER& header) const
@@ -457,6 +1449,16 @@ void Compressor::printDDSHeader(DDS_HEADER& header) const
 	cout << "* dwABitMask: " << header.ddspf.dwABitMask << endl;
 }
 
+PixelFormat Compressor::bmpPixelFormat(const BMP_HEADER& header)
+{
+	return header.colorDepth == 32 ? PIXEL_BGRA32 : PIXEL_BGR24;
+}
+
+long long Compressor::bmpRowBytes(const BMP_HEADER& header)
+{
+	return ((long long)header.imageWidth * (header.colorDepth / 8) + 3) & ~3LL;
+}
+
 bool Compressor::isValidBMPFile(BMP_HEADER& header) const
 {
 	// check correct BMP signature
@@ -466,10 +1468,10 @@ bool Compressor::isValidBMPFile(BMP_HEADER& header) const
 		return false;
 	}
 
-	// check 24bit BMP
-	if (header.colorDepth != 24)
+	// check 24bit or 32bit BMP (the 32bit alpha is ignored)
+	if (header.colorDepth != 24 && header.colorDepth != 32)
 	{
-		cout << "* only 24bit BMP files supported." << '\n';
+		cout << "* only 24bit and 32bit BMP files supported." << '\n';
 		return false;
 	}
 
@@ -488,6 +1490,13 @@ bool Compressor::isValidBMPFile(BMP_HEADER& header) const
 		return false;
 	}
 
+	// check not empty (negative heights are top-down files)
+	if (header.imageWidth <= 0 || header.imageHeight == 0)
+	{
+		cout << "* BMP file has no pixels." << '\n';
+		return false;
+	}
+
 	return true;
 }
 
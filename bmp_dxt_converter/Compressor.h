@@ -8,28 +8,263 @@ Purpose: Converts from bmp to DXT1 dds and vice versa
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <mutex>
 #include <string>
 #include "bmp_dxt1_headers.h"
+#include "SimdEncoder.h"
+#include "SimdDecoder.h"
+#include "Downsampler.h"
+#include "ThreadPool.h"
+#include "RangeEncoder.h"
+#include "ScratchArena.h"
+#include "ErrorMetrics.h"
+#include "BlockCache.h"
+#include "RdoOptimizer.h"
+#include "MappedFile.h"
+#include "ImageView.h"
+#include "Profiler.h"
+#include "BlockClassifier.h"
+#include "ConversionCache.h"
 
 using namespace std;
 
-// generated dds, bmp file names(TODO: use input file name for output file instead of fixed output name)
+// default generated dds, bmp file names (used by the interactive mode, batch mode derives the names from the input files)
 #define	DDS_FILE_NAME	"dds_output.dds"	
 #define	BMP_FILE_NAME	"bmp_output.bmp"
 
+// the files go through the read, convert and write stages (see Pipeline) in chunks of block rows of about this many
+// bytes of pixels, the streaming encoder keeps 3 chunks in memory
+#define PIPELINE_CHUNK_BYTES	(4 << 20)
+
+// general blocks gathered for the encoder tier at once (a multiple of every SIMD batch width)
+#define CLASSIFIER_BATCH_BLOCKS	64
+
+// a rectangle of pixels of an image
+struct ImageRegion
+{
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+/**
+Parse a decimal number: digits only, at most 18 so any of them fits
+
+@return false if the text is not a number
+*/
+bool parseNumber(const string& text, unsigned long long& value);
+
+/**
+Parse a "x,y,width,height" rectangle
+
+@return false if the text is not 4 comma separated numbers (each fitting an int) or the rectangle is empty
+*/
+bool parseRegion(const string& text, ImageRegion& region);
+
+// block encoders to choose from, trading speed for quality
+enum EncoderTier
+{
+	TIER_INTENSITY = 0,	// c0/c1 are the brightest and darkest pixels (SIMD accelerated)
+	TIER_RANGE_FIT		// c0/c1 are the pixels extremes on the colors principal axis (RangeEncoder, scalar: slower, better quality)
+};
+
 class Compressor
 {
+	// in-memory API, shares the encoders and threads of its compressor
+	friend class EncoderContext;
+
+	// times the block encoders directly
+	friend class Benchmark;
+
+	// patches the changed blocks of an existing DDS file
+	friend class IncrementalEncoder;
+
+	// packs DDS files on the compressor threads
+	friend class BlockPacker;
+
+	// runs the jobs of the conversion server on files held in memory
+	friend class ConversionServer;
+
 private:
+	// block encoder used by compress()
+	EncoderTier encoderTier;
+
+	// if true, compress() reads the BMP 4 scanlines at a time instead of mapping the whole file
+	bool streamingMode;
+
+	// print progress and success messages (errors are always printed)
+	bool verbose;
+
+	// if true, compress() saves the whole mip chain (down to 1x1) in the DDS file
+	bool mipmaps;
+
+	// entries of the per thread duplicate block caches, 0 to compress every block
+	int blockCacheEntries;
+
+	// rate-distortion optimization lambda (see RdoOptimizer), 0 to keep the encoder blocks
+	int rdoLambda;
+
+	// rate-distortion optimization results of all the compressions (guarded by rdoStatsMutex)
+	RdoStats rdoStats;
+	mutex rdoStatsMutex;
+
+	// block cache hits and misses of all the compressions
+	atomic<long long> cacheHits;
+	atomic<long long> cacheMisses;
+
+	// palette cache hits and misses of all the decompressions
+	atomic<long long> paletteHits;
+	atomic<long long> paletteMisses;
+
+	// principal axis encoder used by TIER_RANGE_FIT
+	RangeEncoder rangeEncoder;
+
+	// encoders of the solid, two-color and low-variance blocks, ahead of the encoder tier (all tiers and SIMD levels)
+	BlockClassifier blockClassifier;
+
+	// vectorized block encoder, selected for the running CPU
+	SimdEncoder simdEncoder;
+
+	// vectorized row decoder, selected for the running CPU
+	SimdDecoder simdDecoder;
+
+	// 2x2 box filter building the mip levels
+	Downsampler downsampler;
+
+	// worker threads sharing the block rows of an image
+	ThreadPool* threadPool;
+
+	// stage timings and counters of all the conversions, null unless profiling
+	Profiler* profiler;
+
+	// DDS files of the inputs already compressed, null unless enabled
+	ConversionCache* conversionCache;
+
+	/**
+	Key of a compression in the conversion cache: the hash of the BMP header and scanlines, followed by the
+	settings changing the DDS bytes
+
+	@param inputHash hash of the BMP header then of the scanlines from top to bottom
+	@param nLevels mip levels saved in the DDS file
+	*/
+	ConversionKey conversionKey(ContentHash& inputHash, const int nLevels) const;
+
 	/**
-	Compress bmp pixels colors into DXT1 blocks
+	Save the DDS file of a compression from the conversion cache
 
-	@param bmpBuffer source colors to compress
+	@param key key of the compression
+	@param outputPath DDS file path
+	@return true if the DDS file was in the cache, false if it has to be compressed
+	*/
+	bool fetchConverted(const ConversionKey& key, const string& outputPath);
+
+	/**
+	Compress pixels colors into DXT1 blocks. Block rows are split into bands compressed in parallel
+	on the thread pool, the blocks are the same whatever the number of threads. Sizes that are not
+	a multiple of 4 (small mip levels) repeat the last column/row in the partial blocks.
+	The block rows are gathered by compressBlockRows specialized for the image pixel format.
+
+	@param image source image (negative stride for bottom-up BMPs)
 	@param blocks target blocks where the compressed colors and indices will be saved
-	@param imgWidth image width
-	@param imgHeight image height
-	@param isBottomUp if true, the bmp pixels array "bmpBuffer" is stored from bottom to top
+	@param arena scratch memory for the threads block colors (reset by the caller)
+	@param blockErrors if not null, receives the squared error of every block (see ErrorMetrics)
+	@param nextLevel if not null, receives the half size image (next mip level, top to bottom, unpadded),
+	filtered from the scanlines of each block row while they are in cache
+
+	With the block cache enabled, each thread has its own cache for the image.
 	*/
-	void compressBMP(const RGBTriplet* bmpBuffer, Dxt1Block* blocks, const int imgWidth, const int imgHeight, const bool isBottomUp);
+	void compressBMP(const ImageView& image, Dxt1Block* blocks, ScratchArena& arena, unsigned int* blockErrors, RGBTriplet* nextLevel);
+
+	/**
+	Compress a mapped image with compressBMP in chunks of block rows going through a Pipeline: the pages of the
+	next chunk are read from the input file and the blocks of the previous chunk written to the output file while
+	the chunk between them is compressed. Heights that are not a multiple of 4 are compressed in one piece.
+
+	@param input mapped file holding the image
+	@param output if not null, mapped file holding the blocks
+	(other parameters as compressBMP, arena is unused)
+	*/
+	void compressBMPPipelined(const ImageView& image, Dxt1Block* blocks, unsigned int* blockErrors, RGBTriplet* nextLevel,
+		const MappedFile& input, const MappedFile* output);
+
+	/**
+	Compress a band of block rows of an image of the pixel format Format (see ImageView.h)
+
+	@param image source image
+	@param blocks target blocks of the whole image
+	@param firstRow first block row of the band
+	@param endRow block row after the last one of the band
+	@param rowColors scratch buffer for the colors of one block row (16 colors per block)
+	@param scanlineColors scratch buffer for 4 scanlines converted to 24bit colors (for the downsampler), null for PIXEL_BGR24
+	@param blockErrors if not null, the error map of the whole image
+	@param nextLevel if not null, the half size image receiving the rows covered by the band
+	@param cache if not null, the calling thread's block cache
+	@param rdo if not null, the calling thread's rate-distortion optimizer
+	*/
+	template <class Format>
+	void compressBlockRows(const ImageView& image, Dxt1Block* blocks, const int firstRow, const int endRow, RGBTriplet* rowColors,
+		RGBTriplet* scanlineColors, unsigned int* blockErrors, RGBTriplet* nextLevel, BlockCache* cache, RdoOptimizer* rdo);
+
+	/**
+	Set up one block cache per thread if the cache is enabled
+
+	@param arena memory of the caches
+	@param maxRowBlocks largest number of blocks compressed at once
+	@param nBlocks number of blocks of the image (smaller images get smaller caches)
+	@return the caches, indexed by thread slot, or null if the cache is disabled
+	*/
+	BlockCache* createBlockCaches(ScratchArena& arena, const int maxRowBlocks, const long long nBlocks);
+
+	/**
+	Add the hits and misses of the caches to the compressor counters
+	*/
+	void addBlockCacheStats(const BlockCache* caches);
+
+	/**
+	Set up one rate-distortion optimizer per thread if the optimization is enabled
+
+	@param arena memory of the optimizers
+	@return the optimizers, indexed by thread slot, or null if the optimization is disabled
+	*/
+	RdoOptimizer* createRdoOptimizers(ScratchArena& arena);
+
+	/**
+	Add the results of the optimizers to the compressor totals
+	*/
+	void addRdoStats(const RdoOptimizer* optimizers);
+
+	/**
+	Compress an image and its mip levels. Each level is filtered while its parent is compressed and compressed
+	right after, while it is still in cache; the blocks of the levels follow each other (DDS order).
+
+	@param image source image (negative stride for bottom-up BMPs)
+	@param blocks target blocks, mipChainBlocks(image.width, image.height, nLevels) blocks
+	@param nLevels number of levels including the full size image (1 for no mipmaps)
+	@param arena scratch memory (reset by the caller)
+	@param blockErrors if not null, receives the squared error of every block of the full size image
+	@param input if not null, mapped file holding the image: the full size image is compressed by compressBMPPipelined
+	@param output if not null, mapped file holding the blocks
+	*/
+	void compressMipChain(const ImageView& image, Dxt1Block* blocks, const int nLevels, ScratchArena& arena, unsigned int* blockErrors,
+		const MappedFile* input = 0, const MappedFile* output = 0);
+
+	/**
+	Compress a BMP file chunk by chunk: the scanlines of a few block rows are read (from the end of the file for
+	bottom-up BMPs), compressed and appended to the DDS file. The chunks go through a Pipeline, reading the next
+	chunk and writing the previous one overlap the compression. Memory use only depends on the image width
+	and file offsets are 64bit, so images of any height fit.
+
+	@param filePath BMP file path
+	@param outputPath DDS file path
+	@param metrics if not null, receives the compression error
+	@param cacheKey conversion cache key of the file if compress() already looked it up, else the read stage
+	hashes the file for the cache
+	@return true if the DDS file was saved
+	*/
+	bool compressStreaming(const string& filePath, const string& outputPath, ErrorMetrics* metrics, const ConversionKey* cacheKey = 0);
 
 	/**
 	Compress 16 pixel colors into 1 DXT1 block (2 RGB565 colors and 16 indices)
@@ -40,41 +275,134 @@ private:
 	void compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& block);
 
 	/**
-	Decompress dds blocks into pixel colors.
+	Compress consecutive general blocks (see BlockClassifier) with the encoder of the selected tier. For TIER_INTENSITY
+	the SIMD batch kernel compresses whole batches and compressDxt1Block the remaining blocks (identical to calling
+	compressDxt1Block per block)
 
-	@param blocks source blocks containing compressed data
-	@param outputColors target colors where expanded pixel colors will be saved
+	@param blockColors source colors, 16 consecutive colors per block
+	@param blocks target blocks
 	@param nBlocks number of blocks
+	*/
+	void compressGeneralBlocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks);
+
+	/**
+	Compress consecutive blocks: the solid, two-color and low-variance blocks with the encoders of their class, the
+	general blocks with the encoder of the selected tier (compressGeneralBlocks)
+
+	@param blockColors source colors, 16 consecutive colors per block
+	@param blocks target blocks
+	@param nBlocks number of blocks
+	@param blockErrors if not null, receives the squared error of every block, measured right after the encoder
+	while the block colors are still in cache
+	@param cache if not null, blocks already compressed are taken from this cache and only the others compressed
+	@param rdo if not null, the compressed blocks go through this rate-distortion optimizer (the blocks must be
+	a row or a piece of a row starting at a multiple of RDO_SEGMENT_BLOCKS)
+	*/
+	void compressDxt1Blocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks, unsigned int* blockErrors = 0,
+		BlockCache* cache = 0, RdoOptimizer* rdo = 0);
+
+	/**
+	Decompress dds blocks into pixel colors, one row of blocks (4 scanlines) at a time.
+	Sizes that are not a multiple of 4 (small mip levels) only keep the image part of the partial blocks.
+
+	@param blocks source blocks containing compressed data
+	@param firstScanline target first pixel of the top scanline of the image
+	@param stride bytes from a scanline to the one below it
 	@param imgWidth image width
+	@param imgHeight image height
 	*/
-	void Compressor::decompressDDS(const Dxt1Block* blocks, RGBTriplet* outputColors, const int nBlocks, const int imgWidth);
-	
+	void decompressDDS(const Dxt1Block* blocks, RGBTriplet* firstScanline, const ptrdiff_t stride, const int imgWidth, const int imgHeight);
+
 	/**
-	Save DXT1 compressed blocks to a dds file
+	Decompress a row of blocks (the scanlines of the row inside the image)
+
+	@param blocks the blocks of the row
+	@param rowPixels target first pixel of the top scanline of the row
+	@param stride bytes from a scanline to the one below it
+	@param imgWidth image width
+	@param nScanlines scanlines of the row inside the image, 4 but for the last row of a partial blocks height
+	@param cache palette cache of the calling thread
+	@param paddedRow if the width or height is not a multiple of 4 (small mip levels), pixels of the 4 scanlines of
+	whole blocks, the partial blocks are expanded there first
+	*/
+	void decompressDDSRow(const Dxt1Block* blocks, RGBTriplet* rowPixels, const ptrdiff_t stride, const int imgWidth, const int nScanlines,
+		PaletteCache& cache, RGBTriplet* paddedRow);
+
+	/**
+	Find the blocks of a mip level in a DDS file
+
+	@param ddsHeader the file header, checked by isValidDDSFile
+	@param fileSize size of the file
+	@param mipLevel mip level, 0 for the full size image
+	@param imgWidth receives the level width
+	@param imgHeight receives the level height
+	@param levelOffset receives the file offset of the level first block
+	@return false (and print why) if the file doesn't have the level or is truncated
+	*/
+	bool locateMipLevel(const DDS_HEADER& ddsHeader, const unsigned long long fileSize, const int mipLevel, int& imgWidth, int& imgHeight,
+		unsigned long long& levelOffset) const;
+
+	/**
+	Fill a DXT1 dds file header
+
+	@param ddsHeader target header (including the DDS magic number)
+	@param imgWidth image width
+	@param imgHeight image height
+	@param nMipLevels number of mip levels including the full size image
+	*/
+	void fillDDSHeader(DDS_HEADER& ddsHeader, const int imageWidth, const int imageHeight, const int nMipLevels) const;
 
-	@param blocks DXT1 blocks to be saved
+	/**
+	Save DXT1 compressed blocks to a dds file (used when the output file can't be memory mapped)
+
+	@param blocks DXT1 blocks to be saved (all mip levels)
 	@param nBlocks number of blocks
 	@param imgWidth image width
 	@param imgHeight image height
+	@param nMipLevels number of mip levels including the full size image
+	@param outputPath DDS file path
+	@return true if the file was written
 	*/
-	void saveDDS(const Dxt1Block* blocks, const int nBlocks, const int imageWidth, const int imageHeight);
+	bool saveDDS(const Dxt1Block* blocks, const int nBlocks, const int imageWidth, const int imageHeight, const int nMipLevels,
+		const string& outputPath);
 
 	/**
-	Save pixel colors to a bmp file
+	Fill a top-down 24bit bmp file header (scanlines padded to 4 bytes)
 
-	@param pixelColors pixels colors to save
+	@param bmpHeader target header (including the info header)
 	@param imgWidth image width
 	@param imgHeight image height
 	*/
-	void saveBMP(const RGBTriplet* pixelColors, const int imageWidth, const int imageHeight);
+	void fillBMPHeader(BMP_HEADER& bmpHeader, const int imageWidth, const int imageHeight) const;
 
 	/**
-	Check that a BMP file is valid. A BMP file is valid if it is uncompressed 24bit, dimensions devisible by 4
+	Save pixel colors to a bmp file (used when the output file can't be memory mapped)
+
+	@param pixelColors pixels colors to save, scanlines padded to 4 bytes
+	@param imgWidth image width
+	@param imgHeight image height
+	@param outputPath BMP file path
+	@return true if the file was written
+	*/
+	bool saveBMP(const RGBTriplet* pixelColors, const int imageWidth, const int imageHeight, const string& outputPath);
+
+	/**
+	Check that a BMP file is valid. A BMP file is valid if it is uncompressed 24bit or 32bit, dimensions devisible by 4
 
 	@param header the BMP file header (incliding the info header)
 	*/
 	bool isValidBMPFile(BMP_HEADER& header) const;
 
+	/**
+	Pixel format of a valid BMP file: PIXEL_BGR24 or PIXEL_BGRA32
+	*/
+	static PixelFormat bmpPixelFormat(const BMP_HEADER& header);
+
+	/**
+	Bytes of a scanline of a valid BMP file, padding to 4 bytes included
+	*/
+	static long long bmpRowBytes(const BMP_HEADER& header);
+
 	/**
 	Check that a DDS file is valid. A DDS file is valid if it is compressed using DXT1 format
 	and dimensions devisible by 4
@@ -100,19 +428,214 @@ public:
 	Compressor();
 	~Compressor();
 
+	Compressor(const Compressor&) = delete;
+	Compressor& operator=(const Compressor&) = delete;
+
+	/**
+	Set the number of threads used to compress an image
+
+	@param nThreads number of threads, 0 uses one thread per hardware thread
+	*/
+	void setThreadCount(const int nThreads);
+
+	/**
+	Select the block encoder
+
+	@param tier encoder tier, TIER_INTENSITY by default
+	*/
+	void setEncoderTier(const EncoderTier tier) { encoderTier = tier; }
+
+	/**
+	Restrict the SIMD kernels of the encoder and decoder (e.g. for benchmarking). Levels not supported by the CPU
+	fall back to the best supported one.
+
+	@param level highest instruction set level to use
+	*/
+	void setSimdLevel(const SimdLevel level);
+
+	/**
+	Save the mip levels of the compressed images (not supported by the streaming encoder)
+
+	@param enabled true to save the full mip chain, false (default) for the full size image only
+	*/
+	void setMipmaps(const bool enabled) { mipmaps = enabled; }
+
+	/**
+	Skip compressing blocks identical to a block already compressed by the same thread in the same image,
+	worth it for images with many repeated blocks (atlases, tiles), mostly with the range fit tier
+
+	@param nEntries blocks kept per thread, 0 (default) to disable the cache
+	*/
+	void setBlockCache(const int nEntries) { blockCacheEntries = nEntries; }
+
+	/**
+	Trade quality for the size of the DDS files once LZ compressed (packaging): the blocks reuse the end points,
+	indices or whole blocks of the blocks just before them when the error added is under lambda per bit saved.
+	Not applied by the incremental encoder.
+
+	@param lambda squared error (sum over the 16 pixels 3 channels of a block) traded for one bit of the
+	LZ compressed file, 0 (default) to disable
+	*/
+	void setRdo(const int lambda) { rdoLambda = lambda; }
+
+	/**
+	Rate-distortion optimization results (blocks changed, error and estimated LZ size before and after)
+	since the compressor was created
+	*/
+	RdoStats getRdoStats();
+
+	/**
+	Record the time spent in each stage of the conversions (header parse, read, gather, encode, write, decode),
+	the blocks, bytes and busy time of the threads, until writeProfile is called. Enable before converting.
+
+	@param enabled true to profile, false (default) to stop and discard the profile
+	*/
+	void setProfiling(const bool enabled);
+
+	/**
+	Cache the compressed DDS files by the content of their BMP file (and the encoder settings), compress()
+	then copies the DDS file of a BMP file already compressed instead of compressing it again (see ConversionCache).
+	Compressions computing the error metrics are not cached.
+
+	@param dir cache directory, empty (default) to disable the cache
+	@param maxBytes size limit of the directory, the least recently used DDS files are deleted over it
+	@param link true to hard-link the DDS files found in the cache instead of copying them (other tools must then
+	not modify them in place, the incremental updates copy them first)
+	*/
+	void setConversionCache(const string& dir, const long long maxBytes, const bool link);
+
+	/**
+	Write the profile of the conversions since profiling was enabled as JSON (see Profiler)
+
+	@param path JSON file path, "-" for stdout
+	@return false if profiling is disabled or the file can't be written
+	*/
+	bool writeProfile(const string& path);
+
+	/**
+	Blocks taken from the block cache since the compressor was created
+	*/
+	long long getBlockCacheHits() const { return cacheHits; }
+
+	/**
+	Blocks compressed with the block cache enabled since the compressor was created
+	*/
+	long long getBlockCacheMisses() const { return cacheMisses; }
+
+	/**
+	Blocks decompressed with a memoized palette since the compressor was created
+	*/
+	long long getPaletteCacheHits() const { return paletteHits; }
+
+	/**
+	Blocks whose palette had to be expanded since the compressor was created
+	*/
+	long long getPaletteCacheMisses() const { return paletteMisses; }
+
+	/**
+	Compressions whose DDS file was taken from the conversion cache, and compressions looked up and not found,
+	since the cache was enabled
+	*/
+	long long getConversionCacheHits() const { return conversionCache ? conversionCache->getHits() : 0; }
+	long long getConversionCacheMisses() const { return conversionCache ? conversionCache->getMisses() : 0; }
+
+	/**
+	Number of mip levels of a full chain, down to 1x1
+
+	@param imgWidth image width
+	@param imgHeight image height
+	*/
+	static int mipLevelCount(const int imgWidth, const int imgHeight);
+
+	/**
+	Number of DXT1 blocks of the first levels of a mip chain (partial blocks count as whole blocks)
+
+	@param imgWidth image width
+	@param imgHeight image height
+	@param nLevels number of levels, including the full size image
+	*/
+	static size_t mipChainBlocks(const int imgWidth, const int imgHeight, const int nLevels);
+
+	/**
+	Enable the bounded-memory streaming encoder for all images. Images too large for the in-memory path
+	(over 2GB of pixels, or that can't be mapped) are always streamed. With a conversion cache the images are
+	mapped anyway, the cache is looked up before compressing.
+
+	@param streaming true to stream, false (default) to map the whole BMP file
+	*/
+	void setStreamingMode(const bool streaming) { streamingMode = streaming; }
+
+	/**
+	Enable or disable the progress and success messages
+
+	@param enabled true (default) to print them
+	*/
+	void setVerbose(const bool enabled) { verbose = enabled; }
+
+	/**
+	Run fn(task) for every task in [0, nTasks) on the compressor threads. Conversions started from the tasks
+	share the same threads: a thread done with its own files helps with the block rows of the others.
+
+	@param nTasks number of tasks
+	@param fn task function
+	*/
+	void runParallel(const int nTasks, const function<void(int)>& fn);
+
 	/**
 	Load a BMP file and compress it using DDX1 and save the file as .dds
-	BMP image must be uncompressed 24bit, dimensions devisible by 4
+	BMP image must be uncompressed 24bit or 32bit, dimensions devisible by 4
+	Both files are memory mapped: pixels are read from the BMP mapping and blocks written into the DDS mapping,
+	reading and writing the pages of the files overlap the compression (see compressBMPPipelined)
+	With a conversion cache (see setConversionCache), a BMP file already compressed with the same settings
+	is not compressed again.
+
+	compress() and decompress() may be called from several threads at once for different output files.
 
 	@param filePath BMP file path
+	@param outputPath DDS file path
+	@param metrics if not null, receives the compression error (RMSE, PSNR, worst block, per block error map)
+	computed while compressing
+	@return true if the DDS file was saved
 	*/
-	void compress(const string& filePath);
+	bool compress(const string& filePath, const string& outputPath = DDS_FILE_NAME, ErrorMetrics* metrics = 0);
 
 	/**
 	Load a DDS file and decompress it to BMP and save the file as .bmp
 	DDS file must be compressed using DXT1 and dimentions divisible by 4
+	The block rows are streamed through a Pipeline: a chunk of blocks is read while the one before it is decompressed
+	(a block row per thread) and the padded scanlines of the one before that appended to the BMP file, so memory
+	stays at a few chunks of scanlines (O(width x threads)) whatever the image height
+
+	@param filePath DDS file path
+	@param outputPath BMP file path
+	@param mipLevel mip level to extract, 0 (default) for the full size image
+	@return true if the BMP file was saved
+	*/
+	bool decompress(const string&  filePath, const string& outputPath = BMP_FILE_NAME, const int mipLevel = 0);
+
+	/**
+	Decompress a rectangle of a DDS file. Only the blocks covering the rectangle are read from the file
+	(one read per block row, their offsets computed from the header) and decompressed, so the time depends
+	on the size of the rectangle, not the size of the file.
+
+	@param filePath DDS file path
+	@param region pixel rectangle, inside the mip level
+	@param pixels target first pixel of the rectangle top scanline
+	@param stride bytes from a scanline of the target to the one below it
+	@param mipLevel mip level to read from, 0 (default) for the full size image
+	@return false if the file is invalid or the rectangle is not inside the image (reported)
+	*/
+	bool decompressRegion(const string& filePath, const ImageRegion& region, RGBTriplet* pixels, const ptrdiff_t stride,
+		const int mipLevel = 0);
+
+	/**
+	Decompress a rectangle of a DDS file (see above) and save it as a BMP file
 
 	@param filePath DDS file path
+	@param region pixel rectangle, inside the mip level
+	@param outputPath BMP file path
+	@param mipLevel mip level to read from, 0 (default) for the full size image
+	@return true if the BMP file was saved
 	*/
-	void decompress(const string&  filePath);
+	bool decompressRegion(const string& filePath, const ImageRegion& region, const string& outputPath, const int mipLevel = 0);
 };
\ No newline at end of file
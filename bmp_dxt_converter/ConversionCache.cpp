@@ -0,0 +1,324 @@
+/**
+ConversionCache.cpp
+Purpose: Content-addressed cache of the converted DDS files
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string.h>
+#include <vector>
+#include "ConversionCache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+// multipliers of the hash rounds (64bit primes with well spread bits)
+static const unsigned long long PRIME1 = 0x9E3779B185EBCA87ull;
+static const unsigned long long PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const unsigned long long PRIME3 = 0x165667B19E3779F9ull;
+static const unsigned long long PRIME4 = 0x85EBCA77C2B2AE63ull;
+
+static inline unsigned long long rotateLeft(const unsigned long long value, const int bits)
+{
+	return value << bits | value >> (64 - bits);
+}
+
+// one round of a lane: the next 8 bytes multiplied into the lane
+static inline unsigned long long hashRound(const unsigned long long lane, const unsigned long long word)
+{
+	return rotateLeft(lane + word * PRIME2, 31) * PRIME1;
+}
+
+// spread every bit of the hash over all its bits
+static inline unsigned long long avalanche(unsigned long long hash)
+{
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+ContentHash::ContentHash() : tailSize(0), length(0)
+{
+	lanes[0] = PRIME1 + PRIME2;
+	lanes[1] = PRIME2;
+	lanes[2] = 0;
+	lanes[3] = 0 - PRIME1;
+}
+
+void ContentHash::hashStripe(const byte* stripe)
+{
+	unsigned long long words[4];
+	memcpy(words, stripe, sizeof(words));
+	for (int i = 0; i < 4; ++i)
+		lanes[i] = hashRound(lanes[i], words[i]);
+}
+
+void ContentHash::update(const byte* data, const size_t size)
+{
+	length += size;
+
+	// complete the stripe left by the previous bytes
+	size_t offset = 0;
+	if (tailSize > 0)
+	{
+		offset = min(size, (size_t)(32 - tailSize));
+		memcpy(tail + tailSize, data, offset);
+		tailSize += (int)offset;
+		if (tailSize < 32)
+			return;
+
+		hashStripe(tail);
+		tailSize = 0;
+	}
+
+	for (; offset + 32 <= size; offset += 32)
+		hashStripe(data + offset);
+
+	tailSize = (int)(size - offset);
+	memcpy(tail, data + offset, tailSize);
+}
+
+ConversionKey ContentHash::digest() const
+{
+	// the bytes of the last partial stripe, then the length
+	unsigned long long tailHash = length * PRIME4;
+	int offset = 0;
+	for (; offset + 8 <= tailSize; offset += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, tail + offset, 8);
+		tailHash = rotateLeft(tailHash ^ hashRound(0, word), 27) * PRIME1 + PRIME4;
+	}
+	for (; offset < tailSize; ++offset)
+		tailHash = rotateLeft(tailHash ^ tail[offset] * PRIME3, 11) * PRIME1;
+
+	// two different combinations of the lanes
+	ConversionKey key;
+	key.low = avalanche(rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18) + tailHash);
+	key.high = avalanche((lanes[0] ^ rotateLeft(lanes[1], 29)) * PRIME3 + (lanes[2] ^ rotateLeft(lanes[3], 23)) * PRIME4 +
+		rotateLeft(tailHash, 32) + length);
+	return key;
+}
+
+// a file of the cache directory
+struct CacheFile
+{
+	string path;
+	long long size;
+	long long modified; // modification time, in seconds
+};
+
+// names of the entries: 32 lowercase hex digits (the key) then .dds, the temporary files and any other file of the
+// directory are not entries
+static bool isEntryName(const char* name)
+{
+	for (int i = 0; i < 32; ++i)
+	{
+		if (!(name[i] >= '0' && name[i] <= '9') && !(name[i] >= 'a' && name[i] <= 'f'))
+			return false;
+	}
+	return strcmp(name + 32, ".dds") == 0;
+}
+
+// entries (regular files named as entries) of a directory
+static void listEntries(const string& dir, vector<CacheFile>& files)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA findData;
+	HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &findData);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || !isEntryName(findData.cFileName))
+			continue;
+
+		CacheFile file;
+		file.path = dir + "\\" + findData.cFileName;
+		file.size = (long long)findData.nFileSizeHigh << 32 | findData.nFileSizeLow;
+		file.modified = ((long long)findData.ftLastWriteTime.dwHighDateTime << 32 | findData.ftLastWriteTime.dwLowDateTime) / 10000000;
+		files.push_back(file);
+	} while (FindNextFileA(find, &findData));
+
+	FindClose(find);
+#else
+	DIR* directory = opendir(dir.c_str());
+	if (!directory)
+		return;
+
+	while (dirent* entry = readdir(directory))
+	{
+		if (!isEntryName(entry->d_name))
+			continue;
+
+		CacheFile file;
+		file.path = dir + "/" + entry->d_name;
+
+		struct stat fileStat;
+		if (stat(file.path.c_str(), &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+			continue;
+
+		file.size = (long long)fileStat.st_size;
+		file.modified = (long long)fileStat.st_mtime;
+		files.push_back(file);
+	}
+
+	closedir(directory);
+#endif
+}
+
+static long long fileBytes(const string& path)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	return file.good() ? (long long)file.tellg() : 0;
+}
+
+static bool copyFile(const string& sourcePath, const string& targetPath)
+{
+	ifstream source(sourcePath, ios::binary);
+	if (!source.good())
+		return false;
+
+	ofstream target(targetPath, ofstream::out | ofstream::binary);
+	target << source.rdbuf();
+	target.close();
+
+	if (!target)
+	{
+		remove(targetPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+ConversionCache::ConversionCache(const string& dir, const long long maxBytes, const bool link) : dir(dir), maxBytes(maxBytes), link(link),
+	cachedBytes(-1), hits(0), misses(0), nTemporary(0)
+{
+#ifdef _WIN32
+	CreateDirectoryA(dir.c_str(), 0);
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+}
+
+string ConversionCache::entryPath(const ConversionKey& key) const
+{
+	char name[40];
+	snprintf(name, sizeof(name), "%016llx%016llx.dds", key.high, key.low);
+	return dir + "/" + name;
+}
+
+bool ConversionCache::linkOrCopy(const string& sourcePath, const string& targetPath) const
+{
+#ifdef _WIN32
+	if (link && CreateHardLinkA(targetPath.c_str(), sourcePath.c_str(), 0))
+		return true;
+#else
+	if (link && ::link(sourcePath.c_str(), targetPath.c_str()) == 0)
+		return true;
+#endif
+
+	return copyFile(sourcePath, targetPath);
+}
+
+bool ConversionCache::fetch(const ConversionKey& key, const string& outputPath)
+{
+	remove(outputPath.c_str());
+
+	string path = entryPath(key);
+	if (!linkOrCopy(path, outputPath))
+	{
+		++misses;
+		return false;
+	}
+
+	// most recently used entry
+#ifdef _WIN32
+	_utime(path.c_str(), 0);
+#else
+	utime(path.c_str(), 0);
+#endif
+
+	++hits;
+	return true;
+}
+
+void ConversionCache::store(const ConversionKey& key, const string& outputPath)
+{
+	// a copy (never a link, the output may be patched in place later), written under a name of its own then
+	// renamed: the other threads and processes only see whole entries
+	string path = entryPath(key);
+#ifdef _WIN32
+	string temporaryPath = path + "." + to_string(GetCurrentProcessId()) + "-" + to_string(nTemporary++) + ".tmp";
+	if (!copyFile(outputPath, temporaryPath))
+		return;
+
+	bool renamed = MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	string temporaryPath = path + "." + to_string(getpid()) + "-" + to_string(nTemporary++) + ".tmp";
+	if (!copyFile(outputPath, temporaryPath))
+		return;
+
+	bool renamed = rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+
+	if (!renamed)
+	{
+		remove(temporaryPath.c_str());
+		return;
+	}
+
+	// the first store scans the directory (with the entries of the other processes), the next ones only
+	// scan it again once it is over the size limit
+	lock_guard<mutex> lock(sizeMutex);
+	if (cachedBytes < 0)
+		cachedBytes = evict();
+	else
+	{
+		cachedBytes += fileBytes(path);
+		if (cachedBytes > maxBytes)
+			cachedBytes = evict();
+	}
+}
+
+long long ConversionCache::evict()
+{
+	vector<CacheFile> files;
+	listEntries(dir, files);
+
+	long long totalBytes = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+		totalBytes += files[i].size;
+
+	if (totalBytes <= maxBytes)
+		return totalBytes;
+
+	// least recently used first
+	sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.modified < b.modified; });
+
+	long long targetBytes = maxBytes / 100 * CONVERSION_CACHE_EVICT_PERCENT;
+	for (size_t i = 0; i < files.size() && totalBytes > targetBytes; ++i)
+	{
+		if (remove(files[i].path.c_str()) == 0)
+			totalBytes -= files[i].size;
+	}
+
+	return totalBytes;
+}
@@ -0,0 +1,160 @@
+/**
+ConversionCache.h
+Purpose: Content-addressed cache of the converted DDS files, so inputs converted before (on other branches, by
+other CI runs) are not compressed again. An entry is keyed by a 128bit hash of the BMP header and scanlines (top to
+bottom, the same whether the file is mapped or streamed) followed by the encoder settings changing the DDS bytes and
+CONVERSION_CACHE_VERSION, and saved as <key>.dds in the cache directory. A hit copies (or hard-links) the entry to
+the output without decoding the BMP. Entries are evicted least recently used first (by modification time, refreshed
+by every hit) once the entries of the directory are over its size limit, other files are never counted nor deleted.
+Several processes may share a cache directory: entries are written to a temporary file then renamed.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "bmp_dxt1_headers.h"
+
+using namespace std;
+
+// bumped when the encoders change the DDS bytes of an input, entries of older versions are never hit
+#define CONVERSION_CACHE_VERSION		1
+
+// default size limit of the cache directory
+#define CONVERSION_CACHE_DEFAULT_MB		1024
+
+// once over its size limit, the cache is evicted down to this percentage of the limit, so every entry stored
+// doesn't scan the directory again
+#define CONVERSION_CACHE_EVICT_PERCENT	90
+
+// cache key of a conversion
+struct ConversionKey
+{
+	unsigned long long high;
+	unsigned long long low;
+};
+
+/**
+Fast 128bit hash of a byte stream fed piece by piece (4 lanes of 64bit multiply-rotate rounds, 32 bytes at a time),
+not cryptographic: the cache inputs are trusted
+*/
+class ContentHash
+{
+private:
+	unsigned long long lanes[4];
+
+	// bytes not hashed yet (less than a 32 byte stripe)
+	byte tail[32];
+	int tailSize;
+
+	// bytes fed so far
+	unsigned long long length;
+
+	/**
+	Hash a 32 byte stripe into the lanes
+	*/
+	void hashStripe(const byte* stripe);
+
+public:
+	ContentHash();
+
+	/**
+	Hash the next bytes of the stream
+
+	@param data next bytes
+	@param size number of bytes
+	*/
+	void update(const byte* data, const size_t size);
+
+	/**
+	Hash of the bytes fed so far (more bytes can still be fed)
+	*/
+	ConversionKey digest() const;
+};
+
+class ConversionCache
+{
+private:
+	// cache directory, its files not named as entries (<32 hex digits>.dds) are left alone
+	string dir;
+
+	// size limit of the entries of the directory
+	long long maxBytes;
+
+	// hard-link the outputs of the hits to their entries instead of copying them (the entries stored are always copies)
+	bool link;
+
+	// size of the entries of the directory: scanned at the first store, then the entries stored by this process are added
+	// (-1 before the scan), guarded by sizeMutex
+	long long cachedBytes;
+	mutex sizeMutex;
+
+	// lookups hit and missed
+	atomic<long long> hits;
+	atomic<long long> misses;
+
+	// temporary files of the entries being stored, numbered
+	atomic<long long> nTemporary;
+
+	/**
+	Path of the entry of a key: dir/<32 hex digits>.dds
+	*/
+	string entryPath(const ConversionKey& key) const;
+
+	/**
+	Hard-link (if link is set) or copy a file, the target must not exist
+
+	@return false if the file can't be linked nor copied
+	*/
+	bool linkOrCopy(const string& sourcePath, const string& targetPath) const;
+
+	/**
+	Delete the least recently used entries of the directory until they are under CONVERSION_CACHE_EVICT_PERCENT
+	of the size limit (only if they are over the limit)
+
+	@return size of the entries left
+	*/
+	long long evict();
+
+public:
+	/**
+	@param dir cache directory, created if it doesn't exist
+	@param maxBytes size limit of the entries of the directory
+	@param link true to hard-link the outputs of the hits to their entries (faster, no extra disk space, but the
+	DDS files must not be modified in place by other tools, MappedFile::openWrite copies them first), false to
+	copy them. Falls back to a copy if the output is on another file system.
+	*/
+	ConversionCache(const string& dir, const long long maxBytes, const bool link);
+
+	ConversionCache(const ConversionCache&) = delete;
+	ConversionCache& operator=(const ConversionCache&) = delete;
+
+	/**
+	Save the entry of a key to the output path. The output file is removed first, hit or miss: it may be a link
+	to an entry, so it is replaced and never written through.
+
+	@param key key of the conversion
+	@param outputPath DDS file path
+	@return false if there's no entry, the output is then to be converted
+	*/
+	bool fetch(const ConversionKey& key, const string& outputPath);
+
+	/**
+	Add a converted file as the entry of a key, evicting older entries if the directory goes over its size limit.
+	Failures are silent, the conversion is only not cached.
+
+	@param key key of the conversion
+	@param outputPath the converted DDS file
+	*/
+	void store(const ConversionKey& key, const string& outputPath);
+
+	/**
+	Lookups that found their entry, and that didn't, since the cache was created
+	*/
+	long long getHits() const { return hits; }
+	long long getMisses() const { return misses; }
+};
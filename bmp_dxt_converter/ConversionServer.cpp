@@ -0,0 +1,711 @@
+/**
+ConversionServer.cpp
+Purpose: Resident conversion server reading framed jobs from a Unix socket or stdin
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "ConversionServer.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// read and write a file descriptor (socket or stdin/stdout), retried when interrupted by a signal
+static long long readFd(const int fd, byte* target, const size_t size)
+{
+#ifdef _WIN32
+	return _read(fd, target, (unsigned int)min(size, (size_t)INT_MAX));
+#else
+	ssize_t n;
+	do
+	{
+		n = read(fd, target, size);
+	} while (n < 0 && errno == EINTR);
+	return n;
+#endif
+}
+
+static long long writeFd(const int fd, const byte* source, const size_t size)
+{
+#ifdef _WIN32
+	return _write(fd, source, (unsigned int)min(size, (size_t)INT_MAX));
+#else
+	ssize_t n;
+	do
+	{
+		n = write(fd, source, size);
+	} while (n < 0 && errno == EINTR);
+	return n;
+#endif
+}
+
+// value of a request option, defaultValue if the request doesn't have it
+static string optionOf(const map<string, string>& options, const string& key, const string& defaultValue = "")
+{
+	map<string, string>::const_iterator it = options.find(key);
+	return it != options.end() ? it->second : defaultValue;
+}
+
+#ifndef _WIN32
+// a socket file no server listens on any more (the connection is refused), left by a server that didn't stop cleanly
+static bool isStaleSocket(const sockaddr_un& address)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+
+	bool stale = connect(fd, (const sockaddr*)&address, sizeof(address)) != 0 && errno == ECONNREFUSED;
+	close(fd);
+	return stale;
+}
+#endif
+
+ConversionServer::ConversionServer(Compressor& compressor) : compressor(compressor), listenFd(-1), stopping(false), nRunning(0),
+	nJobs(0), nFailed(0), bytesIn(0), bytesOut(0)
+{
+}
+
+ConversionServer::~ConversionServer()
+{
+	for (size_t i = 0; i < idleSessions.size(); ++i)
+		delete idleSessions[i];
+}
+
+ConversionServer::Session* ConversionServer::acquireSession()
+{
+	lock_guard<mutex> lock(sessionsMutex);
+	if (idleSessions.empty())
+		return new Session;
+
+	Session* session = idleSessions.back();
+	idleSessions.pop_back();
+	return session;
+}
+
+void ConversionServer::releaseSession(Session* session)
+{
+	lock_guard<mutex> lock(sessionsMutex);
+	idleSessions.push_back(session);
+}
+
+bool ConversionServer::run(const string& path)
+{
+#ifndef _WIN32
+	// a client closing its connection early must not kill the server when the response is written
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	if (path != SERVER_STDIO_PATH)
+		return serveSocket(path);
+
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	// stdout carries the responses: the compressor messages go to stderr
+	cout.flush();
+	streambuf* coutBuffer = cout.rdbuf(cerr.rdbuf());
+
+	Connection* connection = new Connection;
+	connection->inFd = 0;
+	connection->outFd = 1;
+	connection->start = connection->end = 0;
+	serveConnection(*connection);
+	delete connection;
+
+	cout << "- served " << nJobs << " job(s), " << nFailed << " failed." << endl;
+	cout.rdbuf(coutBuffer);
+	return true;
+}
+
+bool ConversionServer::serveSocket(const string& path)
+{
+#ifdef _WIN32
+	cout << "* Unix sockets are not supported on this platform, use --serve " << SERVER_STDIO_PATH << " (stdin)." << endl;
+	return false;
+#else
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path))
+	{
+		cout << "* invalid socket path " << path << endl;
+		return false;
+	}
+	memcpy(address.sun_path, path.c_str(), path.size());
+
+	// only a stale socket file is replaced, never another file nor the socket of a running server
+	struct stat pathStat;
+	if (lstat(path.c_str(), &pathStat) == 0)
+	{
+		if (!S_ISSOCK(pathStat.st_mode) || !isStaleSocket(address))
+		{
+			cout << "* " << path << " exists and is not a stale socket, is another server running?" << endl;
+			return false;
+		}
+		unlink(path.c_str());
+	}
+
+	// the socket file is created for the owner only: the jobs read and write the files of the server user
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	mode_t mask = umask(0077);
+	bool bound = listenFd >= 0 && bind(listenFd, (sockaddr*)&address, sizeof(address)) == 0;
+	umask(mask);
+	if (!bound || listen(listenFd, SOMAXCONN) != 0)
+	{
+		cout << "* can't listen on " << path << endl;
+		if (listenFd >= 0)
+			close(listenFd);
+		listenFd = -1;
+		return false;
+	}
+
+	socketPath = path;
+	cout << "- serving on " << path << endl;
+
+	while (true)
+	{
+		int fd = accept(listenFd, 0, 0);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			cout << "* can't accept connections on " << path << endl;
+			stop();
+			break;
+		}
+
+		// registered under the lock stop() wakes the connections with, so none is missed
+		{
+			lock_guard<mutex> lock(connectionsMutex);
+			if (stopping)
+			{
+				close(fd);
+				break;
+			}
+			openFds.push_back(fd);
+			++nRunning;
+		}
+
+		thread([this, fd]
+		{
+			Connection* connection = new Connection;
+			connection->inFd = connection->outFd = fd;
+			connection->start = connection->end = 0;
+			bool keepServing = serveConnection(*connection);
+			delete connection;
+
+			if (!keepServing)
+				stop();
+
+			lock_guard<mutex> lock(connectionsMutex);
+			openFds.erase(find(openFds.begin(), openFds.end(), fd));
+			close(fd);
+			--nRunning;
+			connectionClosed.notify_all();
+		}).detach();
+	}
+
+	// the connections finish the job they are running
+	{
+		unique_lock<mutex> lock(connectionsMutex);
+		connectionClosed.wait(lock, [this] { return nRunning == 0; });
+	}
+
+	close(listenFd);
+	listenFd = -1;
+	unlink(path.c_str());
+
+	cout << "- served " << nJobs << " job(s), " << nFailed << " failed." << endl;
+	return true;
+#endif
+}
+
+void ConversionServer::stop()
+{
+#ifndef _WIN32
+	{
+		lock_guard<mutex> lock(connectionsMutex);
+		if (stopping)
+			return;
+		stopping = true;
+
+		// connections waiting for a request see the end of their input
+		for (size_t i = 0; i < openFds.size(); ++i)
+			shutdown(openFds[i], SHUT_RD);
+	}
+
+	// wake up accept() with a connection of our own
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0)
+	{
+		connect(fd, (sockaddr*)&address, sizeof(address));
+		close(fd);
+	}
+#else
+	stopping = true;
+#endif
+}
+
+bool ConversionServer::serveConnection(Connection& connection)
+{
+	Session* session = acquireSession();
+	bool keepServing = true;
+	string line;
+
+	while (!stopping && readLine(connection, line))
+	{
+		if (line.empty())
+			continue;
+
+		Request request;
+		if (!parseRequest(line, request))
+		{
+			if (!sendResponse(connection, false, "malformed request"))
+				break;
+			continue;
+		}
+
+		// the input bytes follow the line, read them first to stay in step with the client whatever the request
+		string sizeText = optionOf(request.options, "size");
+		unsigned long long inputSize = 0;
+		if (!sizeText.empty() && (!parseNumber(sizeText, inputSize) || inputSize > SERVER_MAX_PAYLOAD))
+		{
+			sendResponse(connection, false, "invalid size " + sizeText);
+			break;
+		}
+
+		session->input.resize((size_t)inputSize);
+		if (!readBytes(connection, session->input.data(), (size_t)inputSize))
+			break;
+		bytesIn += inputSize;
+
+		if (request.operation == "quit")
+		{
+			sendResponse(connection, true, "bye");
+			break;
+		}
+
+		if (request.operation == "shutdown")
+		{
+			sendResponse(connection, true, "shutting down");
+			keepServing = false;
+			break;
+		}
+
+		if (request.operation == "stats")
+		{
+			ostringstream message;
+			message << "jobs=" << nJobs << " failed=" << nFailed << " in=" << bytesIn << " out=" << bytesOut <<
+				" threads=" << compressor.threadPool->size();
+			if (!sendResponse(connection, true, message.str()))
+				break;
+			continue;
+		}
+
+		string message;
+		session->output.clear();
+		bool ok = runJob(request, *session, message);
+		++nJobs;
+		if (!ok)
+			++nFailed;
+
+		if (!sendResponse(connection, ok, message, session->output.data(), ok ? session->output.size() : 0))
+			break;
+	}
+
+	releaseSession(session);
+	return keepServing;
+}
+
+bool ConversionServer::readLine(Connection& connection, string& line)
+{
+	while (true)
+	{
+		byte* first = connection.buffer + connection.start;
+		byte* newline = (byte*)memchr(first, '\n', connection.end - connection.start);
+		if (newline)
+		{
+			line.assign((const char*)first, newline - first);
+			if (!line.empty() && line[line.size() - 1] == '\r')
+				line.resize(line.size() - 1);
+			connection.start = (int)(newline + 1 - connection.buffer);
+			return true;
+		}
+
+		if (connection.end - connection.start >= SERVER_MAX_LINE)
+			return false;
+
+		// keep the partial line at the start of the buffer and read more
+		memmove(connection.buffer, first, connection.end - connection.start);
+		connection.end -= connection.start;
+		connection.start = 0;
+
+		long long n = readFd(connection.inFd, connection.buffer + connection.end, SERVER_READ_BUFFER - connection.end);
+		if (n <= 0)
+			return false;
+		connection.end += (int)n;
+	}
+}
+
+bool ConversionServer::readBytes(Connection& connection, byte* target, size_t size)
+{
+	size_t buffered = min(size, (size_t)(connection.end - connection.start));
+	memcpy(target, connection.buffer + connection.start, buffered);
+	connection.start += (int)buffered;
+	target += buffered;
+	size -= buffered;
+
+	// the rest straight into the target
+	while (size > 0)
+	{
+		long long n = readFd(connection.inFd, target, size);
+		if (n <= 0)
+			return false;
+		target += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+bool ConversionServer::writeBytes(Connection& connection, const byte* source, size_t size)
+{
+	while (size > 0)
+	{
+		long long n = writeFd(connection.outFd, source, size);
+		if (n <= 0)
+			return false;
+		source += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+bool ConversionServer::sendResponse(Connection& connection, const bool ok, const string& message, const byte* payload, const size_t size)
+{
+	ostringstream line;
+	line << (ok ? "ok" : "error") << '\t' << size << '\t' << message << '\n';
+	string text = line.str();
+
+	if (!writeBytes(connection, (const byte*)text.data(), text.size()) || !writeBytes(connection, payload, size))
+		return false;
+
+	bytesOut += size;
+	return true;
+}
+
+bool ConversionServer::parseRequest(const string& line, Request& request)
+{
+	size_t start = 0;
+	bool first = true;
+	while (start <= line.size())
+	{
+		size_t end = line.find('\t', start);
+		string field = line.substr(start, end == string::npos ? string::npos : end - start);
+		start = end == string::npos ? line.size() + 1 : end + 1;
+
+		if (first)
+		{
+			request.operation = field;
+			first = false;
+			if (field.empty())
+				return false;
+			continue;
+		}
+
+		size_t separator = field.find('=');
+		if (separator == string::npos || separator == 0)
+			return false;
+		request.options[field.substr(0, separator)] = field.substr(separator + 1);
+	}
+	return true;
+}
+
+bool ConversionServer::runJob(const Request& request, Session& session, string& message)
+{
+	const string& operation = request.operation;
+	if (operation != "compress" && operation != "decompress" && operation != "region")
+	{
+		message = "unknown operation " + operation;
+		return false;
+	}
+
+	string inputPath = optionOf(request.options, "in");
+	string outputPath = optionOf(request.options, "out", "-");
+	bool inputInRequest = inputPath == "-", outputInResponse = outputPath == "-";
+	if (inputPath.empty() || outputPath.empty())
+	{
+		message = "missing input or output";
+		return false;
+	}
+	if (inputInRequest && session.input.empty())
+	{
+		message = "in=- needs the input bytes (size=)";
+		return false;
+	}
+
+	unsigned long long mipLevel = 0;
+	string mipText = optionOf(request.options, "mip", "0");
+	if (!parseNumber(mipText, mipLevel) || mipLevel > 31)
+	{
+		message = "invalid mip level " + mipText;
+		return false;
+	}
+
+	ImageRegion region;
+	if (operation == "region" && !parseRegion(optionOf(request.options, "rect"), region))
+	{
+		message = "invalid rect (x,y,w,h) " + optionOf(request.options, "rect");
+		return false;
+	}
+
+	// file to file: the compressor maps both files and pipelines the reads and writes
+	if (!inputInRequest && !outputInResponse)
+	{
+		bool ok;
+		if (operation == "compress")
+			ok = compressor.compress(inputPath, outputPath);
+		else if (operation == "decompress")
+			ok = compressor.decompress(inputPath, outputPath, (int)mipLevel);
+		else
+			ok = compressor.decompressRegion(inputPath, region, outputPath, (int)mipLevel);
+
+		message = ok ? "saved " + outputPath : "can't convert " + inputPath;
+		return ok;
+	}
+
+	// a region of a file only needs its blocks, read by the compressor
+	if (!inputInRequest && operation == "region")
+	{
+		int rowBytes = (region.width * 3 + 3) & ~3;
+		if ((long long)rowBytes * region.height > INT_MAX)
+		{
+			message = "the region is too large";
+			return false;
+		}
+
+		session.output.assign(sizeof(BMP_HEADER) + (size_t)rowBytes * region.height, 0);
+		compressor.fillBMPHeader(*(BMP_HEADER*)session.output.data(), region.width, region.height);
+		if (!compressor.decompressRegion(inputPath, region, (RGBTriplet*)(session.output.data() + sizeof(BMP_HEADER)), rowBytes, (int)mipLevel))
+		{
+			session.output.clear();
+			message = "can't read the region of " + inputPath;
+			return false;
+		}
+	}
+	else
+	{
+		// the input held in memory: sent with the request, or the mapped file
+		MappedFile inputFile;
+		const byte* input = session.input.data();
+		size_t inputSize = session.input.size();
+		if (!inputInRequest)
+		{
+			if (!inputFile.openRead(inputPath))
+			{
+				message = "can't read " + inputPath;
+				return false;
+			}
+			input = inputFile.data();
+			inputSize = inputFile.size();
+		}
+
+		bool ok;
+		if (operation == "compress")
+			ok = compressBuffer(input, inputSize, session, message);
+		else if (operation == "decompress")
+			ok = decompressBuffer(input, inputSize, (int)mipLevel, session, message);
+		else
+			ok = decompressRegionBuffer(input, inputSize, region, (int)mipLevel, session, message);
+
+		if (!ok)
+		{
+			session.output.clear();
+			return false;
+		}
+	}
+
+	if (outputInResponse)
+	{
+		message = to_string(session.output.size()) + " bytes";
+		return true;
+	}
+
+	bool saved = saveFile(outputPath, session.output);
+	session.output.clear();
+	message = saved ? "saved " + outputPath : "can't write " + outputPath;
+	return saved;
+}
+
+bool ConversionServer::compressBuffer(const byte* bmp, const size_t bmpSize, Session& session, string& message)
+{
+	BMP_HEADER bmpHeader;
+	if (bmpSize < sizeof(BMP_HEADER))
+	{
+		message = "not a BMP file";
+		return false;
+	}
+	memcpy(&bmpHeader, bmp, sizeof(bmpHeader));
+
+	if (!compressor.isValidBMPFile(bmpHeader) || bmpHeader.imageWidth <= 0 || bmpHeader.imageHeight == 0)
+	{
+		message = "invalid BMP file";
+		return false;
+	}
+
+	// same limit as the in-memory path of Compressor::compress
+	int imgWidth = bmpHeader.imageWidth;
+	int imgHeight = abs(bmpHeader.imageHeight);
+	long long rowBytes = Compressor::bmpRowBytes(bmpHeader);
+	if (rowBytes * imgHeight > INT_MAX)
+	{
+		message = "BMP file too large to be sent, use file paths";
+		return false;
+	}
+
+	if (bmpHeader.dataOffset > bmpSize || bmpSize - bmpHeader.dataOffset < (size_t)(rowBytes * imgHeight))
+	{
+		message = "BMP file is truncated";
+		return false;
+	}
+
+	const byte* pixels = bmp + bmpHeader.dataOffset;
+	PixelFormat format = Compressor::bmpPixelFormat(bmpHeader);
+	ImageView image = bmpHeader.imageHeight > 0 ? ImageView::bottomUp(pixels, (ptrdiff_t)rowBytes, imgWidth, imgHeight, format) :
+		ImageView(pixels, (ptrdiff_t)rowBytes, imgWidth, imgHeight, format);
+
+	int nLevels = compressor.mipmaps ? Compressor::mipLevelCount(imgWidth, imgHeight) : 1;
+	size_t nBlocks = Compressor::mipChainBlocks(imgWidth, imgHeight, nLevels);
+	session.output.resize(sizeof(DDS_HEADER) + nBlocks * sizeof(Dxt1Block));
+	compressor.fillDDSHeader(*(DDS_HEADER*)session.output.data(), imgWidth, imgHeight, nLevels);
+
+	session.arena.reset();
+	compressor.compressMipChain(image, (Dxt1Block*)(session.output.data() + sizeof(DDS_HEADER)), nLevels, session.arena, 0);
+	return true;
+}
+
+bool ConversionServer::locateBlocks(const byte* dds, const size_t ddsSize, const int mipLevel, const Dxt1Block*& blocks, int& imgWidth,
+	int& imgHeight, string& message)
+{
+	DDS_HEADER ddsHeader;
+	if (ddsSize < sizeof(DDS_HEADER))
+	{
+		message = "not a DDS file";
+		return false;
+	}
+	memcpy(&ddsHeader, dds, sizeof(ddsHeader));
+
+	unsigned long long levelOffset;
+	if (!compressor.isValidDDSFile(ddsHeader) || ddsHeader.dwWidth == 0 || ddsHeader.dwHeight == 0 ||
+		!compressor.locateMipLevel(ddsHeader, ddsSize, mipLevel, imgWidth, imgHeight, levelOffset))
+	{
+		message = "invalid DDS file, or no mip level " + to_string(mipLevel);
+		return false;
+	}
+
+	blocks = (const Dxt1Block*)(dds + levelOffset);
+	return true;
+}
+
+bool ConversionServer::decompressBuffer(const byte* dds, const size_t ddsSize, const int mipLevel, Session& session, string& message)
+{
+	const Dxt1Block* blocks;
+	int imgWidth, imgHeight;
+	if (!locateBlocks(dds, ddsSize, mipLevel, blocks, imgWidth, imgHeight, message))
+		return false;
+
+	// scanlines padded to 4 bytes, the padding zeroed
+	int rowBytes = (imgWidth * 3 + 3) & ~3;
+	if ((long long)rowBytes * imgHeight > INT_MAX)
+	{
+		message = "image too large to be returned, use file paths";
+		return false;
+	}
+
+	session.output.assign(sizeof(BMP_HEADER) + (size_t)rowBytes * imgHeight, 0);
+	compressor.fillBMPHeader(*(BMP_HEADER*)session.output.data(), imgWidth, imgHeight);
+	compressor.decompressDDS(blocks, (RGBTriplet*)(session.output.data() + sizeof(BMP_HEADER)), rowBytes, imgWidth, imgHeight);
+	return true;
+}
+
+bool ConversionServer::decompressRegionBuffer(const byte* dds, const size_t ddsSize, const ImageRegion& region, const int mipLevel,
+	Session& session, string& message)
+{
+	const Dxt1Block* blocks;
+	int imgWidth, imgHeight;
+	if (!locateBlocks(dds, ddsSize, mipLevel, blocks, imgWidth, imgHeight, message))
+		return false;
+
+	if (region.x > imgWidth - region.width || region.y > imgHeight - region.height)
+	{
+		message = "the region is not inside the " + to_string(imgWidth) + "x" + to_string(imgHeight) + " image";
+		return false;
+	}
+
+	int rowBytes = (region.width * 3 + 3) & ~3;
+	if ((long long)rowBytes * region.height > INT_MAX)
+	{
+		message = "the region is too large";
+		return false;
+	}
+
+	session.output.assign(sizeof(BMP_HEADER) + (size_t)rowBytes * region.height, 0);
+	compressor.fillBMPHeader(*(BMP_HEADER*)session.output.data(), region.width, region.height);
+	byte* pixels = session.output.data() + sizeof(BMP_HEADER);
+
+	// the blocks covering the region, as Compressor::decompressRegion: each block row is expanded and its region part kept
+	int nBlocksPerRow = (imgWidth + 3) / 4;
+	int firstColumn = region.x / 4, endColumn = (region.x + region.width + 3) / 4;
+	int firstRow = region.y / 4, endRow = (region.y + region.height + 3) / 4;
+	int rowWidth = (endColumn - firstColumn) * 4;
+
+	session.arena.reset();
+	RGBTriplet* rowPixels = session.arena.allocateArray<RGBTriplet>((size_t)rowWidth * 4);
+	for (int row = firstRow; row < endRow; ++row)
+	{
+		compressor.decompressDDS(blocks + (size_t)row * nBlocksPerRow + firstColumn, rowPixels, rowWidth * 3, rowWidth, 4);
+
+		for (int h = 0; h < 4; ++h)
+		{
+			int y = row * 4 + h;
+			if (y < region.y || y >= region.y + region.height)
+				continue;
+
+			memcpy(pixels + (size_t)(y - region.y) * rowBytes, rowPixels + h * rowWidth + (region.x - firstColumn * 4), region.width * 3);
+		}
+	}
+	return true;
+}
+
+bool ConversionServer::saveFile(const string& path, const vector<byte>& data)
+{
+	ofstream file;
+	file.open(path, ofstream::out | ofstream::binary);
+	file.write((const char*)data.data(), (streamsize)data.size());
+	file.close();
+	return (bool)file;
+}
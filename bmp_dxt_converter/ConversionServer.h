@@ -0,0 +1,224 @@
+/**
+ConversionServer.h
+Purpose: Resident conversion server. Jobs (compress, decompress, region) come as framed requests over a local
+Unix socket or stdin, so the compressor threads, the encoder tables and the scratch memory stay warm from job
+to job instead of being set up by a new process for every file.
+
+A request is a line of tab separated fields, the operation then key=value options, followed by the input
+file bytes if the input is in the request:
+
+	compress	in=<path|->	out=<path|->	[size=<input bytes>]
+	decompress	in=<path|->	out=<path|->	[size=<input bytes>]	[mip=<level>]
+	region		in=<path|->	out=<path|->	[size=<input bytes>]	rect=<x,y,w,h>	[mip=<level>]
+	stats
+	quit		(closes the connection)
+	shutdown	(stops the server)
+
+in=- reads the input file (BMP or DDS) from the size bytes following the line, out=- (the default) returns
+the output file in the response instead of saving it. A response is a line then its payload:
+
+	ok	<payload bytes>	<message>
+	error	0	<message>
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Compressor.h"
+#include "ScratchArena.h"
+
+using namespace std;
+
+// stdin/stdout instead of a socket path
+#define SERVER_STDIO_PATH		"-"
+
+// longest request line, and largest input file sent in a request
+#define SERVER_MAX_LINE			4096
+#define SERVER_MAX_PAYLOAD		(1ull << 31)
+
+// bytes read from a connection at once
+#define SERVER_READ_BUFFER		(64 << 10)
+
+class ConversionServer
+{
+private:
+	// memory of a job, kept from job to job (and from connection to connection) so sizes already seen don't allocate
+	struct Session
+	{
+		ScratchArena arena;
+		vector<byte> input;		// input file sent in the request
+		vector<byte> output;	// output file returned in the response
+	};
+
+	// a client: requests are read from inFd and responses written to outFd (the same socket, or stdin/stdout)
+	struct Connection
+	{
+		int inFd;
+		int outFd;
+		byte buffer[SERVER_READ_BUFFER];	// bytes read and not consumed yet: [start, end)
+		int start;
+		int end;
+	};
+
+	// a parsed request line
+	struct Request
+	{
+		string operation;
+		map<string, string> options;
+	};
+
+	// settings, encoders and threads shared by all the jobs
+	Compressor& compressor;
+
+	// sessions not used by a connection
+	vector<Session*> idleSessions;
+	mutex sessionsMutex;
+
+	// socket server state: listening socket, open connections (woken up at shutdown), connection threads running
+	int listenFd;
+	string socketPath;
+	atomic<bool> stopping;
+	vector<int> openFds;
+	int nRunning;
+	mutex connectionsMutex;
+	condition_variable connectionClosed;
+
+	// jobs done and failed, bytes received and sent in the requests and responses
+	atomic<long long> nJobs;
+	atomic<long long> nFailed;
+	atomic<long long> bytesIn;
+	atomic<long long> bytesOut;
+
+	/**
+	Take an idle session (or create one), give it back once the connection is closed
+	*/
+	Session* acquireSession();
+	void releaseSession(Session* session);
+
+	/**
+	Serve the requests of a connection until it is closed, a quit request or a shutdown
+
+	@return false if the connection asked for a shutdown
+	*/
+	bool serveConnection(Connection& connection);
+
+	/**
+	Accept the socket connections until a shutdown, each one served by its own thread
+	*/
+	bool serveSocket(const string& path);
+
+	/**
+	Stop accepting connections and wake up the connections waiting for a request
+	*/
+	void stop();
+
+	/**
+	Read a request line, without its '\n'
+
+	@return false at the end of the connection or if the line is longer than SERVER_MAX_LINE
+	*/
+	bool readLine(Connection& connection, string& line);
+
+	/**
+	Read exactly size bytes
+
+	@return false if the connection ends first
+	*/
+	bool readBytes(Connection& connection, byte* target, size_t size);
+
+	/**
+	Write all the bytes
+
+	@return false if the connection is closed
+	*/
+	bool writeBytes(Connection& connection, const byte* source, size_t size);
+
+	/**
+	Send a response line and its payload
+
+	@param ok true for an ok response, false for an error (no payload)
+	@param message one line message
+	@param payload response payload, size bytes
+	@return false if the connection is closed
+	*/
+	bool sendResponse(Connection& connection, const bool ok, const string& message, const byte* payload = 0, const size_t size = 0);
+
+	/**
+	Split a request line into the operation and its options
+
+	@return false if a field is not key=value
+	*/
+	static bool parseRequest(const string& line, Request& request);
+
+	/**
+	Run a job, its input already in the session if it came with the request
+
+	@param request the request
+	@param session memory of the job, output receives the output file if it is returned
+	@param message receives the response message (what went wrong for a failed job)
+	@return true if the job succeeded
+	*/
+	bool runJob(const Request& request, Session& session, string& message);
+
+	/**
+	Compress a BMP file held in memory into a DDS file held in memory (with the compressor settings)
+
+	@return false (and message set) if the BMP file is invalid
+	*/
+	bool compressBuffer(const byte* bmp, const size_t bmpSize, Session& session, string& message);
+
+	/**
+	Decompress a mip level of a DDS file held in memory into a BMP file held in memory
+
+	@return false (and message set) if the DDS file is invalid or doesn't have the level
+	*/
+	bool decompressBuffer(const byte* dds, const size_t ddsSize, const int mipLevel, Session& session, string& message);
+
+	/**
+	Decompress a rectangle of a mip level of a DDS file held in memory into a BMP file held in memory
+
+	@return false (and message set) if the DDS file is invalid or the rectangle is not inside the level
+	*/
+	bool decompressRegionBuffer(const byte* dds, const size_t ddsSize, const ImageRegion& region, const int mipLevel, Session& session,
+		string& message);
+
+	/**
+	Find the header and the blocks of a mip level of a DDS file held in memory
+
+	@return false (and message set) if the DDS file is invalid or doesn't have the level
+	*/
+	bool locateBlocks(const byte* dds, const size_t ddsSize, const int mipLevel, const Dxt1Block*& blocks, int& imgWidth, int& imgHeight,
+		string& message);
+
+	/**
+	Save a file held in memory
+	*/
+	static bool saveFile(const string& path, const vector<byte>& data);
+
+public:
+	/**
+	@param compressor compressor providing the settings, encoders and threads of all the jobs, must outlive the server
+	*/
+	explicit ConversionServer(Compressor& compressor);
+	~ConversionServer();
+
+	ConversionServer(const ConversionServer&) = delete;
+	ConversionServer& operator=(const ConversionServer&) = delete;
+
+	/**
+	Serve requests until a shutdown request (or the end of stdin)
+
+	@param path Unix socket path, SERVER_STDIO_PATH to read the requests from stdin and write the responses to
+	stdout (the messages of the compressor then go to stderr)
+	@return false if the socket can't be created
+	*/
+	bool run(const string& path);
+};
@@ -0,0 +1,59 @@
+/**
+Downsampler.cpp
+Purpose: 2x2 box filter halving an image, kernel dispatch and scalar kernel
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include "Downsampler.h"
+
+#ifdef SIMD_X86
+// kernel defined in DownsamplerSse41.cpp
+void downsampleRowSse41(const RGBTriplet* row0, const RGBTriplet* row1, const int srcWidth, RGBTriplet* outRow);
+#endif
+
+/**
+Scalar kernel: rounded average of the 4 pixels, (a + b + c + d + 2) / 4
+*/
+static void downsampleRowScalar(const RGBTriplet* row0, const RGBTriplet* row1, const int srcWidth, RGBTriplet* outRow)
+{
+	int outWidth = Downsampler::halfSize(srcWidth);
+	int step = srcWidth > 1 ? 1 : 0; // a 1 pixel wide image averages its pixel with itself
+
+	for (int x = 0; x < outWidth; ++x)
+	{
+		const RGBTriplet& a = row0[x * 2];
+		const RGBTriplet& b = row0[x * 2 + step];
+		const RGBTriplet& c = row1[x * 2];
+		const RGBTriplet& d = row1[x * 2 + step];
+
+		outRow[x].r = (a.r + b.r + c.r + d.r + 2) >> 2;
+		outRow[x].g = (a.g + b.g + c.g + d.g + 2) >> 2;
+		outRow[x].b = (a.b + b.b + c.b + d.b + 2) >> 2;
+	}
+}
+
+Downsampler::Downsampler()
+{
+	setLevel(SimdEncoder::detectLevel());
+}
+
+void Downsampler::setLevel(const SimdLevel requestedLevel)
+{
+	SimdLevel supported = SimdEncoder::detectLevel();
+	level = requestedLevel < supported ? requestedLevel : supported;
+
+	// the filter is memory bound, wider kernels don't pay off
+#ifdef SIMD_X86
+	if (level >= SIMD_SSE41)
+	{
+		level = SIMD_SSE41;
+		kernel = downsampleRowSse41;
+		return;
+	}
+#endif
+
+	level = SIMD_SCALAR;
+	kernel = downsampleRowScalar;
+}
@@ -0,0 +1,57 @@
+/**
+Downsampler.h
+Purpose: 2x2 box filter halving an image, used to build the mip levels. A row kernel averages two scanlines
+into one half width scanline, the SSE4.1 kernel sums the pixel pairs of both scanlines with pmaddubsw
+and writes 4 pixels per iteration
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include "bmp_dxt1_headers.h"
+#include "SimdEncoder.h"
+
+// averages the 2x2 pixels of the scanlines row0 and row1 (srcWidth pixels each) into outWidth = max(1, srcWidth / 2) pixels
+typedef void (*DownsampleRowKernel)(const RGBTriplet* row0, const RGBTriplet* row1, const int srcWidth, RGBTriplet* outRow);
+
+class Downsampler
+{
+private:
+	SimdLevel level;
+	DownsampleRowKernel kernel;
+
+public:
+	/**
+	Select the best kernel supported by the running CPU
+	*/
+	Downsampler();
+
+	/**
+	Force a specific kernel. Levels not supported by the CPU fall back to the best supported one.
+
+	@param level requested instruction set level
+	*/
+	void setLevel(const SimdLevel level);
+
+	SimdLevel getLevel() const { return level; }
+
+	/**
+	Size of the next mip level: half the size, rounded down, at least 1
+	*/
+	static int halfSize(const int size) { return size > 1 ? size / 2 : 1; }
+
+	/**
+	Compute a row of the half size image. Odd sizes drop the last column/row, a size of 1 repeats its pixels.
+
+	@param srcScanline0 source scanline 2 * y (top to bottom order)
+	@param srcScanline1 source scanline 2 * y + 1, or srcScanline0 again for a 1 pixel high image
+	@param srcWidth source width
+	@param outRow target scanline y of the half size image
+	*/
+	void downsampleRow(const RGBTriplet* srcScanline0, const RGBTriplet* srcScanline1, const int srcWidth, RGBTriplet* outRow) const
+	{
+		kernel(srcScanline0, srcScanline1, srcWidth, outRow);
+	}
+};
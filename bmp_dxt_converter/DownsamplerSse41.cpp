@@ -0,0 +1,73 @@
+/**
+DownsamplerSse41.cpp
+Purpose: SSE4.1 2x2 box filter row kernel (compiled with SSE4.1 enabled)
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <string.h>
+#include "Downsampler.h"
+
+#ifdef SIMD_X86
+
+#include <smmintrin.h>
+
+void downsampleRowSse41(const RGBTriplet* row0, const RGBTriplet* row1, const int srcWidth, RGBTriplet* outRow)
+{
+	int outWidth = Downsampler::halfSize(srcWidth);
+	const byte* src0 = (const byte*)row0;
+	const byte* src1 = (const byte*)row1;
+	byte* out = (byte*)outRow;
+
+	// 8 source pixels (24 bytes) give 4 pixels: the bytes of each horizontal pair are put side by side
+	// (b0 b1 g0 g1 r0 r1 ...) and summed by pmaddubsw, pairs 0-3 come from bytes 0..11, pairs 4-7 from bytes 12..23
+	const __m128i pairsLow = _mm_setr_epi8(0, 3, 1, 4, 2, 5, 6, 9, 7, 10, 8, 11, -1, -1, -1, -1);
+	const __m128i pairsHigh = _mm_setr_epi8(4, 7, 5, 8, 6, 9, 10, 13, 11, 14, 12, 15, -1, -1, -1, -1); // loaded from byte 8
+	const __m128i compact = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+	const __m128i ones = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi16(2);
+
+	int x = 0;
+	if (srcWidth > 1) // a 1 pixel wide image has no pairs
+	{
+		for (; x + 4 <= outWidth; x += 4)
+		{
+			const byte* p0 = src0 + x * 6;
+			const byte* p1 = src1 + x * 6;
+
+			__m128i low = _mm_add_epi16(
+				_mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p0), pairsLow), ones),
+				_mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p1), pairsLow), ones));
+			__m128i high = _mm_add_epi16(
+				_mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p0 + 8)), pairsHigh), ones),
+				_mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p1 + 8)), pairsHigh), ones));
+
+			low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+			high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+			__m128i pixels = _mm_shuffle_epi8(_mm_packus_epi16(low, high), compact);
+
+			// 12 bytes, without writing past the 4 pixels
+			byte* target = out + x * 3;
+			_mm_storel_epi64((__m128i*)target, pixels);
+			int last = _mm_cvtsi128_si32(_mm_srli_si128(pixels, 8));
+			memcpy(target + 8, &last, 4);
+		}
+	}
+
+	// remaining pixels (and 1 pixel wide images)
+	int step = srcWidth > 1 ? 1 : 0;
+	for (; x < outWidth; ++x)
+	{
+		const RGBTriplet& a = row0[x * 2];
+		const RGBTriplet& b = row0[x * 2 + step];
+		const RGBTriplet& c = row1[x * 2];
+		const RGBTriplet& d = row1[x * 2 + step];
+
+		outRow[x].r = (a.r + b.r + c.r + d.r + 2) >> 2;
+		outRow[x].g = (a.g + b.g + c.g + d.g + 2) >> 2;
+		outRow[x].b = (a.b + b.b + c.b + d.b + 2) >> 2;
+	}
+}
+
+#endif
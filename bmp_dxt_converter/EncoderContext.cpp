@@ -0,0 +1,48 @@
+/**
+EncoderContext.cpp
+Purpose: Buffer to buffer DXT1 conversion without files
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <climits>
+#include "EncoderContext.h"
+
+bool EncoderContext::isValidSize(const int imgWidth, const int imgHeight) const
+{
+	if (imgWidth <= 0 || imgHeight <= 0 || imgWidth % 4 != 0 || imgHeight % 4 != 0)
+		return false;
+
+	// same limit as the in-memory path of Compressor::compress
+	return (long long)imgWidth * imgHeight * 3 <= INT_MAX;
+}
+
+bool EncoderContext::compress(const RGBTriplet* pixels, const ptrdiff_t stride, const int imgWidth, const int imgHeight, Dxt1Block* blocks,
+	ErrorMetrics* metrics)
+{
+	return compress(ImageView(pixels, stride, imgWidth, imgHeight), blocks, metrics);
+}
+
+bool EncoderContext::compress(const ImageView& image, Dxt1Block* blocks, ErrorMetrics* metrics)
+{
+	if (!isValidSize(image.width, image.height) || !image.firstScanline || !blocks)
+		return false;
+
+	arena.reset();
+	unsigned int* blockErrors = metrics ? metrics->begin(image.width, image.height) : 0;
+	compressor.compressBMP(image, blocks, arena, blockErrors, 0);
+
+	if (metrics)
+		metrics->finish();
+	return true;
+}
+
+bool EncoderContext::decompress(const Dxt1Block* blocks, const int imgWidth, const int imgHeight, RGBTriplet* pixels, const ptrdiff_t stride)
+{
+	if (!isValidSize(imgWidth, imgHeight) || !pixels || !blocks)
+		return false;
+
+	compressor.decompressDDS(blocks, pixels, stride, imgWidth, imgHeight);
+	return true;
+}
@@ -0,0 +1,83 @@
+/**
+EncoderContext.h
+Purpose: Buffer to buffer DXT1 conversion without files. A context is reused from image to image: its scratch
+arena keeps the memory of the previous images, so converting images of a size already seen doesn't allocate.
+Several contexts (one per thread) may share the same compressor, its encoders and threads.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include "Compressor.h"
+#include "ScratchArena.h"
+
+using namespace std;
+
+class EncoderContext
+{
+private:
+	// encoder settings (tier) and threads
+	Compressor& compressor;
+
+	// per image scratch buffers, reset at the start of every conversion
+	ScratchArena arena;
+
+	/**
+	Check the image dimensions: positive and divisible by 4, at most INT_MAX pixels bytes
+	*/
+	bool isValidSize(const int imgWidth, const int imgHeight) const;
+
+public:
+	/**
+	@param compressor compressor providing the encoder settings and the threads, must outlive the context
+	*/
+	explicit EncoderContext(Compressor& compressor) : compressor(compressor) {}
+
+	EncoderContext(const EncoderContext&) = delete;
+	EncoderContext& operator=(const EncoderContext&) = delete;
+
+	/**
+	Compress 24bit pixels into DXT1 blocks, using the compressor's encoder tier
+
+	@param pixels first pixel of the top scanline
+	@param stride bytes from a scanline to the one below it, at least imgWidth * 3 (negative for bottom-up images)
+	@param imgWidth image width, divisible by 4
+	@param imgHeight image height, divisible by 4
+	@param blocks target blocks, (imgWidth / 4) * (imgHeight / 4) blocks in row order
+	@param metrics if not null, receives the compression error computed while compressing
+	@return false if the dimensions are invalid (nothing is printed)
+	*/
+	bool compress(const RGBTriplet* pixels, const ptrdiff_t stride, const int imgWidth, const int imgHeight, Dxt1Block* blocks,
+		ErrorMetrics* metrics = 0);
+
+	/**
+	Compress an image of any pixel format (BGR24, BGRA32, RGB565, gray8) in place, e.g. an engine framebuffer,
+	using the compressor's encoder tier
+
+	@param image source image, dimensions divisible by 4, stride at least a scanline (negative for bottom-up images)
+	@param blocks target blocks, (width / 4) * (height / 4) blocks in row order
+	@param metrics if not null, receives the compression error computed while compressing
+	@return false if the dimensions are invalid (nothing is printed)
+	*/
+	bool compress(const ImageView& image, Dxt1Block* blocks, ErrorMetrics* metrics = 0);
+
+	/**
+	Decompress DXT1 blocks into 24bit pixels
+
+	@param blocks source blocks, (imgWidth / 4) * (imgHeight / 4) blocks in row order
+	@param imgWidth image width, divisible by 4
+	@param imgHeight image height, divisible by 4
+	@param pixels target first pixel of the top scanline
+	@param stride bytes from a scanline to the one below it, at least imgWidth * 3 (negative for bottom-up images)
+	@return false if the dimensions are invalid (nothing is printed)
+	*/
+	bool decompress(const Dxt1Block* blocks, const int imgWidth, const int imgHeight, RGBTriplet* pixels, const ptrdiff_t stride);
+
+	/**
+	Bytes of scratch memory kept by the context
+	*/
+	size_t scratchCapacity() const { return arena.capacity(); }
+};
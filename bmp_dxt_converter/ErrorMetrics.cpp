@@ -0,0 +1,74 @@
+/**
+ErrorMetrics.cpp
+Purpose: Compression error of an image, gathered block by block while the image is compressed
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <cmath>
+#include <limits>
+#include "ErrorMetrics.h"
+#include "SimdDecoder.h"
+
+ErrorMetrics::ErrorMetrics() : nBlocksPerRow(0), rmse(0), psnr(0), maxBlockError(0), maxErrorBlock(0)
+{
+}
+
+unsigned int ErrorMetrics::blockError(const RGBTriplet* blockColors, const Dxt1Block& block)
+{
+	// decoded palette, same integer math as the decoder kernels
+	int r[4], g[4], b[4];
+	r[0] = expand5To8[block.c0 >> 11];
+	g[0] = expand6To8[(block.c0 >> 5) & 0x3F];
+	b[0] = expand5To8[block.c0 & 0x1F];
+	r[1] = expand5To8[block.c1 >> 11];
+	g[1] = expand6To8[(block.c1 >> 5) & 0x3F];
+	b[1] = expand5To8[block.c1 & 0x1F];
+	r[2] = (2 * r[0] + r[1]) / 3;
+	g[2] = (2 * g[0] + g[1]) / 3;
+	b[2] = (2 * b[0] + b[1]) / 3;
+	r[3] = (r[0] + 2 * r[1]) / 3;
+	g[3] = (g[0] + 2 * g[1]) / 3;
+	b[3] = (b[0] + 2 * b[1]) / 3;
+
+	unsigned int error = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = (block.indices[i / 4] >> (i % 4) * 2) & 0x3;
+		int dr = blockColors[i].r - r[index], dg = blockColors[i].g - g[index], db = blockColors[i].b - b[index];
+		error += dr * dr + dg * dg + db * db;
+	}
+
+	return error;
+}
+
+unsigned int* ErrorMetrics::begin(const int imgWidth, const int imgHeight)
+{
+	nBlocksPerRow = imgWidth / 4;
+	blockErrors.assign((size_t)nBlocksPerRow * (imgHeight / 4), 0);
+	rmse = psnr = 0;
+	maxBlockError = 0;
+	maxErrorBlock = 0;
+
+	return blockErrors.empty() ? 0 : &blockErrors[0];
+}
+
+void ErrorMetrics::finish()
+{
+	unsigned long long sumError = 0;
+	for (size_t i = 0; i < blockErrors.size(); ++i)
+	{
+		sumError += blockErrors[i];
+		if (blockErrors[i] > maxBlockError)
+		{
+			maxBlockError = blockErrors[i];
+			maxErrorBlock = i;
+		}
+	}
+
+	// 16 pixels * 3 channels per block
+	double nSamples = (double)blockErrors.size() * 48;
+	rmse = nSamples > 0 ? sqrt(sumError / nSamples) : 0;
+	psnr = rmse > 0 ? 20 * log10(255 / rmse) : numeric_limits<double>::infinity();
+}
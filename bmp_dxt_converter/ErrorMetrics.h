@@ -0,0 +1,88 @@
+/**
+ErrorMetrics.h
+Purpose: Compression error of an image, gathered block by block while the image is compressed: every block is
+compared to its colors as the decoder expands them, so no decompression pass is needed. Gives the RMSE, PSNR,
+the worst block and a map of the error of every block
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "bmp_dxt1_headers.h"
+
+using namespace std;
+
+class ErrorMetrics
+{
+private:
+	int nBlocksPerRow;
+
+	// squared error of every block (sum over its 16 pixels and 3 channels), in block row order
+	vector<unsigned int> blockErrors;
+
+	double rmse;
+	double psnr;
+	unsigned int maxBlockError;
+	size_t maxErrorBlock;
+
+public:
+	ErrorMetrics();
+
+	/**
+	Squared error of a compressed block: the block pixels decoded exactly like Compressor::decompress
+	(RGB565 expanded to RGB888, c2/c3 at 1/3 and 2/3) compared to the source colors
+
+	@param blockColors source 16 pixel colors of the block
+	@param block the compressed block
+	@return sum of the squared differences of the 16 pixels 3 channels
+	*/
+	static unsigned int blockError(const RGBTriplet* blockColors, const Dxt1Block& block);
+
+	/**
+	Size the error map for an image (called by the compressor)
+
+	@param imgWidth image width
+	@param imgHeight image height
+	@return the error map to fill, one entry per block
+	*/
+	unsigned int* begin(const int imgWidth, const int imgHeight);
+
+	/**
+	Compute the image metrics from the error map once every block is compressed (called by the compressor)
+	*/
+	void finish();
+
+	/**
+	Root mean square error per channel (0 to 255)
+	*/
+	double getRMSE() const { return rmse; }
+
+	/**
+	Peak signal to noise ratio in dB, infinity for a lossless image
+	*/
+	double getPSNR() const { return psnr; }
+
+	/**
+	Squared error of the worst block
+	*/
+	unsigned int getMaxBlockError() const { return maxBlockError; }
+
+	/**
+	Index of the worst block (the first one if several are equally bad), in block row order
+	*/
+	size_t getMaxErrorBlock() const { return maxErrorBlock; }
+
+	/**
+	Number of blocks per row of the error map
+	*/
+	int getBlocksPerRow() const { return nBlocksPerRow; }
+
+	/**
+	Squared error of every block, in block row order
+	*/
+	const vector<unsigned int>& getBlockErrors() const { return blockErrors; }
+};
@@ -0,0 +1,176 @@
+/**
+ImageView.h
+Purpose: Source images of the encoders: the pixels are read where they are (BMP mapping, engine framebuffer)
+through a view carrying the pixel format, the stride and so the orientation (negative stride for bottom-up rows),
+and converted to 24bit colors while the block colors are gathered, without conversion copies.
+Each format has a traits struct, the gather loops are templates specialized per format.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include "bmp_dxt1_headers.h"
+#include "SimdDecoder.h"
+
+using namespace std;
+
+// pixel formats of the source images (byte order in memory)
+enum PixelFormat
+{
+	PIXEL_BGR24 = 0,	// BMP 24bit, RGBTriplet
+	PIXEL_BGRA32,		// BMP 32bit and most framebuffers, alpha ignored
+	PIXEL_RGB565,		// 16bit little endian, red in the high bits (as the DXT1 colors)
+	PIXEL_GRAY8			// 8bit luminance, expanded to gray colors
+};
+
+// format traits: PIXEL_BYTES, the size of a pixel, and load(), its 24bit color
+
+struct FormatBGR24
+{
+	enum { PIXEL_BYTES = 3 };
+	static RGBTriplet load(const byte* pixel) { return *(const RGBTriplet*)pixel; }
+};
+
+struct FormatBGRA32
+{
+	enum { PIXEL_BYTES = 4 };
+	static RGBTriplet load(const byte* pixel) { return RGBTriplet(pixel[2], pixel[1], pixel[0]); }
+};
+
+struct FormatRGB565
+{
+	enum { PIXEL_BYTES = 2 };
+	static RGBTriplet load(const byte* pixel)
+	{
+		// same expansion as the DXT1 decoder
+		unsigned int color = pixel[0] | pixel[1] << 8;
+		return RGBTriplet(expand5To8[color >> 11], expand6To8[(color >> 5) & 0x3F], expand5To8[color & 0x1F]);
+	}
+};
+
+struct FormatGray8
+{
+	enum { PIXEL_BYTES = 1 };
+	static RGBTriplet load(const byte* pixel) { return RGBTriplet(pixel[0], pixel[0], pixel[0]); }
+};
+
+struct ImageView
+{
+	const byte* firstScanline;	// first pixel of the top scanline
+	ptrdiff_t stride;			// bytes from a scanline to the one below it, negative for bottom-up rows
+	int width;
+	int height;
+	PixelFormat format;
+
+	ImageView() : firstScanline(0), stride(0), width(0), height(0), format(PIXEL_BGR24) {}
+
+	/**
+	@param firstScanline first pixel of the top scanline
+	@param stride bytes from a scanline to the one below it (padding included, negative for bottom-up rows)
+	@param width image width
+	@param height image height
+	@param format pixel format, PIXEL_BGR24 by default
+	*/
+	ImageView(const void* firstScanline, const ptrdiff_t stride, const int width, const int height, const PixelFormat format = PIXEL_BGR24)
+		: firstScanline((const byte*)firstScanline), stride(stride), width(width), height(height), format(format) {}
+
+	/**
+	View of rows stored from the bottom scanline to the top one (BMP files with a positive height)
+
+	@param pixels first pixel of the first row in memory (the bottom scanline)
+	@param rowBytes bytes from a row to the next one in memory
+	*/
+	static ImageView bottomUp(const void* pixels, const ptrdiff_t rowBytes, const int width, const int height, const PixelFormat format = PIXEL_BGR24)
+	{
+		return ImageView((const byte*)pixels + (ptrdiff_t)(height - 1) * rowBytes, -rowBytes, width, height, format);
+	}
+
+	/**
+	Bytes of a pixel of a format
+	*/
+	static int pixelBytes(const PixelFormat format)
+	{
+		static const int bytes[] = { FormatBGR24::PIXEL_BYTES, FormatBGRA32::PIXEL_BYTES, FormatRGB565::PIXEL_BYTES, FormatGray8::PIXEL_BYTES };
+		return bytes[format];
+	}
+
+	const byte* scanline(const int y) const { return firstScanline + (ptrdiff_t)y * stride; }
+
+	/**
+	View of the scanlines [first, first + nScanlines)
+	*/
+	ImageView rows(const int first, const int nScanlines) const { return ImageView(scanline(first), stride, width, nScanlines, format); }
+};
+
+/**
+Gather the colors of consecutive blocks of a block row, 16 consecutive colors per block. Scanlines past the
+bottom of the image repeat the last one and columns past its right side the last column (partial blocks).
+
+@param image source image
+@param y top scanline of the block row
+@param firstBlock first block of the row to gather
+@param endBlock block after the last one to gather
+@param blockColors target colors, (endBlock - firstBlock) * 16
+*/
+template <class Format>
+void gatherBlocks(const ImageView& image, const int y, const int firstBlock, const int endBlock, RGBTriplet* blockColors)
+{
+	int fullBlocksEnd = endBlock < image.width / 4 ? endBlock : image.width / 4; // blocks inside the image
+
+	for (int h = 0; h < 4; ++h)
+	{
+		const byte* scanline = image.scanline(y + h < image.height ? y + h : image.height - 1);
+		RGBTriplet* colors = blockColors + h * 4;
+
+		int block = firstBlock;
+		for (; block < fullBlocksEnd; ++block, colors += 16)
+		{
+			const byte* pixels = scanline + block * 4 * Format::PIXEL_BYTES;
+			colors[0] = Format::load(pixels);
+			colors[1] = Format::load(pixels + Format::PIXEL_BYTES);
+			colors[2] = Format::load(pixels + Format::PIXEL_BYTES * 2);
+			colors[3] = Format::load(pixels + Format::PIXEL_BYTES * 3);
+		}
+
+		// partial block: repeat the last column
+		for (; block < endBlock; ++block, colors += 16)
+		{
+			for (int w = 0; w < 4; ++w)
+			{
+				int x = block * 4 + w < image.width ? block * 4 + w : image.width - 1;
+				colors[w] = Format::load(scanline + x * Format::PIXEL_BYTES);
+			}
+		}
+	}
+}
+
+/**
+gatherBlocks for the format of the image, dispatched once per call (for callers gathering large pieces of rows)
+*/
+inline void gatherBlocks(const ImageView& image, const int y, const int firstBlock, const int endBlock, RGBTriplet* blockColors)
+{
+	switch (image.format)
+	{
+	case PIXEL_BGRA32: gatherBlocks<FormatBGRA32>(image, y, firstBlock, endBlock, blockColors); break;
+	case PIXEL_RGB565: gatherBlocks<FormatRGB565>(image, y, firstBlock, endBlock, blockColors); break;
+	case PIXEL_GRAY8: gatherBlocks<FormatGray8>(image, y, firstBlock, endBlock, blockColors); break;
+	default: gatherBlocks<FormatBGR24>(image, y, firstBlock, endBlock, blockColors); break;
+	}
+}
+
+/**
+Convert a scanline to 24bit colors
+
+@param scanline first pixel of the scanline
+@param width number of pixels
+@param colors target colors
+*/
+template <class Format>
+void loadScanline(const byte* scanline, const int width, RGBTriplet* colors)
+{
+	for (int x = 0; x < width; ++x)
+		colors[x] = Format::load(scanline + x * Format::PIXEL_BYTES);
+}
@@ -0,0 +1,404 @@
+/**
+IncrementalEncoder.cpp
+Purpose: Re-encodes only the blocks of a BMP file that changed since its DDS file was saved
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <string.h>
+#include "IncrementalEncoder.h"
+
+/**
+Gather the 16 colors of a block, partial blocks (small mip levels) repeat the last column/row
+
+@param firstScanline first pixel of the top scanline
+@param stride bytes from a scanline to the one below it
+@param imgWidth image width
+@param imgHeight image height
+@param x left pixel of the block
+@param y top pixel of the block
+@param blockColors target 16 colors
+*/
+static void gatherBlock(const RGBTriplet* firstScanline, const ptrdiff_t stride, const int imgWidth, const int imgHeight,
+	const int x, const int y, RGBTriplet* blockColors)
+{
+	for (int h = 0; h < 4; ++h)
+	{
+		const RGBTriplet* scanline = (const RGBTriplet*)((const byte*)firstScanline + min(y + h, imgHeight - 1) * stride);
+		for (int w = 0; w < 4; ++w)
+			blockColors[h * 4 + w] = scanline[min(x + w, imgWidth - 1)];
+	}
+}
+
+bool IncrementalEncoder::openBMP(const string& filePath, BMPImage& image) const
+{
+	if (!image.file.openRead(filePath) || image.file.size() < sizeof(BMP_HEADER))
+		return false;
+
+	BMP_HEADER bmpHeader;
+	memcpy(&bmpHeader, image.file.data(), sizeof(bmpHeader));
+	if (!compressor.isValidBMPFile(bmpHeader))
+		return false;
+
+	// the blocks are compared and hashed as 24bit pixels, other formats are compressed whole
+	if (bmpHeader.colorDepth != 24)
+		return false;
+
+	// same limit as the in-memory path of Compressor::compress
+	image.width = bmpHeader.imageWidth;
+	image.height = abs(bmpHeader.imageHeight);
+	size_t nPixelBytes = (size_t)image.width * image.height * 3;
+	if (image.width <= 0 || image.height <= 0 || (long long)nPixelBytes > INT_MAX ||
+		bmpHeader.dataOffset > image.file.size() || image.file.size() - bmpHeader.dataOffset < nPixelBytes)
+		return false;
+
+	// a bottom-up BMP is walked from its last scanline backwards
+	const RGBTriplet* bmpPixels = (const RGBTriplet*)(image.file.data() + bmpHeader.dataOffset);
+	bool isBottomUp = bmpHeader.imageHeight > 0;
+	image.stride = isBottomUp ? -(ptrdiff_t)image.width * 3 : (ptrdiff_t)image.width * 3;
+	image.firstScanline = isBottomUp ? bmpPixels + (size_t)(image.height - 1) * image.width : bmpPixels;
+	return true;
+}
+
+unsigned long long IncrementalEncoder::hashBlock(const RGBTriplet* blockPixels, const ptrdiff_t stride)
+{
+	// the 12 bytes of each block scanline as a 64bit and a 32bit word
+	unsigned long long hash = 0x243F6A8885A308D3ull;
+	for (int h = 0; h < 4; ++h)
+	{
+		const byte* scanline = (const byte*)blockPixels + h * stride;
+		unsigned long long low;
+		unsigned int high;
+		memcpy(&low, scanline, 8);
+		memcpy(&high, scanline + 8, 4);
+
+		hash = (hash ^ low) * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 29;
+		hash = (hash ^ high) * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 32;
+	}
+	return hash;
+}
+
+long long IncrementalEncoder::findDirtyBlocks(const BMPImage& image, const BMPImage* previous, const unsigned long long* previousHashes,
+	unsigned long long* hashes, byte* dirty)
+{
+	int nBlocksPerRow = image.width / 4;
+	int nBlockRows = image.height / 4;
+	atomic<long long> nDirty(0);
+
+	compressor.threadPool->parallelFor(nBlockRows, [&](int row, int /*slot*/)
+	{
+		const byte* scanline = (const byte*)image.firstScanline + (ptrdiff_t)row * 4 * image.stride;
+		size_t firstBlock = (size_t)row * nBlocksPerRow;
+		int nRowDirty = 0;
+
+		for (int block = 0; block < nBlocksPerRow; ++block)
+			hashes[firstBlock + block] = hashBlock((const RGBTriplet*)scanline + block * 4, image.stride);
+
+		if (previous)
+		{
+			// compare whole scanlines first (memcmp is vectorized), most scanlines of a small edit are unchanged
+			const byte* previousScanline = (const byte*)previous->firstScanline + (ptrdiff_t)row * 4 * previous->stride;
+			bool scanlineChanged[4];
+			bool rowChanged = false;
+			for (int h = 0; h < 4; ++h)
+			{
+				scanlineChanged[h] = memcmp(scanline + h * image.stride, previousScanline + h * previous->stride, image.width * 3) != 0;
+				rowChanged |= scanlineChanged[h];
+			}
+
+			for (int block = 0; block < nBlocksPerRow; ++block)
+			{
+				bool changed = false;
+				for (int h = 0; h < 4 && rowChanged && !changed; ++h)
+				{
+					changed = scanlineChanged[h] &&
+						memcmp(scanline + h * image.stride + block * 12, previousScanline + h * previous->stride + block * 12, 12) != 0;
+				}
+				dirty[firstBlock + block] = changed;
+				nRowDirty += changed;
+			}
+		}
+		else
+		{
+			for (int block = 0; block < nBlocksPerRow; ++block)
+			{
+				bool changed = hashes[firstBlock + block] != previousHashes[firstBlock + block];
+				dirty[firstBlock + block] = changed;
+				nRowDirty += changed;
+			}
+		}
+
+		nDirty += nRowDirty;
+	});
+
+	return nDirty;
+}
+
+void IncrementalEncoder::compressDirtyBlocks(const RGBTriplet* firstScanline, const ptrdiff_t stride, const int imgWidth, const int imgHeight,
+	const byte* dirty, Dxt1Block* blocks, ScratchArena& arena)
+{
+	int nBlocksPerRow = (imgWidth + 3) / 4;
+	int nBlockRows = (imgHeight + 3) / 4;
+	int nThreads = compressor.threadPool->size();
+
+	// per thread: the colors of a row's dirty blocks (gathered together for the SIMD encoder), their blocks and positions
+	RGBTriplet* rowColors = arena.allocateArray<RGBTriplet>((size_t)nBlocksPerRow * 16 * nThreads);
+	Dxt1Block* rowBlocks = arena.allocateArray<Dxt1Block>((size_t)nBlocksPerRow * nThreads);
+	int* rowPositions = arena.allocateArray<int>((size_t)nBlocksPerRow * nThreads);
+
+	// with rate-distortion optimization a block depends on the blocks before it in its row segment (see RdoOptimizer):
+	// the segments holding a dirty block are compressed whole, as the full compression does
+	RdoOptimizer* optimizers = compressor.createRdoOptimizers(arena);
+	int segmentBlocks = optimizers ? RDO_SEGMENT_BLOCKS : 1;
+
+	compressor.threadPool->parallelFor(nBlockRows, [&](int row, int slot)
+	{
+		const byte* rowDirty = dirty + (size_t)row * nBlocksPerRow;
+		RGBTriplet* colors = rowColors + (size_t)slot * nBlocksPerRow * 16;
+		Dxt1Block* compressed = rowBlocks + (size_t)slot * nBlocksPerRow;
+		int* positions = rowPositions + (size_t)slot * nBlocksPerRow;
+
+		// whole segments are gathered, so the segments still start at multiples of RDO_SEGMENT_BLOCKS
+		int nDirty = 0;
+		for (int first = 0; first < nBlocksPerRow; first += segmentBlocks)
+		{
+			int end = min(first + segmentBlocks, nBlocksPerRow);
+			if (find(rowDirty + first, rowDirty + end, 1) == rowDirty + end)
+				continue;
+
+			for (int block = first; block < end; ++block)
+			{
+				gatherBlock(firstScanline, stride, imgWidth, imgHeight, block * 4, row * 4, colors + nDirty * 16);
+				positions[nDirty++] = block;
+			}
+		}
+
+		if (nDirty == 0)
+			return;
+
+		compressor.compressDxt1Blocks(colors, compressed, nDirty, 0, 0, optimizers ? optimizers + slot : 0);
+		for (int i = 0; i < nDirty; ++i)
+			blocks[(size_t)row * nBlocksPerRow + positions[i]] = compressed[i];
+	});
+
+	compressor.addRdoStats(optimizers);
+}
+
+void IncrementalEncoder::compressDirtyMipLevels(const BMPImage& image, const byte* dirty, Dxt1Block* blocks, const int nLevels, ScratchArena& arena)
+{
+	// two level images used in turn: the one being filtered and its parent (see Compressor::compressMipChain)
+	int w = image.width, h = image.height;
+	RGBTriplet* levelPixels[2] = { 0, 0 };
+	levelPixels[0] = arena.allocateArray<RGBTriplet>((size_t)Downsampler::halfSize(w) * Downsampler::halfSize(h));
+	if (nLevels > 2)
+		levelPixels[1] = arena.allocateArray<RGBTriplet>((size_t)Downsampler::halfSize(Downsampler::halfSize(w)) *
+			Downsampler::halfSize(Downsampler::halfSize(h)));
+
+	const RGBTriplet* source = image.firstScanline;
+	ptrdiff_t stride = image.stride;
+	const byte* sourceDirty = dirty;
+	blocks += Compressor::mipChainBlocks(w, h, 1);
+
+	for (int level = 1; level < nLevels; ++level)
+	{
+		int levelWidth = Downsampler::halfSize(w), levelHeight = Downsampler::halfSize(h);
+		RGBTriplet* pixels = levelPixels[(level - 1) % 2];
+
+		// the level pixels depend on the whole parent level, filter all of it (the same rows as the full compression)
+		compressor.threadPool->parallelFor(levelHeight, [&](int y, int /*slot*/)
+		{
+			const RGBTriplet* scanline0 = (const RGBTriplet*)((const byte*)source + min(y * 2, h - 1) * stride);
+			const RGBTriplet* scanline1 = (const RGBTriplet*)((const byte*)source + min(y * 2 + 1, h - 1) * stride);
+			compressor.downsampler.downsampleRow(scanline0, scanline1, w, pixels + (size_t)y * levelWidth);
+		});
+
+		// a block covers (parts of) the 2x2 blocks of the parent level above it
+		int nBlocksPerRow = (w + 3) / 4, nBlockRows = (h + 3) / 4;
+		int nLevelBlocksPerRow = (levelWidth + 3) / 4, nLevelBlockRows = (levelHeight + 3) / 4;
+		byte* levelDirty = arena.allocateArray<byte>((size_t)nLevelBlocksPerRow * nLevelBlockRows);
+		memset(levelDirty, 0, (size_t)nLevelBlocksPerRow * nLevelBlockRows);
+		for (int row = 0; row < nBlockRows; ++row)
+		{
+			for (int block = 0; block < nBlocksPerRow; ++block)
+			{
+				if (sourceDirty[(size_t)row * nBlocksPerRow + block])
+					levelDirty[min(row / 2, nLevelBlockRows - 1) * nLevelBlocksPerRow + min(block / 2, nLevelBlocksPerRow - 1)] = 1;
+			}
+		}
+
+		compressDirtyBlocks(pixels, (ptrdiff_t)levelWidth * 3, levelWidth, levelHeight, levelDirty, blocks, arena);
+
+		blocks += Compressor::mipChainBlocks(levelWidth, levelHeight, 1);
+		source = pixels;
+		stride = (ptrdiff_t)levelWidth * 3;
+		sourceDirty = levelDirty;
+		w = levelWidth;
+		h = levelHeight;
+	}
+}
+
+unsigned long long IncrementalEncoder::checksumBlocks(const Dxt1Block* blocks, const size_t nBlocks)
+{
+	// chunks hashed in parallel, the chunk hashes combined in order
+	const size_t chunkBlocks = 1 << 16;
+	int nChunks = (int)((nBlocks + chunkBlocks - 1) / chunkBlocks);
+	unsigned long long* chunkHashes = new unsigned long long[max(nChunks, 1)];
+
+	compressor.threadPool->parallelFor(nChunks, [&](int chunk, int /*slot*/)
+	{
+		size_t first = chunk * chunkBlocks, end = min(first + chunkBlocks, nBlocks);
+		unsigned long long hash = 0x243F6A8885A308D3ull;
+		for (size_t i = first; i < end; ++i)
+		{
+			unsigned long long word;
+			memcpy(&word, blocks + i, 8);
+			hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+			hash ^= hash >> 29;
+		}
+		chunkHashes[chunk] = hash;
+	});
+
+	unsigned long long checksum = nBlocks;
+	for (int chunk = 0; chunk < nChunks; ++chunk)
+	{
+		checksum = (checksum ^ chunkHashes[chunk]) * 0x9E3779B97F4A7C15ull;
+		checksum ^= checksum >> 32;
+	}
+
+	delete[] chunkHashes;
+	return checksum;
+}
+
+bool IncrementalEncoder::saveHashes(const string& hashPath, const int imgWidth, const int imgHeight, const unsigned long long* hashes,
+	const BMPImage* image, const unsigned long long ddsChecksum)
+{
+	size_t nBlocks = (size_t)(imgWidth / 4) * (imgHeight / 4);
+	unsigned long long* imageHashes = 0;
+	if (!hashes)
+	{
+		int nBlocksPerRow = imgWidth / 4;
+		imageHashes = new unsigned long long[nBlocks];
+		compressor.threadPool->parallelFor(imgHeight / 4, [&](int row, int /*slot*/)
+		{
+			const RGBTriplet* scanline = (const RGBTriplet*)((const byte*)image->firstScanline + (ptrdiff_t)row * 4 * image->stride);
+			for (int block = 0; block < nBlocksPerRow; ++block)
+				imageHashes[(size_t)row * nBlocksPerRow + block] = hashBlock(scanline + block * 4, image->stride);
+		});
+		hashes = imageHashes;
+	}
+
+	// cleared first, the padding is written too
+	BlockHashHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = BLOCK_HASH_MAGIC;
+	header.width = imgWidth;
+	header.height = imgHeight;
+	header.encoderTier = compressor.encoderTier;
+	header.rdoLambda = compressor.rdoLambda;
+	header.ddsChecksum = ddsChecksum;
+
+	ofstream hashFile(hashPath, ofstream::out | ofstream::binary);
+	hashFile.write((const char*)&header, sizeof(header));
+	hashFile.write((const char*)hashes, (streamsize)(nBlocks * sizeof(unsigned long long)));
+	hashFile.close();
+
+	delete[] imageHashes;
+
+	if (!hashFile)
+	{
+		cout << "- can't write " << hashPath << endl;
+		return false;
+	}
+	return true;
+}
+
+bool IncrementalEncoder::update(const string& filePath, const string& outputPath, const string& previousPath)
+{
+	// images the in-memory path can't take (or invalid files, reported by compress) are compressed whole
+	BMPImage image;
+	if (!openBMP(filePath, image))
+		return compressor.compress(filePath, outputPath);
+
+	int nBlocks = (image.width / 4) * (image.height / 4);
+	int nLevels = compressor.mipmaps ? Compressor::mipLevelCount(image.width, image.height) : 1;
+	size_t nChainBlocks = Compressor::mipChainBlocks(image.width, image.height, nLevels);
+	string hashPath = outputPath + BLOCK_HASH_EXTENSION;
+
+	// the DDS file must be the one a full compression writes: same size, same header (dimensions, mip levels)
+	DDS_HEADER ddsHeader;
+	compressor.fillDDSHeader(ddsHeader, image.width, image.height, nLevels);
+	MappedFile ddsFile;
+	bool hasDDS = ddsFile.openWrite(outputPath) && ddsFile.size() == sizeof(DDS_HEADER) + nChainBlocks * sizeof(Dxt1Block) &&
+		memcmp(ddsFile.data(), &ddsHeader, sizeof(DDS_HEADER)) == 0;
+	Dxt1Block* blocks = hasDDS ? (Dxt1Block*)(ddsFile.data() + sizeof(DDS_HEADER)) : 0;
+
+	// the previous version: its BMP file, or the hashes saved by the last update of this DDS file
+	BMPImage previous;
+	MappedFile hashFile;
+	const unsigned long long* previousHashes = 0;
+	bool hasPrevious = false;
+	if (!previousPath.empty())
+	{
+		hasPrevious = openBMP(previousPath, previous) && previous.width == image.width && previous.height == image.height;
+	}
+	else if (hasDDS && hashFile.openRead(hashPath) && hashFile.size() == sizeof(BlockHashHeader) + (size_t)nBlocks * sizeof(unsigned long long))
+	{
+		const BlockHashHeader* header = (const BlockHashHeader*)hashFile.data();
+		hasPrevious = header->magic == BLOCK_HASH_MAGIC && header->width == image.width && header->height == image.height &&
+			header->encoderTier == compressor.encoderTier && header->rdoLambda == compressor.rdoLambda && header->ddsChecksum == checksumBlocks(blocks, nChainBlocks);
+		previousHashes = (const unsigned long long*)(hashFile.data() + sizeof(BlockHashHeader));
+	}
+
+	if (!hasPrevious || !hasDDS)
+	{
+		ddsFile.close();
+		hashFile.close();
+
+		if (compressor.verbose)
+			cout << "- no previous version of " << outputPath << " to update, compressing all the blocks" << endl;
+
+		if (!compressor.compress(filePath, outputPath))
+			return false;
+
+		// hashes for the next update
+		if (ddsFile.openRead(outputPath))
+			saveHashes(hashPath, image.width, image.height, 0, &image,
+				checksumBlocks((const Dxt1Block*)(ddsFile.data() + sizeof(DDS_HEADER)), nChainBlocks));
+		return true;
+	}
+
+	if (compressor.verbose)
+		cout << "- updating..." << endl;
+
+	ScratchArena arena;
+	unsigned long long* hashes = arena.allocateArray<unsigned long long>(nBlocks);
+	byte* dirty = arena.allocateArray<byte>(nBlocks);
+	long long nDirty = findDirtyBlocks(image, previousPath.empty() ? 0 : &previous, previousHashes, hashes, dirty);
+	hashFile.close();
+
+	// patch the dirty blocks (and the mip levels blocks covering them) in place
+	if (nDirty > 0)
+	{
+		compressDirtyBlocks(image.firstScanline, image.stride, image.width, image.height, dirty, blocks, arena);
+		if (nLevels > 1)
+			compressDirtyMipLevels(image, dirty, blocks, nLevels, arena);
+	}
+
+	unsigned long long ddsChecksum = checksumBlocks(blocks, nChainBlocks);
+	ddsFile.close();
+	checkedBlocks += nBlocks;
+	dirtyBlocks += nDirty;
+
+	if (compressor.verbose)
+		cout << "- " << nDirty << " of " << nBlocks << " blocks changed, " << outputPath << " updated successfully" << endl;
+
+	saveHashes(hashPath, image.width, image.height, hashes, 0, ddsChecksum);
+	return true;
+}
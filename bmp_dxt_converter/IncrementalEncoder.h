@@ -0,0 +1,172 @@
+/**
+IncrementalEncoder.h
+Purpose: Re-encodes only the blocks of a BMP file that changed since its DDS file was saved. The changed
+(dirty) 4x4 blocks are found by comparing the new BMP with the previous BMP, or with the block hashes
+saved next to the DDS file by the previous update, and are recompressed and patched into the DDS file in place.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include "Compressor.h"
+#include "MappedFile.h"
+#include "ScratchArena.h"
+
+using namespace std;
+
+// block hashes file saved next to the DDS file (DDS path + extension): the header then one 64bit hash
+// per block of the full size image, in row order. The header keeps a checksum of the DDS file blocks, hashes
+// saved for another version of the DDS file (e.g. compressed again without an update) are not used.
+#define BLOCK_HASH_EXTENSION	".blockhash"
+#define BLOCK_HASH_MAGIC		0x48534842 // "BHSH"
+
+struct BlockHashHeader
+{
+	unsigned int magic;
+	int width;
+	int height;
+	int encoderTier; // hashes of blocks compressed with another encoder don't describe the DDS file blocks
+	int rdoLambda; // nor with another rate-distortion optimization
+	unsigned long long ddsChecksum;
+};
+
+class IncrementalEncoder
+{
+private:
+	// encoder settings (tier, mipmaps, rate-distortion optimization) and threads, a DDS file is only patched if it was saved with the same settings
+	Compressor& compressor;
+
+	// blocks of the full size images checked and found dirty by all the updates
+	atomic<long long> checkedBlocks;
+	atomic<long long> dirtyBlocks;
+
+	// a mapped 24bit BMP file, scanlines top to bottom through stride
+	struct BMPImage
+	{
+		MappedFile file;
+		const RGBTriplet* firstScanline;
+		ptrdiff_t stride;
+		int width;
+		int height;
+	};
+
+	/**
+	Map a BMP file and check it can be compressed in memory
+
+	@param filePath BMP file path
+	@param image target image
+	@return false if the file is missing, not a valid BMP file (reported by isValidBMPFile), not 24bit or too large
+	*/
+	bool openBMP(const string& filePath, BMPImage& image) const;
+
+	/**
+	Hash the colors of a block
+
+	@param blockPixels top left pixel of the block
+	@param stride bytes from a scanline to the one below it
+	*/
+	static unsigned long long hashBlock(const RGBTriplet* blockPixels, const ptrdiff_t stride);
+
+	/**
+	Checksum of the DXT1 blocks of a DDS file, computed in parallel
+
+	@param blocks the blocks (all mip levels)
+	@param nBlocks number of blocks
+	*/
+	unsigned long long checksumBlocks(const Dxt1Block* blocks, const size_t nBlocks);
+
+	/**
+	Hash every block of an image and flag the blocks that differ from the previous image or hashes
+
+	@param image the new image
+	@param previous the previous image, or null to compare with previousHashes
+	@param previousHashes hashes of the previous image blocks, used if previous is null
+	@param hashes target hashes of the new image blocks
+	@param dirty target flags, 1 for the blocks that changed
+	@return number of dirty blocks
+	*/
+	long long findDirtyBlocks(const BMPImage& image, const BMPImage* previous, const unsigned long long* previousHashes,
+		unsigned long long* hashes, byte* dirty);
+
+	/**
+	Compress the dirty blocks of an image (or mip level) into their place among the image blocks. With rate-distortion
+	optimization, the whole row segments (RDO_SEGMENT_BLOCKS) holding a dirty block are compressed.
+
+	@param firstScanline first pixel of the top scanline
+	@param stride bytes from a scanline to the one below it
+	@param imgWidth image width
+	@param imgHeight image height
+	@param dirty flags of the blocks to compress
+	@param blocks blocks of the image, the dirty ones are replaced
+	@param arena scratch memory (reset by the caller)
+	*/
+	void compressDirtyBlocks(const RGBTriplet* firstScanline, const ptrdiff_t stride, const int imgWidth, const int imgHeight,
+		const byte* dirty, Dxt1Block* blocks, ScratchArena& arena);
+
+	/**
+	Recompress the mip levels blocks covering the dirty blocks of the full size image. The levels are filtered
+	again from the new image, only their dirty blocks are compressed.
+
+	@param image the new image
+	@param dirty flags of the full size image blocks
+	@param blocks blocks of the whole mip chain
+	@param nLevels number of mip levels including the full size image
+	@param arena scratch memory (reset by the caller)
+	*/
+	void compressDirtyMipLevels(const BMPImage& image, const byte* dirty, Dxt1Block* blocks, const int nLevels, ScratchArena& arena);
+
+	/**
+	Save the block hashes file of a DDS file
+
+	@param hashPath block hashes file path
+	@param imgWidth image width
+	@param imgHeight image height
+	@param hashes one hash per block, or null to hash the blocks of image
+	@param image image to hash if hashes is null
+	@param ddsChecksum checksum of the DDS file blocks (see checksumBlocks)
+	@return true if the file was written (a missing file only makes the next update compress the whole image)
+	*/
+	bool saveHashes(const string& hashPath, const int imgWidth, const int imgHeight, const unsigned long long* hashes,
+		const BMPImage* image, const unsigned long long ddsChecksum);
+
+public:
+	/**
+	@param compressor compressor providing the encoder settings and the threads, must outlive the encoder
+	*/
+	explicit IncrementalEncoder(Compressor& compressor) : compressor(compressor), checkedBlocks(0), dirtyBlocks(0) {}
+
+	IncrementalEncoder(const IncrementalEncoder&) = delete;
+	IncrementalEncoder& operator=(const IncrementalEncoder&) = delete;
+
+	/**
+	Update a DDS file from a new version of its BMP file, recompressing only the blocks that changed. The DDS file
+	must have been saved from the previous BMP with the same compressor settings (encoder tier, mipmaps, RDO lambda),
+	the patched file is then the same as a full compression of the new BMP (with RDO, every row segment holding a
+	changed block is recompressed, the blocks of a segment depend on each other). Without a previous BMP or block hashes
+	matching the image, or without a matching DDS file, the whole image is compressed.
+	The block hashes of the new image are saved next to the DDS file for the next update.
+
+	update() may be called from several threads at once for different output files.
+
+	@param filePath new BMP file path
+	@param outputPath DDS file path, patched in place
+	@param previousPath previous BMP file path, empty (default) to compare with the saved block hashes
+	@return true if the DDS file is up to date
+	*/
+	bool update(const string& filePath, const string& outputPath, const string& previousPath = "");
+
+	/**
+	Blocks of the full size images checked by all the updates (whole compressions excluded)
+	*/
+	long long getCheckedBlocks() const { return checkedBlocks; }
+
+	/**
+	Blocks of the full size images found changed and recompressed by all the updates
+	*/
+	long long getDirtyBlocks() const { return dirtyBlocks; }
+};
@@ -0,0 +1,331 @@
+/**
+MappedFile.cpp
+Purpose: Memory mapped file (Win32 file mapping or POSIX mmap)
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <cstdio>
+#include <fstream>
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#else
+#include <sys/mount.h>
+#endif
+#endif
+
+// replace a file by a copy of its own (not sharing its data with its other hard links), under the same name
+static bool replaceWithCopy(const string& filePath)
+{
+	string copyPath = filePath + ".copy";
+	{
+		ifstream source(filePath, ios::binary);
+		ofstream target(copyPath, ofstream::out | ofstream::binary);
+		target << source.rdbuf();
+		target.close();
+		if (!source.good() || !target)
+		{
+			remove(copyPath.c_str());
+			return false;
+		}
+	}
+
+#ifdef _WIN32
+	if (!MoveFileExA(copyPath.c_str(), filePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+	if (rename(copyPath.c_str(), filePath.c_str()) != 0)
+#endif
+	{
+		remove(copyPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+MappedFile::MappedFile() : mappedData(0), mappedSize(0), remote(false)
+{
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = 0;
+#else
+	fileDescriptor = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+void MappedFile::prefetch(const byte* first, const size_t size) const
+{
+	if (size == 0)
+		return;
+
+#ifndef _WIN32
+	// start reading the whole part at once, then wait for every page
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	byte* firstPage = mappedData + (first - mappedData) / pageSize * pageSize;
+	madvise(firstPage, first + size - firstPage, MADV_WILLNEED);
+#endif
+
+	// touch a byte of every page (4KB or larger)
+	volatile byte sink = 0;
+	for (size_t offset = 0; offset < size; offset += 4096)
+		sink += first[offset];
+	sink += first[size - 1];
+}
+
+#ifdef _WIN32
+
+bool MappedFile::openRead(const string& filePath)
+{
+	close();
+
+	fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0 || (unsigned long long)fileSize.QuadPart > (size_t)-1)
+	{
+		close();
+		return false;
+	}
+
+	mappedSize = (size_t)fileSize.QuadPart;
+	return map(false);
+}
+
+bool MappedFile::openWrite(const string& filePath)
+{
+	close();
+
+	fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	// the writes must not reach the other hard links of the file (e.g. a conversion cache entry)
+	BY_HANDLE_FILE_INFORMATION fileInfo;
+	if (GetFileInformationByHandle(fileHandle, &fileInfo) && fileInfo.nNumberOfLinks > 1)
+	{
+		close();
+		if (!replaceWithCopy(filePath))
+			return false;
+
+		fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+			return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0 || (unsigned long long)fileSize.QuadPart > (size_t)-1)
+	{
+		close();
+		return false;
+	}
+
+	mappedSize = (size_t)fileSize.QuadPart;
+	return map(true);
+}
+
+bool MappedFile::create(const string& filePath, const size_t fileSize)
+{
+	close();
+
+	fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fileHandle == INVALID_HANDLE_VALUE || fileSize == 0)
+	{
+		close();
+		return false;
+	}
+
+	// mapping a file for writing extends it to the mapping size
+	mappedSize = fileSize;
+	return map(true);
+}
+
+void MappedFile::flush(const byte* first, const size_t size) const
+{
+	if (remote && size != 0)
+		FlushViewOfFile(first, size);
+}
+
+bool MappedFile::map(const bool writable)
+{
+	unsigned long long size = mappedSize;
+	mappingHandle = CreateFileMappingA(fileHandle, 0, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(size >> 32), (DWORD)size, 0);
+	if (!mappingHandle)
+	{
+		close();
+		return false;
+	}
+
+	mappedData = (byte*)MapViewOfFile(mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, mappedSize);
+	if (!mappedData)
+	{
+		close();
+		return false;
+	}
+
+	// only files of network shares have a remote protocol
+	FILE_REMOTE_PROTOCOL_INFO protocolInfo;
+	remote = GetFileInformationByHandleEx(fileHandle, FileRemoteProtocolInfo, &protocolInfo, sizeof(protocolInfo)) != 0;
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (mappedData)
+		UnmapViewOfFile(mappedData);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+
+	mappedData = 0;
+	mappedSize = 0;
+	remote = false;
+	mappingHandle = 0;
+	fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::openRead(const string& filePath)
+{
+	close();
+
+	fileDescriptor = open(filePath.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0 || (unsigned long long)fileStat.st_size > (size_t)-1)
+	{
+		close();
+		return false;
+	}
+
+	mappedSize = (size_t)fileStat.st_size;
+	return map(false);
+}
+
+bool MappedFile::openWrite(const string& filePath)
+{
+	close();
+
+	fileDescriptor = open(filePath.c_str(), O_RDWR);
+	if (fileDescriptor < 0)
+		return false;
+
+	// the writes must not reach the other hard links of the file (e.g. a conversion cache entry)
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_nlink > 1)
+	{
+		close();
+		if (!replaceWithCopy(filePath))
+			return false;
+
+		fileDescriptor = open(filePath.c_str(), O_RDWR);
+		if (fileDescriptor < 0)
+			return false;
+	}
+
+	if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0 || (unsigned long long)fileStat.st_size > (size_t)-1)
+	{
+		close();
+		return false;
+	}
+
+	mappedSize = (size_t)fileStat.st_size;
+	return map(true);
+}
+
+bool MappedFile::create(const string& filePath, const size_t fileSize)
+{
+	close();
+
+	fileDescriptor = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fileDescriptor < 0 || fileSize == 0 || ftruncate(fileDescriptor, (off_t)fileSize) != 0)
+	{
+		close();
+		return false;
+	}
+
+	mappedSize = fileSize;
+	return map(true);
+}
+
+void MappedFile::flush(const byte* first, const size_t size) const
+{
+	if (!remote || size == 0)
+		return;
+
+#ifdef __linux__
+	// queue the dirty pages of the part for writing and return
+	sync_file_range(fileDescriptor, (off64_t)(first - mappedData), (off64_t)size, SYNC_FILE_RANGE_WRITE);
+#else
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	byte* firstPage = mappedData + (first - mappedData) / pageSize * pageSize;
+	msync(firstPage, first + size - firstPage, MS_ASYNC);
+#endif
+}
+
+bool MappedFile::map(const bool writable)
+{
+	void* data = mmap(0, mappedSize, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	if (data == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	mappedData = (byte*)data;
+
+	// the encoder and decoder walk the input front to back
+	if (!writable)
+		madvise(data, mappedSize, MADV_SEQUENTIAL);
+
+	struct statfs fileSystem;
+	if (fstatfs(fileDescriptor, &fileSystem) == 0)
+	{
+#ifdef __linux__
+		// NFS, SMB, CIFS, SMB2
+		unsigned long type = (unsigned long)fileSystem.f_type;
+		remote = type == 0x6969 || type == 0x517B || type == 0xFF534D42 || type == 0xFE534D42;
+#else
+		remote = !(fileSystem.f_flags & MNT_LOCAL);
+#endif
+	}
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (mappedData)
+		munmap(mappedData, mappedSize);
+	if (fileDescriptor >= 0)
+		::close(fileDescriptor);
+
+	mappedData = 0;
+	mappedSize = 0;
+	remote = false;
+	fileDescriptor = -1;
+}
+
+#endif
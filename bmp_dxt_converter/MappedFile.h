@@ -0,0 +1,101 @@
+/**
+MappedFile.h
+Purpose: Memory mapped file, lets the compressor read pixels/blocks straight from the input file
+and write its output in place into a pre-sized output file
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <string>
+#include "bmp_dxt1_headers.h"
+
+using namespace std;
+
+class MappedFile
+{
+private:
+	byte* mappedData;
+	size_t mappedSize;
+
+	// the file is on a network file system (see flush)
+	bool remote;
+
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fileDescriptor;
+#endif
+
+	/**
+	Map the opened file (fileHandle/fileDescriptor)
+
+	@param writable map the file for reading and writing
+	@return true on success
+	*/
+	bool map(const bool writable);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	Map an existing file for reading
+
+	@param filePath file path
+	@return true on success, false if the file does not exist, is empty or can't be mapped
+	*/
+	bool openRead(const string& filePath);
+
+	/**
+	Map an existing file for reading and writing, written bytes patch the file in place. A file with other hard
+	links is first replaced by a copy of its own, the writes don't reach the other links.
+
+	@param filePath file path
+	@return true on success, false if the file does not exist, is empty or can't be mapped
+	*/
+	bool openWrite(const string& filePath);
+
+	/**
+	Create (or truncate) a file of the given size and map it for writing
+
+	@param filePath file path
+	@param fileSize size of the file in bytes
+	@return true on success
+	*/
+	bool create(const string& filePath, const size_t fileSize);
+
+	/**
+	Unmap and close the file, written pages are flushed to the file by the OS
+	*/
+	void close();
+
+	/**
+	Read the pages of a part of the mapping into memory now, on the calling thread, so the thread using them
+	next doesn't wait for the disk (or network)
+
+	@param first first byte of the part, inside the mapping
+	@param size size of the part in bytes
+	*/
+	void prefetch(const byte* first, const size_t size) const;
+
+	/**
+	Start writing a part of a writable mapping back to the network file system holding the file, without waiting
+	for the write to end, so the written pages don't all go over the network when the file is closed.
+	Local files are left to the OS, which writes them back in the background.
+
+	@param first first byte of the part, inside the mapping
+	@param size size of the part in bytes
+	*/
+	void flush(const byte* first, const size_t size) const;
+
+	bool isOpen() const { return mappedData != 0; }
+	byte* data() const { return mappedData; }
+	size_t size() const { return mappedSize; }
+};
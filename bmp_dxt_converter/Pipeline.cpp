@@ -0,0 +1,72 @@
+/**
+Pipeline.cpp
+Purpose: Three stage (read, process, write) pipeline over the chunks of a file
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <thread>
+#include "Pipeline.h"
+
+template <class Ready>
+bool Pipeline::waitFor(const Ready& ready)
+{
+	unique_lock<mutex> lock(stateMutex);
+	stateChanged.wait(lock, [&] { return failed || ready(); });
+	return !failed;
+}
+
+void Pipeline::finishChunk(int& counter, const bool ok)
+{
+	{
+		lock_guard<mutex> lock(stateMutex);
+		if (ok)
+			++counter;
+		else
+			failed = true;
+	}
+	stateChanged.notify_all();
+}
+
+bool Pipeline::run(const int nChunks, const Stage& read, const Stage& process, const Stage& write)
+{
+	nRead = nProcessed = nWritten = 0;
+	failed = false;
+
+	// nothing to overlap
+	if (nChunks == 1)
+		return read(0, 0) && process(0, 0) && write(0, 0);
+
+	// a slot is free once the chunk that used it before is written
+	thread reader([&]
+	{
+		for (int chunk = 0; chunk < nChunks; ++chunk)
+		{
+			if (!waitFor([&] { return chunk < nWritten + nSlots; }))
+				return;
+			finishChunk(nRead, read(chunk, chunk % nSlots));
+		}
+	});
+
+	thread writer([&]
+	{
+		for (int chunk = 0; chunk < nChunks; ++chunk)
+		{
+			if (!waitFor([&] { return chunk < nProcessed; }))
+				return;
+			finishChunk(nWritten, write(chunk, chunk % nSlots));
+		}
+	});
+
+	for (int chunk = 0; chunk < nChunks; ++chunk)
+	{
+		if (!waitFor([&] { return chunk < nRead; }))
+			break;
+		finishChunk(nProcessed, process(chunk, chunk % nSlots));
+	}
+
+	reader.join();
+	writer.join();
+	return !failed;
+}
@@ -0,0 +1,82 @@
+/**
+Pipeline.h
+Purpose: Three stage (read, process, write) pipeline over the chunks of a file. The read and write stages run on
+their own threads, so reading chunk N + 1, processing chunk N and writing chunk N - 1 overlap and the wall time
+approaches the slowest stage instead of the sum of the stages. Chunks go through a fixed number of slots (bounded
+queues): a chunk is only read once the chunk that used its slot before is written.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+using namespace std;
+
+// default number of chunk buffers: one per stage, so all the stages can work at once
+#define PIPELINE_SLOTS	3
+
+class Pipeline
+{
+public:
+	// a stage function: (chunk, slot) -> false to stop the pipeline (e.g. on an I/O error)
+	typedef function<bool(int chunk, int slot)> Stage;
+
+private:
+	// number of chunk buffers, chunk i uses slot i % nSlots
+	int nSlots;
+
+	// chunks done by each stage, in order (guarded by stateMutex)
+	int nRead;
+	int nProcessed;
+	int nWritten;
+	bool failed;
+
+	mutex stateMutex;
+	condition_variable stateChanged;
+
+	/**
+	Wait until a stage may start a chunk
+
+	@param ready condition, checked with the state mutex held
+	@return false if the pipeline failed meanwhile
+	*/
+	template <class Ready>
+	bool waitFor(const Ready& ready);
+
+	/**
+	Record the end of a chunk in a stage (or its failure) and wake the other stages
+
+	@param counter the stage counter
+	@param ok stage result
+	*/
+	void finishChunk(int& counter, const bool ok);
+
+public:
+	/**
+	@param nSlots number of chunk buffers, more than PIPELINE_SLOTS absorb I/O hiccups
+	*/
+	explicit Pipeline(const int nSlots = PIPELINE_SLOTS) : nSlots(nSlots < 1 ? 1 : nSlots) {}
+
+	Pipeline(const Pipeline&) = delete;
+	Pipeline& operator=(const Pipeline&) = delete;
+
+	int slotCount() const { return nSlots; }
+
+	/**
+	Run the chunks through the stages: read and write on 2 new threads, process on the calling thread
+	(which may use a thread pool). Each stage sees the chunks in order. A single chunk runs the stages in turn
+	on the calling thread.
+
+	@param nChunks number of chunks
+	@param read reads a chunk into the slot buffers
+	@param process processes the slot buffers
+	@param write writes the slot buffers
+	@return false if a stage failed, the stages stop at their next chunk
+	*/
+	bool run(const int nChunks, const Stage& read, const Stage& process, const Stage& write);
+};
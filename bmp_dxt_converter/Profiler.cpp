@@ -0,0 +1,164 @@
+/**
+Profiler.cpp
+Purpose: Per stage timing and counters of the conversions, written as JSON
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <chrono>
+#include <string.h>
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// FILETIME counts 100ns units
+static long long fileTimeNs(const FILETIME& time)
+{
+	return (long long)(((unsigned long long)time.dwHighDateTime << 32) | time.dwLowDateTime) * 100;
+}
+#endif
+
+Profiler::Profiler() : nConversions(0), blocksDecoded(0), bytesRead(0), bytesWritten(0)
+{
+	for (int stage = 0; stage < STAGE_COUNT; ++stage)
+	{
+		stages[stage].wallNs = 0;
+		stages[stage].cpuNs = 0;
+		stages[stage].nIntervals = 0;
+	}
+	for (int slot = 0; slot < PROFILE_MAX_THREADS; ++slot)
+		threadBusyNs[slot] = 0;
+	for (int blockClass = 0; blockClass < BLOCK_CLASS_COUNT; ++blockClass)
+		blockClasses[blockClass] = 0;
+
+	startWallNs = wallNow();
+	startCpuNs = processCpuNow();
+}
+
+long long Profiler::wallNow()
+{
+	return (long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long Profiler::threadCpuNow()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	return fileTimeNs(kernel) + fileTimeNs(user);
+#else
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return (long long)time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+long long Profiler::processCpuNow()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	return fileTimeNs(kernel) + fileTimeNs(user);
+#else
+	timespec time;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+	return (long long)time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+void Profiler::addInterval(const ProfileStage stage, const long long wallNs, const long long cpuNs)
+{
+	stages[stage].wallNs += wallNs;
+	stages[stage].cpuNs += cpuNs;
+	++stages[stage].nIntervals;
+
+	int slot = ThreadPool::currentSlot();
+	threadBusyNs[slot < PROFILE_MAX_THREADS ? slot : PROFILE_MAX_THREADS - 1] += wallNs;
+}
+
+void Profiler::countEncodedBlocks(const RGBTriplet* blockColors, const int nBlocks)
+{
+	long long counts[BLOCK_CLASS_COUNT] = { 0 };
+	for (int i = 0; i < nBlocks; ++i)
+		++counts[BlockClassifier::classify(blockColors + i * 16)];
+
+	for (int blockClass = 0; blockClass < BLOCK_CLASS_COUNT; ++blockClass)
+		blockClasses[blockClass] += counts[blockClass];
+}
+
+void Profiler::writeJson(ostream& out, const int nThreads, const char* simdLevel, const char* encoder) const
+{
+	static const char* stageNames[STAGE_COUNT] = { "header", "read", "gather", "encode", "downsample", "write", "decode" };
+	const double nsPerSecond = 1e9;
+
+	double wallSeconds = (wallNow() - startWallNs) / nsPerSecond;
+	double cpuSeconds = (processCpuNow() - startCpuNs) / nsPerSecond;
+	long long blocksEncoded = blockClasses[BLOCK_SOLID] + blockClasses[BLOCK_TWO_COLOR] + blockClasses[BLOCK_LOW_VARIANCE] +
+		blockClasses[BLOCK_GENERAL];
+	double encodeSeconds = stages[STAGE_ENCODE].wallNs / nsPerSecond;
+	double decodeSeconds = stages[STAGE_DECODE].wallNs / nsPerSecond;
+
+	char host[256] = "";
+#ifdef _WIN32
+	DWORD hostSize = sizeof(host);
+	GetComputerNameA(host, &hostSize);
+#else
+	gethostname(host, sizeof(host) - 1);
+#endif
+	// the host name goes in a JSON string as is, keep it printable
+	for (char* c = host; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\' || (unsigned char)*c < 0x20)
+			*c = '_';
+	}
+
+	out << "{" << endl;
+	out << "  \"host\": \"" << host << "\"," << endl;
+	out << "  \"threads\": " << nThreads << "," << endl;
+	out << "  \"simd\": \"" << simdLevel << "\"," << endl;
+	out << "  \"encoder\": \"" << encoder << "\"," << endl;
+	out << "  \"wallSeconds\": " << wallSeconds << "," << endl;
+	out << "  \"cpuSeconds\": " << cpuSeconds << "," << endl;
+	out << "  \"conversions\": " << nConversions << "," << endl;
+	out << "  \"bytesRead\": " << bytesRead << "," << endl;
+	out << "  \"bytesWritten\": " << bytesWritten << "," << endl;
+
+	// thread seconds and CPU seconds of every stage, summed over the threads
+	out << "  \"stages\": {" << endl;
+	for (int stage = 0; stage < STAGE_COUNT; ++stage)
+	{
+		out << "    \"" << stageNames[stage] << "\": { \"wallSeconds\": " << stages[stage].wallNs / nsPerSecond <<
+			", \"cpuSeconds\": " << stages[stage].cpuNs / nsPerSecond << ", \"intervals\": " << stages[stage].nIntervals << " }" <<
+			(stage + 1 < STAGE_COUNT ? "," : "") << endl;
+	}
+	out << "  }," << endl;
+
+	// blocks per second of the whole run, and per thread second of the encode/decode stages
+	out << "  \"blocks\": {" << endl;
+	out << "    \"encoded\": " << blocksEncoded << "," << endl;
+	out << "    \"decoded\": " << blocksDecoded << "," << endl;
+	out << "    \"blocksPerSecond\": " << (wallSeconds > 0 ? (blocksEncoded + blocksDecoded) / wallSeconds : 0) << "," << endl;
+	out << "    \"encodedPerThreadSecond\": " << (encodeSeconds > 0 ? blocksEncoded / encodeSeconds : 0) << "," << endl;
+	out << "    \"decodedPerThreadSecond\": " << (decodeSeconds > 0 ? blocksDecoded / decodeSeconds : 0) << "," << endl;
+	out << "    \"classes\": { \"solid\": " << blockClasses[BLOCK_SOLID] << ", \"twoColor\": " << blockClasses[BLOCK_TWO_COLOR] <<
+		", \"lowVariance\": " << blockClasses[BLOCK_LOW_VARIANCE] << ", \"general\": " << blockClasses[BLOCK_GENERAL] << " }" << endl;
+	out << "  }," << endl;
+
+	// slot 0: the threads outside the pool (main thread, pipeline read/write threads, server connections)
+	int nSlots = nThreads < PROFILE_MAX_THREADS ? nThreads : PROFILE_MAX_THREADS;
+	out << "  \"threadBusySeconds\": [";
+	for (int slot = 0; slot < nSlots; ++slot)
+		out << (slot ? ", " : "") << threadBusyNs[slot] / nsPerSecond;
+	out << "]" << endl;
+	out << "}" << endl;
+}
@@ -0,0 +1,168 @@
+/**
+Profiler.h
+Purpose: Per stage timing and counters of the conversions (header parse, read, gather, encode, downsample, write,
+decode), written as JSON. Every stage interval adds its wall time and the CPU time of its thread, so a stage waiting
+on the disk shows a wall time above its CPU time. Stage times are summed over the threads running them (thread
+seconds), the busy time of each thread is the sum of the stage intervals it ran.
+With memory mapped files, the pages not prefetched by the read stage are faulted in by the gather (pixels) and
+decode (blocks) stages.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include "bmp_dxt1_headers.h"
+#include "BlockClassifier.h"
+
+using namespace std;
+
+// threads whose busy time is kept apart: the pool workers (by slot), the other threads share slot 0
+#define PROFILE_MAX_THREADS	256
+
+enum ProfileStage
+{
+	STAGE_HEADER = 0,	// opening the input and checking its header
+	STAGE_READ,			// reading (or prefetching the pages of) the input
+	STAGE_GATHER,		// converting the scanlines to the 16 colors of the blocks
+	STAGE_ENCODE,		// block encoders (and cache, rate-distortion optimization, error metrics)
+	STAGE_DOWNSAMPLE,	// filtering the next mip level
+	STAGE_WRITE,		// writing (or flushing the pages of) the output
+	STAGE_DECODE,		// block decoder
+	STAGE_COUNT
+};
+
+class Profiler
+{
+private:
+	// sums over all the intervals of a stage, in nanoseconds
+	struct StageTimes
+	{
+		atomic<long long> wallNs;
+		atomic<long long> cpuNs;
+		atomic<long long> nIntervals;
+	};
+
+	StageTimes stages[STAGE_COUNT];
+
+	// stage time of every thread slot (see ThreadPool::currentSlot)
+	atomic<long long> threadBusyNs[PROFILE_MAX_THREADS];
+
+	// files converted, blocks encoded (by class) and decoded, bytes read from the inputs and written to the outputs
+	atomic<long long> nConversions;
+	atomic<long long> blockClasses[BLOCK_CLASS_COUNT];
+	atomic<long long> blocksDecoded;
+	atomic<long long> bytesRead;
+	atomic<long long> bytesWritten;
+
+	// when the profiler was created
+	long long startWallNs;
+	long long startCpuNs;
+
+public:
+	Profiler();
+
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	/**
+	Monotonic wall clock, CPU time of the calling thread and of the process, in nanoseconds
+	*/
+	static long long wallNow();
+	static long long threadCpuNow();
+	static long long processCpuNow();
+
+	/**
+	Add an interval of a stage run by the calling thread
+
+	@param stage the stage
+	@param wallNs wall time of the interval
+	@param cpuNs CPU time of the calling thread during the interval
+	*/
+	void addInterval(const ProfileStage stage, const long long wallNs, const long long cpuNs);
+
+	/**
+	Count encoded blocks by class (see BlockClassifier)
+
+	@param blockColors source colors, 16 consecutive colors per block
+	@param nBlocks number of blocks
+	*/
+	void countEncodedBlocks(const RGBTriplet* blockColors, const int nBlocks);
+
+	void countDecodedBlocks(const long long nBlocks) { blocksDecoded += nBlocks; }
+	void countConversion() { ++nConversions; }
+	void countBytesRead(const long long nBytes) { bytesRead += nBytes; }
+	void countBytesWritten(const long long nBytes) { bytesWritten += nBytes; }
+
+	/**
+	Write the stage times and counters since the profiler was created as a JSON object
+
+	@param out target stream
+	@param nThreads threads of the compressor pool (slots listed in the per thread busy times)
+	@param simdLevel name of the SIMD level of the encoder
+	@param encoder name of the encoder tier
+	*/
+	void writeJson(ostream& out, const int nThreads, const char* simdLevel, const char* encoder) const;
+};
+
+/**
+Times the stages run one after the other by the calling thread: each interval ends when the next stage starts
+or the timer is destroyed. Does nothing without a profiler.
+*/
+class StageTimer
+{
+private:
+	Profiler* profiler;
+	ProfileStage stage;
+	long long startWallNs;
+	long long startCpuNs;
+
+public:
+	/**
+	@param profiler the profiler, null to time nothing
+	@param stage first stage
+	*/
+	StageTimer(Profiler* profiler, const ProfileStage stage) : profiler(profiler), stage(stage)
+	{
+		if (profiler)
+		{
+			startWallNs = Profiler::wallNow();
+			startCpuNs = Profiler::threadCpuNow();
+		}
+	}
+
+	~StageTimer() { stop(); }
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+	/**
+	End the current stage interval and start one of the next stage
+	*/
+	void next(const ProfileStage nextStage)
+	{
+		if (!profiler)
+			return;
+
+		long long wallNs = Profiler::wallNow(), cpuNs = Profiler::threadCpuNow();
+		profiler->addInterval(stage, wallNs - startWallNs, cpuNs - startCpuNs);
+		stage = nextStage;
+		startWallNs = wallNs;
+		startCpuNs = cpuNs;
+	}
+
+	/**
+	End the current stage interval, nothing more is timed
+	*/
+	void stop()
+	{
+		if (!profiler)
+			return;
+
+		profiler->addInterval(stage, Profiler::wallNow() - startWallNs, Profiler::threadCpuNow() - startCpuNs);
+		profiler = 0;
+	}
+};
@@ -2,14 +2,39 @@
 RangeEncoder.cpp
 Purpose: Implementation of a color range fit algorithm for choosing c0 and c1 in a DX1 compressed block.
 The idea is to calculate the principal axis in the block color space (using principal component analysis "PCA")
-and choose the min and max points on the principal axis as c0 and c1. Implementation is not complete yet
+and choose the min and max points on the principal axis as c0 and c1. Pixel indices are chosen by projecting
+the pixels on the line between the decoded c0 and c1.
 
 @author Mahmoud Badri (mhdside@hotmail.com)
 @version 1.2 12/02/2017
 */
 
+#include <algorithm>
+#include <cmath>
 #include "RangeEncoder.h"
 
+using namespace std;
+
+// number of power iterations, the axis converges long before for 16 colors
+#define POWER_ITERATIONS 8
+
+// quantize a color in [0, 255] to RGB565 (rounded to the nearest representable color)
+inline unsigned short toRGB565(const VecRGB& c)
+{
+	int r = (int)(min(max(c.r, 0.0f), 255.0f) * (31.0f / 255.0f) + 0.5f);
+	int g = (int)(min(max(c.g, 0.0f), 255.0f) * (63.0f / 255.0f) + 0.5f);
+	int b = (int)(min(max(c.b, 0.0f), 255.0f) * (31.0f / 255.0f) + 0.5f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+// expand a RGB565 color exactly as the decoder does
+inline VecRGB fromRGB565(const unsigned short c)
+{
+	return VecRGB((float)(((((c >> 11) & 0x1F) * 527) + 23) >> 6),
+		(float)(((((c >> 5) & 0x3F) * 259) + 33) >> 6),
+		(float)((((c & 0x1F) * 527) + 23) >> 6));
+}
+
 RangeEncoder::RangeEncoder()
 {
 }
@@ -19,19 +44,11 @@ RangeEncoder::~RangeEncoder()
 {
 }
 
-void RangeEncoder::getCovariance(const VecRGB* blockColors, float* coverianceMat)
+void RangeEncoder::getCovariance(const VecRGB* blockColors, const VecRGB& meanColor, float* coverianceMat) const
 {
-	// calculate the mean color
-	VecRGB meanColor;
-	for (int i = 0; i < 16; ++i)
-	{
-		meanColor += blockColors[i];
-	}
-	
-	meanColor.r /= 16;
-	meanColor.g /= 16;
-	meanColor.b /= 16;
-	
+	for (int i = 0; i < 9; ++i)
+		coverianceMat[i] = 0;
+
 	// calculate the covariance matrix
 	for (int i = 0; i < 16; ++i)
 	{
@@ -40,26 +57,100 @@ void RangeEncoder::getCovariance(const VecRGB* blockColors, float* coverianceMat
 		coverianceMat[0] += a.r*a.r;
 		coverianceMat[1] += a.r*a.g;
 		coverianceMat[2] += a.r*a.b;
-		coverianceMat[5] += a.g*a.g;
-		coverianceMat[6] += a.g*a.b;
-		coverianceMat[9] += a.b*a.b;
+		coverianceMat[4] += a.g*a.g;
+		coverianceMat[5] += a.g*a.b;
+		coverianceMat[8] += a.b*a.b;
 	}
 
 	// from symmetry
-	coverianceMat[4] = coverianceMat[1];
-	coverianceMat[7] = coverianceMat[2];
-	coverianceMat[8] = coverianceMat[5];
+	coverianceMat[3] = coverianceMat[1];
+	coverianceMat[6] = coverianceMat[2];
+	coverianceMat[7] = coverianceMat[5];
 }
 
-void RangeEncoder::calctPrincipleAxis(const VecRGB* blockColors, VecRGB* outputColors)
+VecRGB RangeEncoder::calctPrincipleAxis(const VecRGB* blockColors, const VecRGB& meanColor) const
 {
 	// calculate coveriance
 	float coverianceMat[9]; // symmetric 3x3 mat
-	getCovariance(blockColors, coverianceMat);
-
-	/* TODOs:
-		1. calculate eigenvalues and eigenvectors (preferably using a vector math lib.)
-		2. sort them and take the largest (principal axis)
-		3. take the max and min point on the princial axies as c0 and c1
-	*/
-}
\ No newline at end of file
+	getCovariance(blockColors, meanColor, coverianceMat);
+
+	// start from the matrix row with the largest variance, it is never orthogonal to the principal axis
+	// unless the matrix is 0 (then all colors are the same)
+	VecRGB axis(coverianceMat[0], coverianceMat[1], coverianceMat[2]);
+	if (coverianceMat[4] > axis.r && coverianceMat[4] >= coverianceMat[8])
+		axis = VecRGB(coverianceMat[3], coverianceMat[4], coverianceMat[5]);
+	else if (coverianceMat[8] > axis.r && coverianceMat[8] > coverianceMat[4])
+		axis = VecRGB(coverianceMat[6], coverianceMat[7], coverianceMat[8]);
+
+	for (int i = 0; i < POWER_ITERATIONS; ++i)
+	{
+		VecRGB next(axis.dot(VecRGB(coverianceMat[0], coverianceMat[1], coverianceMat[2])),
+			axis.dot(VecRGB(coverianceMat[3], coverianceMat[4], coverianceMat[5])),
+			axis.dot(VecRGB(coverianceMat[6], coverianceMat[7], coverianceMat[8])));
+
+		// normalize by the largest component, keeps the values in range without a square root
+		float norm = max(fabs(next.r), max(fabs(next.g), fabs(next.b)));
+		if (norm < 1e-6f)
+			return VecRGB(0, 0, 0);
+
+		axis = next * (1.0f / norm);
+	}
+
+	float length = sqrt(axis.dot(axis));
+	return length > 0 ? axis * (1.0f / length) : VecRGB(0, 0, 0);
+}
+
+void RangeEncoder::compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& block) const
+{
+	VecRGB colors[16];
+	VecRGB meanColor(0, 0, 0);
+	for (int i = 0; i < 16; ++i)
+	{
+		colors[i] = VecRGB(blockColors[i].r, blockColors[i].g, blockColors[i].b);
+		meanColor += colors[i];
+	}
+	meanColor = meanColor * (1.0f / 16);
+
+	// c0 and c1 are the pixels extremes along the principal axis
+	VecRGB axis = calctPrincipleAxis(colors, meanColor);
+	float minProj = 0, maxProj = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		float proj = (colors[i] - meanColor).dot(axis);
+		minProj = min(minProj, proj);
+		maxProj = max(maxProj, proj);
+	}
+
+	unsigned short c0 = toRGB565(meanColor + axis * maxProj);
+	unsigned short c1 = toRGB565(meanColor + axis * minProj);
+
+	block.indices[0] = block.indices[1] = block.indices[2] = block.indices[3] = 0;
+
+	if (c0 == c1) // 1 color in the block, all pixels take c0 color (index 0)
+	{
+		block.c0 = c0;
+		block.c1 = c1;
+		return;
+	}
+
+	// make sure c0 is bigger than c1 (4 color block)
+	if (c0 < c1)
+		swap(c0, c1);
+
+	block.c0 = c0;
+	block.c1 = c1;
+
+	// project the pixels on the decoded c0 -> c1 line, the projection in [0, 1] maps to
+	// c0 (0), c2 (1/3), c3 (2/3) and c1 (1)
+	VecRGB decoded0 = fromRGB565(c0);
+	VecRGB dir = fromRGB565(c1) - decoded0;
+	float scale = 3.0f / dir.dot(dir);
+	static const int stepToIndex[4] = { 0, 2, 3, 1 };
+
+	for (int i = 0; i < 16; ++i)
+	{
+		int step = (int)((colors[i] - decoded0).dot(dir) * scale + 0.5f);
+		step = min(max(step, 0), 3);
+		block.indices[i / 4] |= stepToIndex[step] << (i % 4) * 2;
+	}
+}
@@ -2,7 +2,10 @@
 RangeEncoder.h
 Purpose: Implementation of a color range fit algorithm for choosing c0 and c1 in a DX1 compressed block.
 The idea is to calculate the principal axis in the block color space (using principal component analysis "PCA")
-and choose the min and max points on the principal axis as c0 and c1. Implementation is not complete yet
+and choose the min and max points on the principal axis as c0 and c1. Pixel indices are chosen by projecting
+the pixels on the line between the decoded c0 and c1.
+The encoder is scalar and several times slower than the SIMD intensity kernels (TIER_INTENSITY): it trades speed
+for quality.
 
 @author Mahmoud Badri (mhdside@hotmail.com)
 @version 1.2 12/02/2017
@@ -32,6 +35,11 @@ struct VecRGB
 		return VecRGB(r - v.r, g - v.g, b - v.b);
 	}
 
+	VecRGB operator * (const float num) const
+	{
+		return VecRGB(r * num, g * num, b * num);
+	}
+
 	void operator += (const VecRGB& v)
 	{
 		r += v.r;
@@ -67,19 +75,30 @@ private:
 	principal component analysis calculations.
 
 	@param blockColors array of pixels colors
+	@param meanColor mean of the pixels colors
 	@param coverianceMat output 3x3 symmetric convariance mattrix (TODO: create a matrix class?)
 	*/
-	void getCovariance(const VecRGB* blockColors, float* coverianceMat);
+	void getCovariance(const VecRGB* blockColors, const VecRGB& meanColor, float* coverianceMat) const;
+
+	/**
+	Calculate the principal axis using principal component analysis. The eigenvector of the largest
+	eigenvalue of the covariance matrix is found by power iteration.
+
+	@param blockColors array of pixels colors
+	@param meanColor mean of the pixels colors
+	@return normalized principal axis, (0, 0, 0) if all the colors are the same
+	*/
+	VecRGB calctPrincipleAxis(const VecRGB* blockColors, const VecRGB& meanColor) const;
+
 public:
 	RangeEncoder();
 	~RangeEncoder();
-	
+
 	/**
-	Calculate the principal axis using principal component analysis.
+	Compress 16 pixel colors into 1 DXT1 block using range fit
 
-	@param blockColors array of pixels colors
-	@param outputColors output array of the 4 chosen compressed block colors)
+	@param blockColors source 16 pixel colors to compress
+	@param block target block where the 2 colors and indices will be saved
 	*/
-	void calctPrincipleAxis(const VecRGB* blockColors, VecRGB* outputColors);
+	void compressDxt1Block(const RGBTriplet* blockColors, Dxt1Block& block) const;
 };
-
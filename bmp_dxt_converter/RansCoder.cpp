@@ -0,0 +1,212 @@
+/**
+RansCoder.cpp
+Purpose: Self-contained entropy coder for byte streams (static order-0 rANS, 4 interleaved states)
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <string.h>
+#include "RansCoder.h"
+
+void RansCoder::normalize(const unsigned int* counts, const size_t nSymbols, unsigned short* freqs)
+{
+	int sum = 0;
+	for (int s = 0; s < 256; ++s)
+	{
+		int freq = (int)((unsigned long long)counts[s] * RANS_PROB_TOTAL / nSymbols);
+		if (counts[s] && freq == 0)
+			freq = 1;
+
+		freqs[s] = (unsigned short)freq;
+		sum += freq;
+	}
+
+	// the rounding error goes to the most frequent symbols, where it costs the least
+	while (sum != RANS_PROB_TOTAL)
+	{
+		int best = -1;
+		for (int s = 0; s < 256; ++s)
+		{
+			if ((sum > RANS_PROB_TOTAL ? freqs[s] > 1 : freqs[s] > 0) && (best < 0 || freqs[s] > freqs[best]))
+				best = s;
+		}
+
+		if (sum > RANS_PROB_TOTAL)
+		{
+			--freqs[best];
+			--sum;
+		}
+		else
+		{
+			++freqs[best];
+			++sum;
+		}
+	}
+}
+
+// code a symbol, the 16bit words are written backwards from ptr
+static inline void encodeSymbol(unsigned int& state, byte*& ptr, const unsigned int freq, const unsigned int start)
+{
+	// 2^32 for a symbol taking the whole total (the only symbol of its stream)
+	unsigned long long stateMax = (unsigned long long)((RANS_STATE_LOW >> RANS_PROB_BITS) << 16) * freq;
+	if (state >= stateMax)
+	{
+		ptr -= 2;
+		ptr[0] = (byte)state;
+		ptr[1] = (byte)(state >> 8);
+		state >>= 16;
+	}
+	state = ((state / freq) << RANS_PROB_BITS) + state % freq + start;
+}
+
+size_t RansCoder::encode(const byte* symbols, const size_t nSymbols, byte* coded)
+{
+	unsigned int counts[256] = { 0 };
+	for (size_t i = 0; i < nSymbols; ++i)
+		++counts[symbols[i]];
+
+	unsigned short freqs[256];
+	unsigned int starts[256];
+	normalize(counts, nSymbols, freqs);
+	for (int s = 0, start = 0; s < 256; start += freqs[s++])
+		starts[s] = start;
+	memcpy(coded, freqs, RANS_TABLE_BYTES);
+
+	// rANS decodes in the reverse order: code the stream from its end, filling the buffer from its end.
+	// Symbol i goes to state i % RANS_STATES.
+	byte* end = coded + maxEncodedSize(nSymbols);
+	byte* ptr = end;
+	unsigned int states[RANS_STATES];
+	for (int k = 0; k < RANS_STATES; ++k)
+		states[k] = RANS_STATE_LOW;
+
+	size_t nGroups = nSymbols / RANS_STATES;
+	for (size_t i = nSymbols; i > nGroups * RANS_STATES; --i)
+		encodeSymbol(states[(i - 1) % RANS_STATES], ptr, freqs[symbols[i - 1]], starts[symbols[i - 1]]);
+	for (size_t i = nGroups * RANS_STATES; i > 0; i -= RANS_STATES)
+	{
+		encodeSymbol(states[3], ptr, freqs[symbols[i - 1]], starts[symbols[i - 1]]);
+		encodeSymbol(states[2], ptr, freqs[symbols[i - 2]], starts[symbols[i - 2]]);
+		encodeSymbol(states[1], ptr, freqs[symbols[i - 3]], starts[symbols[i - 3]]);
+		encodeSymbol(states[0], ptr, freqs[symbols[i - 4]], starts[symbols[i - 4]]);
+	}
+
+	// the final states, read first by the decoder
+	ptr -= sizeof(states);
+	memcpy(ptr, states, sizeof(states));
+
+	size_t size = end - ptr;
+	memmove(coded + RANS_TABLE_BYTES, ptr, size);
+	return RANS_TABLE_BYTES + size;
+}
+
+// decode a symbol: slot step (see decode()) applied to the state
+static inline void decodeSymbol(unsigned int& state, const unsigned int step)
+{
+	state = (step & 0xFFFF) * (state >> RANS_PROB_BITS) + (step >> 16);
+}
+
+// read a 16bit word into a state below the normalized range
+static inline void renormalize(unsigned int& state, const byte*& ptr)
+{
+	if (state < RANS_STATE_LOW)
+	{
+		state = state << 16 | ptr[0] | ptr[1] << 8;
+		ptr += 2;
+	}
+}
+
+// renormalize() near the end of the coded bytes
+static inline void renormalizeChecked(unsigned int& state, const byte*& ptr, const byte* end)
+{
+	if (end - ptr >= 2)
+		renormalize(state, ptr);
+}
+
+bool RansCoder::decode(const byte* coded, const size_t codedSize, byte* symbols, const size_t nSymbols)
+{
+	unsigned int states[RANS_STATES];
+	if (codedSize < RANS_TABLE_BYTES + sizeof(states))
+		return false;
+
+	unsigned short freqs[256];
+	memcpy(freqs, coded, RANS_TABLE_BYTES);
+
+	// slotSymbols: symbol of every unit of the total, slotSteps: frequency (low 16 bits) and offset from the symbol start
+	// (high 16 bits) of every unit, a decoding step is a single lookup
+	byte slotSymbols[RANS_PROB_TOTAL];
+	unsigned int slotSteps[RANS_PROB_TOTAL];
+	int start = 0;
+	for (int s = 0; s < 256; ++s)
+	{
+		if (freqs[s] > RANS_PROB_TOTAL - start)
+			return false;
+
+		memset(slotSymbols + start, s, freqs[s]);
+		for (int i = 0; i < freqs[s]; ++i)
+			slotSteps[start + i] = freqs[s] | (unsigned int)i << 16;
+		start += freqs[s];
+	}
+
+	if (start != RANS_PROB_TOTAL)
+		return false;
+
+	const byte* ptr = coded + RANS_TABLE_BYTES;
+	const byte* end = coded + codedSize;
+	memcpy(states, ptr, sizeof(states));
+	ptr += sizeof(states);
+
+	// independent states in separate variables, the groups decode as RANS_STATES parallel dependency chains
+	unsigned int state0 = states[0], state1 = states[1], state2 = states[2], state3 = states[3];
+	const unsigned int mask = RANS_PROB_TOTAL - 1;
+	size_t nGroups = nSymbols / RANS_STATES;
+	for (size_t i = 0; i < nGroups; ++i)
+	{
+		byte* group = symbols + i * RANS_STATES;
+		group[0] = slotSymbols[state0 & mask];
+		group[1] = slotSymbols[state1 & mask];
+		group[2] = slotSymbols[state2 & mask];
+		group[3] = slotSymbols[state3 & mask];
+		decodeSymbol(state0, slotSteps[state0 & mask]);
+		decodeSymbol(state1, slotSteps[state1 & mask]);
+		decodeSymbol(state2, slotSteps[state2 & mask]);
+		decodeSymbol(state3, slotSteps[state3 & mask]);
+
+		// a state reads at most one 16bit word per symbol, a corrupt stream stops reading at its end
+		if (end - ptr < 2 * RANS_STATES)
+		{
+			renormalizeChecked(state0, ptr, end);
+			renormalizeChecked(state1, ptr, end);
+			renormalizeChecked(state2, ptr, end);
+			renormalizeChecked(state3, ptr, end);
+			continue;
+		}
+
+		renormalize(state0, ptr);
+		renormalize(state1, ptr);
+		renormalize(state2, ptr);
+		renormalize(state3, ptr);
+	}
+
+	// the last symbols are the final ones of their states, no renormalization
+	states[0] = state0;
+	states[1] = state1;
+	states[2] = state2;
+	states[3] = state3;
+	for (size_t i = nGroups * RANS_STATES; i < nSymbols; ++i)
+	{
+		unsigned int& state = states[i % RANS_STATES];
+		symbols[i] = slotSymbols[state & mask];
+		decodeSymbol(state, slotSteps[state & mask]);
+	}
+
+	// a valid stream ends with all its bytes read and the states back to their initial value
+	for (int k = 0; k < RANS_STATES; ++k)
+	{
+		if (states[k] != RANS_STATE_LOW)
+			return false;
+	}
+
+	return ptr == end;
+}
@@ -0,0 +1,71 @@
+/**
+RansCoder.h
+Purpose: Self-contained entropy coder for byte streams: static order-0 range asymmetric numeral system (rANS)
+with 4 interleaved states, so the decoder works on 4 independent dependency chains. The symbol frequencies,
+normalized to RANS_PROB_TOTAL, are saved in front of the coded bytes.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include "bmp_dxt1_headers.h"
+
+using namespace std;
+
+// symbol frequencies sum up to 2^RANS_PROB_BITS (the decoder slot table has one byte per unit)
+#define RANS_PROB_BITS		12
+#define RANS_PROB_TOTAL		(1 << RANS_PROB_BITS)
+
+// lower bound of the normalized states, the states are renormalized 16 bits at a time: at most once per symbol
+#define RANS_STATE_LOW		(1u << 16)
+
+// interleaved states: symbol i is coded by state i % RANS_STATES, the decoder works on independent dependency chains
+#define RANS_STATES			4
+
+// bytes of the frequency table saved in front of the coded bytes (256 16bit frequencies)
+#define RANS_TABLE_BYTES	512
+
+class RansCoder
+{
+private:
+	/**
+	Scale the symbol counts of a stream to frequencies summing to RANS_PROB_TOTAL, symbols present keep a frequency of at least 1
+
+	@param counts occurrences of each byte value
+	@param nSymbols length of the stream (sum of the counts), not 0
+	@param freqs target frequencies
+	*/
+	static void normalize(const unsigned int* counts, const size_t nSymbols, unsigned short* freqs);
+
+public:
+	/**
+	Largest coded size of a stream, the size of the buffer given to encode()
+
+	@param nSymbols length of the stream
+	*/
+	static size_t maxEncodedSize(const size_t nSymbols) { return RANS_TABLE_BYTES + RANS_STATES * 4 + nSymbols * 2; }
+
+	/**
+	Code a stream
+
+	@param symbols the stream
+	@param nSymbols length of the stream, not 0
+	@param coded target buffer of maxEncodedSize(nSymbols) bytes
+	@return size of the coded stream (frequency table included)
+	*/
+	static size_t encode(const byte* symbols, const size_t nSymbols, byte* coded);
+
+	/**
+	Decode a stream coded by encode()
+
+	@param coded the coded stream
+	@param codedSize size of the coded stream
+	@param symbols target stream
+	@param nSymbols length of the stream
+	@return false if the coded stream is corrupt (bad frequency table, or its bytes and the decoded length don't match)
+	*/
+	static bool decode(const byte* coded, const size_t codedSize, byte* symbols, const size_t nSymbols);
+};
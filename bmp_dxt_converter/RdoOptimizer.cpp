@@ -0,0 +1,282 @@
+/**
+RdoOptimizer.cpp
+Purpose: Rate-distortion optimization of the compressed blocks for the LZ compression of the DDS files
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include <string.h>
+#include "RdoOptimizer.h"
+#include "SimdDecoder.h"
+
+// the 4 bytes of the end points (c0, c1) and of the indices of a block
+static inline unsigned int endpointsOf(const Dxt1Block& block)
+{
+	return block.c0 | (unsigned int)block.c1 << 16;
+}
+
+static inline unsigned int indicesOf(const Dxt1Block& block)
+{
+	unsigned int indices;
+	memcpy(&indices, block.indices, 4);
+	return indices;
+}
+
+// blocks with c0 <= c1 are decoded in the 3 color mode (c3 is transparent black): the encoders only make them for
+// solid blocks (c0 == c1, all indices 0), the only indices such end points may take
+static inline bool validBlock(const Dxt1Block& block)
+{
+	return block.c0 > block.c1 || indicesOf(block) == 0;
+}
+
+void RdoOptimizer::init(const int lambda)
+{
+	this->lambda = lambda;
+	nWindow = 0;
+	windowNext = 0;
+	stats = RdoStats();
+}
+
+bool RdoOptimizer::hasEndpoints(const Dxt1Block& block) const
+{
+	unsigned int endpoints = endpointsOf(block);
+	for (int i = 0; i < nWindow; ++i)
+	{
+		if (endpointsOf(window[i]) == endpoints)
+			return true;
+	}
+	return false;
+}
+
+bool RdoOptimizer::hasIndices(const Dxt1Block& block) const
+{
+	unsigned int indices = indicesOf(block);
+	for (int i = 0; i < nWindow; ++i)
+	{
+		if (indicesOf(window[i]) == indices)
+			return true;
+	}
+	return false;
+}
+
+int RdoOptimizer::blockBits(const Dxt1Block& block) const
+{
+	unsigned int endpoints = endpointsOf(block), indices = indicesOf(block);
+	bool sameEndpoints = false, sameIndices = false;
+	for (int i = 0; i < nWindow; ++i)
+	{
+		bool endpointsMatch = endpointsOf(window[i]) == endpoints, indicesMatch = indicesOf(window[i]) == indices;
+		if (endpointsMatch && indicesMatch)
+			return RDO_MATCH_BITS;
+
+		sameEndpoints |= endpointsMatch;
+		sameIndices |= indicesMatch;
+	}
+
+	return (sameEndpoints ? RDO_MATCH_BITS : RDO_LITERAL_BITS) + (sameIndices ? RDO_MATCH_BITS : RDO_LITERAL_BITS);
+}
+
+void RdoOptimizer::pushWindow(const Dxt1Block& block)
+{
+	unsigned int endpoints = endpointsOf(block), indices = indicesOf(block);
+	for (int i = 0; i < nWindow; ++i)
+	{
+		if (endpointsOf(window[i]) == endpoints && indicesOf(window[i]) == indices)
+			return;
+	}
+
+	window[windowNext] = block;
+	expandPalette(block, palettes[windowNext]);
+	windowNext = (windowNext + 1) % RDO_WINDOW_BLOCKS;
+	if (nWindow < RDO_WINDOW_BLOCKS)
+		++nWindow;
+}
+
+void RdoOptimizer::expandPalette(const Dxt1Block& block, Palette& palette)
+{
+	// same integer math as ErrorMetrics::blockError and the decoder (4 color mode)
+	palette.r[0] = expand5To8[block.c0 >> 11];
+	palette.g[0] = expand6To8[(block.c0 >> 5) & 0x3F];
+	palette.b[0] = expand5To8[block.c0 & 0x1F];
+	palette.r[1] = expand5To8[block.c1 >> 11];
+	palette.g[1] = expand6To8[(block.c1 >> 5) & 0x3F];
+	palette.b[1] = expand5To8[block.c1 & 0x1F];
+	if (block.c0 > block.c1)
+	{
+		palette.r[2] = (2 * palette.r[0] + palette.r[1]) / 3;
+		palette.g[2] = (2 * palette.g[0] + palette.g[1]) / 3;
+		palette.b[2] = (2 * palette.b[0] + palette.b[1]) / 3;
+		palette.r[3] = (palette.r[0] + 2 * palette.r[1]) / 3;
+		palette.g[3] = (palette.g[0] + 2 * palette.g[1]) / 3;
+		palette.b[3] = (palette.b[0] + 2 * palette.b[1]) / 3;
+	}
+	else
+	{
+		// 3 color mode, as the decoders of the DDS readers: c2 = (c0 + c1) / 2, c3 is black
+		palette.r[2] = (palette.r[0] + palette.r[1]) / 2;
+		palette.g[2] = (palette.g[0] + palette.g[1]) / 2;
+		palette.b[2] = (palette.b[0] + palette.b[1]) / 2;
+		palette.r[3] = palette.g[3] = palette.b[3] = 0;
+	}
+
+	// c2 and c3 are between c0 and c1 (and black in the 3 color mode)
+	palette.low[0] = block.c0 > block.c1 ? min(palette.r[0], palette.r[1]) : 0;
+	palette.low[1] = block.c0 > block.c1 ? min(palette.g[0], palette.g[1]) : 0;
+	palette.low[2] = block.c0 > block.c1 ? min(palette.b[0], palette.b[1]) : 0;
+	palette.high[0] = max(palette.r[0], palette.r[1]);
+	palette.high[1] = max(palette.g[0], palette.g[1]);
+	palette.high[2] = max(palette.b[0], palette.b[1]);
+}
+
+void RdoOptimizer::splitColors(const RGBTriplet* blockColors, BlockChannels& channels)
+{
+	channels.low[0] = channels.low[1] = channels.low[2] = 255;
+	channels.high[0] = channels.high[1] = channels.high[2] = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		channels.r[i] = blockColors[i].r;
+		channels.g[i] = blockColors[i].g;
+		channels.b[i] = blockColors[i].b;
+		channels.low[0] = min(channels.low[0], channels.r[i]);
+		channels.low[1] = min(channels.low[1], channels.g[i]);
+		channels.low[2] = min(channels.low[2], channels.b[i]);
+		channels.high[0] = max(channels.high[0], channels.r[i]);
+		channels.high[1] = max(channels.high[1], channels.g[i]);
+		channels.high[2] = max(channels.high[2], channels.b[i]);
+	}
+}
+
+unsigned int RdoOptimizer::errorBound(const BlockChannels& channels, const Palette& palette)
+{
+	unsigned int pixelBound = 0;
+	for (int c = 0; c < 3; ++c)
+	{
+		int gap = max(0, max(channels.low[c] - palette.high[c], palette.low[c] - channels.high[c]));
+		pixelBound += gap * gap;
+	}
+	return pixelBound * 16;
+}
+
+unsigned int RdoOptimizer::paletteErrors(const BlockChannels& channels, const Palette& palette, const byte* indices, byte* fitIndices,
+	unsigned int& fitError)
+{
+	unsigned int blockError = 0;
+	fitError = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		unsigned int distances[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			int dr = channels.r[i] - palette.r[j], dg = channels.g[i] - palette.g[j], db = channels.b[i] - palette.b[j];
+			distances[j] = dr * dr + dg * dg + db * db;
+		}
+		blockError += distances[(indices[i / 4] >> (i % 4) * 2) & 0x3];
+
+		if (fitIndices)
+		{
+			int bestIndex = 0;
+			for (int j = 1; j < 4; ++j)
+				bestIndex = distances[j] < distances[bestIndex] ? j : bestIndex;
+
+			if (i % 4 == 0)
+				fitIndices[i / 4] = 0;
+			fitIndices[i / 4] |= bestIndex << (i % 4) * 2;
+			fitError += distances[bestIndex];
+		}
+	}
+
+	return blockError;
+}
+
+void RdoOptimizer::optimizeBlocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks)
+{
+	for (int i = 0; i < nBlocks; ++i)
+	{
+		if (i % RDO_SEGMENT_BLOCKS == 0)
+			nWindow = windowNext = 0;
+
+		BlockChannels channels;
+		splitColors(blockColors + i * 16, channels);
+		const Dxt1Block base = blocks[i];
+		Palette basePalette;
+		expandPalette(base, basePalette);
+		unsigned int fitError;
+		unsigned int blockBaseError = paletteErrors(channels, basePalette, base.indices, 0, fitError);
+		int blockBaseBits = blockBits(base);
+
+		Dxt1Block best = base;
+		unsigned int bestError = blockBaseError;
+		int bestBits = blockBaseBits;
+		long long bestCost = blockBaseError + (long long)lambda * blockBaseBits;
+
+		// the block end points with indices from the window cost a match, and a literal unless the window has them
+		// (3 color end points keep their indices)
+		bool takesIndices = base.c0 > base.c1;
+		int indicesCandidateBits = (hasEndpoints(base) ? RDO_MATCH_BITS : RDO_LITERAL_BITS) + RDO_MATCH_BITS;
+
+		for (int w = 0; w < nWindow; ++w)
+		{
+			// nothing costs less than a whole block match without error
+			if (bestCost <= (long long)lambda * RDO_MATCH_BITS)
+				break;
+
+			// the window block indices with the block end points
+			if (takesIndices && endpointsOf(base) != endpointsOf(window[w]) && bestCost > (long long)lambda * indicesCandidateBits)
+			{
+				unsigned int candidateError = paletteErrors(channels, basePalette, window[w].indices, 0, fitError);
+				long long cost = candidateError + (long long)lambda * indicesCandidateBits;
+				if (cost < bestCost)
+				{
+					best = base;
+					memcpy(best.indices, window[w].indices, 4);
+					bestError = candidateError;
+					bestBits = indicesCandidateBits;
+					bestCost = cost;
+				}
+			}
+
+			// the window block palette can't do better than its bound, with at least a match
+			if (errorBound(channels, palettes[w]) + (long long)lambda * RDO_MATCH_BITS >= bestCost)
+				continue;
+
+			// the whole window block, and its end points with the closest indices (the same indices make it the
+			// whole block, other indices cost at least 2 matches)
+			Dxt1Block candidate = window[w];
+			bool fitEndpoints = bestCost > (long long)lambda * RDO_MATCH_BITS * 2;
+			unsigned int candidateError = paletteErrors(channels, palettes[w], window[w].indices, fitEndpoints ? candidate.indices : 0, fitError);
+			long long cost = candidateError + (long long)lambda * RDO_MATCH_BITS;
+			if (cost < bestCost)
+			{
+				best = window[w];
+				bestError = candidateError;
+				bestBits = RDO_MATCH_BITS;
+				bestCost = cost;
+			}
+
+			if (fitEndpoints && indicesOf(candidate) != indicesOf(window[w]) && validBlock(candidate))
+			{
+				int candidateBits = RDO_MATCH_BITS + (hasIndices(candidate) ? RDO_MATCH_BITS : RDO_LITERAL_BITS);
+				cost = fitError + (long long)lambda * candidateBits;
+				if (cost < bestCost)
+				{
+					best = candidate;
+					bestError = fitError;
+					bestBits = candidateBits;
+					bestCost = cost;
+				}
+			}
+		}
+
+		blocks[i] = best;
+		pushWindow(best);
+
+		++stats.nBlocks;
+		stats.nChanged += endpointsOf(best) != endpointsOf(base) || indicesOf(best) != indicesOf(base);
+		stats.baseError += blockBaseError;
+		stats.error += bestError;
+		stats.baseBits += blockBaseBits;
+		stats.bits += bestBits;
+	}
+}
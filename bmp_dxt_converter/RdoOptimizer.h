@@ -0,0 +1,151 @@
+/**
+RdoOptimizer.h
+Purpose: Rate-distortion optimization of the compressed blocks for the LZ compression of the DDS files (packaging).
+Once a row of blocks is compressed, each block may take the end points, the indices or the whole of a block of a
+sliding window of the blocks just before it, when the error it adds is worth the bytes an LZ compressor saves on
+the repeat: a block minimizes error + lambda * bits, the bits estimated from what the window holds.
+An optimizer is used by a single thread (one per thread of a compression). The window restarts every
+RDO_SEGMENT_BLOCKS blocks of a row, so the blocks are the same whatever the number of threads or the encoder path.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include "bmp_dxt1_headers.h"
+
+using namespace std;
+
+// blocks of the sliding window, the last distinct blocks chosen
+#define RDO_WINDOW_BLOCKS	32
+
+// the window restarts every RDO_SEGMENT_BLOCKS blocks of a row (the pieces of the streaming encoder)
+#define RDO_SEGMENT_BLOCKS	1024
+
+// estimated LZ bits of half a block (4 bytes: the end points or the indices): a literal, or a match
+// (length and distance) if the window holds the same bytes. A whole block repeated is a single match.
+#define RDO_LITERAL_BITS	32
+#define RDO_MATCH_BITS		16
+
+// blocks optimized and changed, their error and estimated LZ bits before and after the optimization
+struct RdoStats
+{
+	long long nBlocks;
+	long long nChanged;
+	long long baseError;
+	long long error;
+	long long baseBits;
+	long long bits;
+
+	RdoStats() : nBlocks(0), nChanged(0), baseError(0), error(0), baseBits(0), bits(0) {}
+
+	void add(const RdoStats& other)
+	{
+		nBlocks += other.nBlocks;
+		nChanged += other.nChanged;
+		baseError += other.baseError;
+		error += other.error;
+		baseBits += other.baseBits;
+		bits += other.bits;
+	}
+};
+
+class RdoOptimizer
+{
+private:
+	// decoded colors of a block palette (as ErrorMetrics::blockError, 3 color mode as the DDS readers) and their
+	// bounding box
+	struct Palette
+	{
+		int r[4];
+		int g[4];
+		int b[4];
+		int low[3];
+		int high[3];
+	};
+
+	// the 16 pixel colors of a block by channel and their bounding box
+	struct BlockChannels
+	{
+		int r[16];
+		int g[16];
+		int b[16];
+		int low[3];
+		int high[3];
+	};
+
+	// error (squared, see ErrorMetrics::blockError) traded for one bit
+	int lambda;
+
+	// ring of the last distinct blocks chosen and their decoded palettes, windowNext: the entry replaced next
+	Dxt1Block window[RDO_WINDOW_BLOCKS];
+	Palette palettes[RDO_WINDOW_BLOCKS];
+	int nWindow;
+	int windowNext;
+
+	RdoStats stats;
+
+	/**
+	Estimated LZ bits of a block following the window
+	*/
+	int blockBits(const Dxt1Block& block) const;
+
+	/**
+	Check if a window block has the same end points (same indices) as a block
+	*/
+	bool hasEndpoints(const Dxt1Block& block) const;
+	bool hasIndices(const Dxt1Block& block) const;
+
+	/**
+	Add a block to the window unless it is already there
+	*/
+	void pushWindow(const Dxt1Block& block);
+
+	/**
+	Decode the palette of a block
+	*/
+	static void expandPalette(const Dxt1Block& block, Palette& palette);
+
+	/**
+	Split the 16 pixel colors of a block by channel
+	*/
+	static void splitColors(const RGBTriplet* blockColors, BlockChannels& channels);
+
+	/**
+	Lower bound of the squared error of a block with a palette: every pixel is at least as far from every palette
+	color as their bounding boxes are apart
+	*/
+	static unsigned int errorBound(const BlockChannels& channels, const Palette& palette);
+
+	/**
+	Squared errors of a block with a palette, in one pass over the pixels: with given indices and with the
+	closest indices (the first one on ties)
+
+	@param channels the 16 pixel colors of the block
+	@param palette the palette
+	@param indices the given indices
+	@param fitIndices target closest indices, null to only compute the error with the given indices
+	@param fitError receives the error with the closest indices
+	@return squared error with the given indices
+	*/
+	static unsigned int paletteErrors(const BlockChannels& channels, const Palette& palette, const byte* indices, byte* fitIndices,
+		unsigned int& fitError);
+
+public:
+	/**
+	@param lambda error traded for one bit, higher values repeat more blocks (smaller LZ compressed files)
+	*/
+	void init(const int lambda);
+
+	/**
+	Optimize compressed blocks, in order
+
+	@param blockColors source colors, 16 consecutive colors per block
+	@param blocks the compressed blocks, replaced by the optimized ones
+	@param nBlocks number of blocks, consecutive blocks of a row starting at a multiple of RDO_SEGMENT_BLOCKS
+	*/
+	void optimizeBlocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks);
+
+	const RdoStats& getStats() const { return stats; }
+};
@@ -0,0 +1,78 @@
+/**
+ScratchArena.cpp
+Purpose: Growable bump allocator for per-image scratch buffers
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include <stdint.h>
+#include "ScratchArena.h"
+
+// smallest chunk allocated, a few rows of block colors of a small image
+#define ARENA_MIN_CHUNK (64 * 1024)
+
+ScratchArena::~ScratchArena()
+{
+	for (size_t i = 0; i < chunks.size(); ++i)
+		delete[] chunks[i].memory;
+}
+
+void ScratchArena::grow(const size_t minSize)
+{
+	// at least double the capacity, so a growing workload only grows a few times
+	Chunk chunk;
+	chunk.size = max(max(minSize, capacity()), (size_t)ARENA_MIN_CHUNK);
+	chunk.memory = new char[chunk.size];
+	chunk.used = 0;
+	chunks.push_back(chunk);
+}
+
+void* ScratchArena::allocate(const size_t size, const size_t alignment)
+{
+	if (!chunks.empty())
+	{
+		Chunk& chunk = chunks.back();
+		uintptr_t start = (uintptr_t)chunk.memory + chunk.used;
+		size_t padding = (alignment - start % alignment) % alignment;
+
+		if (chunk.size - chunk.used >= padding + size)
+		{
+			chunk.used += padding + size;
+			return (void*)(start + padding);
+		}
+	}
+
+	// the new chunk start is only aligned for new[], leave room to align it
+	grow(size + alignment);
+	return allocate(size, alignment);
+}
+
+void ScratchArena::reset()
+{
+	if (chunks.size() > 1)
+	{
+		// merge everything into one chunk of the total size
+		size_t total = capacity();
+		for (size_t i = 0; i < chunks.size(); ++i)
+			delete[] chunks[i].memory;
+		chunks.clear();
+
+		Chunk chunk;
+		chunk.size = total;
+		chunk.memory = new char[total];
+		chunks.push_back(chunk);
+	}
+
+	if (!chunks.empty())
+		chunks.back().used = 0;
+}
+
+size_t ScratchArena::capacity() const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < chunks.size(); ++i)
+		total += chunks[i].size;
+	return total;
+}
@@ -0,0 +1,74 @@
+/**
+ScratchArena.h
+Purpose: Growable bump allocator for per-image scratch buffers. Allocations are only released all at once
+by reset(), which also merges the memory into one chunk, so after the first few images of a given size
+allocating scratch buffers no longer touches the heap
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+class ScratchArena
+{
+private:
+	// a block of memory allocations are carved from
+	struct Chunk
+	{
+		char* memory;
+		size_t size;
+		size_t used;
+	};
+
+	vector<Chunk> chunks; // the last chunk is the one allocations are taken from
+
+	/**
+	Add a chunk of at least minSize bytes
+	*/
+	void grow(const size_t minSize);
+
+public:
+	ScratchArena() {}
+	~ScratchArena();
+
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	/**
+	Allocate uninitialized memory, valid until the next reset()
+
+	@param size number of bytes
+	@param alignment power of two alignment, 64 (a cache line) by default
+	@return the memory
+	*/
+	void* allocate(const size_t size, const size_t alignment = 64);
+
+	/**
+	Allocate an uninitialized array, valid until the next reset()
+
+	@param count number of elements
+	@return the array
+	*/
+	template <class T>
+	T* allocateArray(const size_t count)
+	{
+		return (T*)allocate(count * sizeof(T), alignof(T) > 64 ? alignof(T) : 64);
+	}
+
+	/**
+	Release all allocations. If the arena had to grow, its chunks are replaced by a single chunk
+	large enough for all of them, so the same allocations fit without growing next time.
+	*/
+	void reset();
+
+	/**
+	Total bytes owned by the arena
+	*/
+	size_t capacity() const;
+};
@@ -0,0 +1,125 @@
+/**
+SimdDecoder.cpp
+Purpose: Row oriented DXT1 decoder, kernel dispatch and scalar kernel
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <string.h>
+#include "SimdDecoder.h"
+
+#ifdef SIMD_X86
+// kernel defined in SimdDecoderSse41.cpp
+void decompressDxt1RowSse41(const Dxt1Block* blocks, const int nBlocks, RGBTriplet* rowPixels, const ptrdiff_t stride, PaletteCache& cache);
+#endif
+
+const byte expand5To8[32] =
+{
+	0, 8, 16, 25, 33, 41, 49, 58, 66, 74, 82, 90, 99, 107, 115, 123,
+	132, 140, 148, 156, 165, 173, 181, 189, 197, 206, 214, 222, 230, 239, 247, 255
+};
+
+const byte expand6To8[64] =
+{
+	0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 45, 49, 53, 57, 61,
+	65, 69, 73, 77, 81, 85, 89, 93, 97, 101, 105, 109, 113, 117, 121, 125,
+	130, 134, 138, 142, 146, 150, 154, 158, 162, 166, 170, 174, 178, 182, 186, 190,
+	194, 198, 202, 206, 210, 215, 219, 223, 227, 231, 235, 239, 243, 247, 251, 255
+};
+
+// byte offsets of c0, c1, c2, c3 in a cached palette
+static const int paletteOffsets[4] = { 0, 3, 8, 11 };
+
+void PaletteCache::init()
+{
+	for (unsigned int slot = 0; slot < PALETTE_CACHE_ENTRIES; ++slot)
+		fill(slot, (unsigned short)slot, 0);
+
+	hits = 0;
+	misses = 0;
+}
+
+void PaletteCache::fill(const unsigned int slot, const unsigned short c0, const unsigned short c1)
+{
+	keys[slot] = (unsigned int)c0 << 16 | c1;
+	byte* palette = palettes[slot];
+
+	// c0 and c1 in BGR order
+	palette[0] = expand5To8[c0 & 0x1F];
+	palette[1] = expand6To8[(c0 >> 5) & 0x3F];
+	palette[2] = expand5To8[c0 >> 11];
+	palette[3] = expand5To8[c1 & 0x1F];
+	palette[4] = expand6To8[(c1 >> 5) & 0x3F];
+	palette[5] = expand5To8[c1 >> 11];
+
+	// c2 = (2 * c0 + c1) / 3, c3 = (c0 + 2 * c1) / 3 (exactly the same colors as the float 2/3, 1/3 weights)
+	for (int k = 0; k < 3; ++k)
+	{
+		palette[8 + k] = (2 * palette[k] + palette[3 + k]) / 3;
+		palette[11 + k] = (palette[k] + 2 * palette[3 + k]) / 3;
+	}
+
+	palette[6] = palette[7] = palette[14] = palette[15] = 0;
+}
+
+/**
+Scalar kernel: take the block palette from the cache (expanding it with the tables on a miss), then write
+the pixels of the 4 scanlines
+*/
+static void decompressDxt1RowScalar(const Dxt1Block* blocks, const int nBlocks, RGBTriplet* rowPixels, const ptrdiff_t stride, PaletteCache& cache)
+{
+	for (int i = 0; i < nBlocks; ++i) // loop over the row blocks
+	{
+		unsigned short c0 = blocks[i].c0, c1 = blocks[i].c1;
+		unsigned int slot = PaletteCache::slotOf(c0, c1);
+		if (cache.keys[slot] == ((unsigned int)c0 << 16 | c1))
+		{
+			++cache.hits;
+		}
+		else
+		{
+			++cache.misses;
+			cache.fill(slot, c0, c1);
+		}
+
+		RGBTriplet colors[4];
+		for (int k = 0; k < 4; ++k)
+			memcpy(&colors[k], cache.palettes[slot] + paletteOffsets[k], 3);
+
+		// write the 4 pixels of each of the block 4 scanlines
+		RGBTriplet* pixels = rowPixels + i * 4;
+		for (int h = 0; h < 4; ++h, pixels = (RGBTriplet*)((byte*)pixels + stride))
+		{
+			byte indices = blocks[i].indices[h];
+			pixels[0] = colors[indices & 0x3];
+			pixels[1] = colors[(indices >> 2) & 0x3];
+			pixels[2] = colors[(indices >> 4) & 0x3];
+			pixels[3] = colors[indices >> 6];
+		}
+	}
+}
+
+SimdDecoder::SimdDecoder()
+{
+	setLevel(SimdEncoder::detectLevel());
+}
+
+void SimdDecoder::setLevel(const SimdLevel requestedLevel)
+{
+	SimdLevel supported = SimdEncoder::detectLevel();
+	level = requestedLevel < supported ? requestedLevel : supported;
+
+	// the SSE4.1 kernel is the widest one, 12 bytes (4 pixels) per shuffle are already one store per scanline
+#ifdef SIMD_X86
+	if (level >= SIMD_SSE41)
+	{
+		level = SIMD_SSE41;
+		kernel = decompressDxt1RowSse41;
+		return;
+	}
+#endif
+
+	level = SIMD_SCALAR;
+	kernel = decompressDxt1RowScalar;
+}
@@ -0,0 +1,98 @@
+/**
+SimdDecoder.h
+Purpose: Row oriented DXT1 decoder. A whole row of blocks is expanded at once into the 4 scanlines it covers,
+with a SSE4.1 kernel building the 4 block colors in registers and writing 4 pixels per shuffle.
+Expanded palettes are memoized by (c0, c1) pair, blocks of a texture often share their end points.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include "bmp_dxt1_headers.h"
+#include "SimdEncoder.h"
+
+// RGB565 channels to 8 bits: (x * 527 + 23) >> 6 for 5 bits, (x * 259 + 33) >> 6 for 6 bits
+extern const byte expand5To8[32];
+extern const byte expand6To8[64];
+
+// number of palettes kept by a PaletteCache (20KB)
+#define PALETTE_CACHE_ENTRIES 1024
+
+/**
+Direct mapped cache of expanded block palettes, keyed by the (c0, c1) pair. A cache is used by one decompression
+(one thread) at a time.
+*/
+struct PaletteCache
+{
+	// c0 << 16 | c1 of every entry (an entry is never empty, see init)
+	unsigned int keys[PALETTE_CACHE_ENTRIES];
+
+	// c0, c1, c2, c3 in BGR order at bytes 0, 3, 8, 11 (the layout the SSE4.1 shuffles expect)
+	alignas(16) byte palettes[PALETTE_CACHE_ENTRIES][16];
+
+	long long hits;
+	long long misses;
+
+	/**
+	Fill every entry with a valid palette, entry i with the palette of c0 = i, c1 = 0 (which maps to entry i),
+	so no empty flag has to be checked
+	*/
+	void init();
+
+	/**
+	Entry of a (c0, c1) pair, c1 = 0 maps c0 to entry c0
+	*/
+	static unsigned int slotOf(const unsigned int c0, const unsigned int c1)
+	{
+		return (c0 ^ ((c1 * 2654435761u) >> 16)) & (PALETTE_CACHE_ENTRIES - 1);
+	}
+
+	/**
+	Expand the palette of a (c0, c1) pair into an entry
+	*/
+	void fill(const unsigned int slot, const unsigned short c0, const unsigned short c1);
+};
+
+// decodes a row of blocks into 4 scanlines starting at rowPixels, stride bytes apart
+typedef void (*Dxt1RowKernel)(const Dxt1Block* blocks, const int nBlocks, RGBTriplet* rowPixels, const ptrdiff_t stride, PaletteCache& cache);
+
+class SimdDecoder
+{
+private:
+	SimdLevel level;
+	Dxt1RowKernel kernel;
+
+public:
+	/**
+	Select the best kernel supported by the running CPU
+	*/
+	SimdDecoder();
+
+	/**
+	Force a specific kernel (e.g. for benchmarking). Levels not supported by the CPU fall back to
+	the best supported one.
+
+	@param level requested instruction set level
+	*/
+	void setLevel(const SimdLevel level);
+
+	SimdLevel getLevel() const { return level; }
+
+	/**
+	Decompress a row of blocks
+
+	@param blocks source blocks (imgWidth / 4 blocks)
+	@param rowPixels target colors, first pixel of the top scanline of the row
+	@param imgWidth image width
+	@param stride bytes from a scanline to the one below it (negative for bottom-up images)
+	@param cache palettes of the blocks decoded before, initialized before the first row of an image
+	*/
+	void decompressBlockRow(const Dxt1Block* blocks, RGBTriplet* rowPixels, const int imgWidth, const ptrdiff_t stride,
+		PaletteCache& cache) const
+	{
+		kernel(blocks, imgWidth / 4, rowPixels, stride, cache);
+	}
+};
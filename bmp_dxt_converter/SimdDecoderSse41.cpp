@@ -0,0 +1,103 @@
+/**
+SimdDecoderSse41.cpp
+Purpose: SSE4.1 DXT1 row decoder. The 4 block colors are built in one register and each scanline
+of a block (4 pixels, 12 bytes) is produced by a single byte shuffle
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <string.h>
+#include "SimdDecoder.h"
+
+#ifdef SIMD_X86
+
+#include <smmintrin.h>
+
+namespace
+{
+	// byte offsets of c0, c1, c2, c3 in the packed palette register
+	const int paletteOffsets[4] = { 0, 3, 8, 11 };
+
+	// shuffle masks turning the palette register into the 4 pixels of a scanline, one per indices byte
+	struct ShuffleTable
+	{
+		__m128i masks[256];
+
+		ShuffleTable()
+		{
+			for (int indices = 0; indices < 256; ++indices)
+			{
+				char mask[16];
+				for (int w = 0; w < 4; ++w)
+				{
+					int offset = paletteOffsets[(indices >> (w * 2)) & 0x3];
+					mask[w * 3 + 0] = (char)(offset + 0);
+					mask[w * 3 + 1] = (char)(offset + 1);
+					mask[w * 3 + 2] = (char)(offset + 2);
+				}
+				for (int k = 12; k < 16; ++k)
+					mask[k] = (char)0x80; // zero
+
+				masks[indices] = _mm_loadu_si128((const __m128i*)mask);
+			}
+		}
+	};
+
+	const ShuffleTable shuffleTable;
+}
+
+void decompressDxt1RowSse41(const Dxt1Block* blocks, const int nBlocks, RGBTriplet* rowPixels, const ptrdiff_t stride, PaletteCache& cache)
+{
+	// RGB565 to RGB888: (x * 527 + 23) >> 6 for 5 bits, (x * 259 + 33) >> 6 for 6 bits, lanes in BGR memory order
+	const __m128i expandMul = _mm_setr_epi16(527, 259, 527, 527, 259, 527, 0, 0);
+	const __m128i expandAdd = _mm_setr_epi16(23, 33, 23, 23, 33, 23, 0, 0);
+	const __m128i div3 = _mm_set1_epi16((short)0xAAAB); // x / 3 = mulhi(x, 0xAAAB) >> 1
+
+	byte* out = (byte*)rowPixels;
+
+	for (int i = 0; i < nBlocks; ++i, out += 12)
+	{
+		unsigned short c0 = blocks[i].c0, c1 = blocks[i].c1;
+		unsigned int slot = PaletteCache::slotOf(c0, c1);
+		__m128i palette;
+
+		if (cache.keys[slot] == ((unsigned int)c0 << 16 | c1))
+		{
+			++cache.hits;
+			palette = _mm_load_si128((const __m128i*)cache.palettes[slot]);
+		}
+		else
+		{
+			++cache.misses;
+
+			// colors01: c0.b c0.g c0.r c1.b c1.g c1.r (16 bit lanes), colors10: same with c0 and c1 swapped
+			__m128i colors01 = _mm_setr_epi16(c0 & 0x1F, (c0 >> 5) & 0x3F, c0 >> 11, c1 & 0x1F, (c1 >> 5) & 0x3F, c1 >> 11, 0, 0);
+			colors01 = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(colors01, expandMul), expandAdd), 6);
+			__m128i colors10 = _mm_shuffle_epi8(colors01, _mm_setr_epi8(6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, -1, -1, -1, -1));
+
+			// c2 = (2 * c0 + c1) / 3, c3 = (2 * c1 + c0) / 3
+			__m128i colors23 = _mm_add_epi16(_mm_add_epi16(colors01, colors01), colors10);
+			colors23 = _mm_srli_epi16(_mm_mulhi_epu16(colors23, div3), 1);
+
+			// bytes: c0 at 0, c1 at 3, c2 at 8, c3 at 11
+			palette = _mm_packus_epi16(colors01, colors23);
+
+			cache.keys[slot] = (unsigned int)c0 << 16 | c1;
+			_mm_store_si128((__m128i*)cache.palettes[slot], palette);
+		}
+
+		byte* scanline = out;
+		for (int h = 0; h < 4; ++h, scanline += stride)
+		{
+			__m128i pixels = _mm_shuffle_epi8(palette, shuffleTable.masks[blocks[i].indices[h]]);
+
+			// 12 bytes, without touching the pixels after the block (they may already be written)
+			_mm_storel_epi64((__m128i*)scanline, pixels);
+			int last = _mm_cvtsi128_si32(_mm_srli_si128(pixels, 8));
+			memcpy(scanline + 8, &last, 4);
+		}
+	}
+}
+
+#endif
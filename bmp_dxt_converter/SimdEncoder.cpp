@@ -0,0 +1,144 @@
+/**
+SimdEncoder.cpp
+Purpose: Runtime dispatch of the vectorized DXT1 block encoders
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include "SimdEncoder.h"
+
+#ifdef SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// kernels defined in SimdEncoderSse41.cpp, SimdEncoderAvx2.cpp and SimdEncoderAvx512.cpp
+void compressDxt1BatchSse41(const RGBTriplet* blockColors, Dxt1Block* blocks);
+void compressDxt1BatchAvx2(const RGBTriplet* blockColors, Dxt1Block* blocks);
+#ifdef SIMD_HAS_AVX512
+void compressDxt1BatchAvx512(const RGBTriplet* blockColors, Dxt1Block* blocks);
+#endif
+
+// cpuid(leaf, subleaf) into regs: eax, ebx, ecx, edx
+static void cpuid(int* regs, const int leaf, const int subleaf)
+{
+#ifdef _MSC_VER
+	__cpuidex(regs, leaf, subleaf);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+// enabled OS register state (XCR0), AVX needs the OS to save the ymm/zmm registers on context switch
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+
+SimdEncoder::SimdEncoder()
+{
+	setLevel(detectLevel());
+}
+
+SimdLevel SimdEncoder::detectLevel()
+{
+#ifdef SIMD_X86
+	int regs[4];
+	cpuid(regs, 0, 0);
+	int maxLeaf = regs[0];
+
+	cpuid(regs, 1, 0);
+	bool sse41 = (regs[2] & (1 << 19)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	if (!sse41)
+		return SIMD_SCALAR;
+
+	unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+	bool ymmEnabled = (xcr0 & 0x6) == 0x6; // xmm + ymm state
+	bool zmmEnabled = (xcr0 & 0xe6) == 0xe6; // xmm + ymm + opmask + zmm state
+	if (maxLeaf < 7 || !ymmEnabled)
+		return SIMD_SSE41;
+
+	cpuid(regs, 7, 0);
+	bool avx2 = (regs[1] & (1 << 5)) != 0;
+	bool avx512f = (regs[1] & (1 << 16)) != 0;
+
+#ifdef SIMD_HAS_AVX512
+	if (avx2 && avx512f && zmmEnabled)
+		return SIMD_AVX512;
+#else
+	(void)avx512f;
+	(void)zmmEnabled;
+#endif
+
+	return avx2 ? SIMD_AVX2 : SIMD_SSE41;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+const char* SimdEncoder::levelName(const SimdLevel level)
+{
+	switch (level)
+	{
+	case SIMD_SSE41: return "sse4.1";
+	case SIMD_AVX2: return "avx2";
+	case SIMD_AVX512: return "avx512";
+	default: return "scalar";
+	}
+}
+
+void SimdEncoder::setLevel(const SimdLevel requestedLevel)
+{
+	SimdLevel supported = detectLevel();
+	level = requestedLevel < supported ? requestedLevel : supported;
+
+	switch (level)
+	{
+#ifdef SIMD_X86
+	case SIMD_SSE41:
+		kernel = compressDxt1BatchSse41;
+		width = 4;
+		break;
+	case SIMD_AVX2:
+		kernel = compressDxt1BatchAvx2;
+		width = 8;
+		break;
+#ifdef SIMD_HAS_AVX512
+	case SIMD_AVX512:
+		kernel = compressDxt1BatchAvx512;
+		width = 16;
+		break;
+#endif
+#endif
+	default:
+		level = SIMD_SCALAR;
+		kernel = 0;
+		width = 1;
+		break;
+	}
+}
+
+int SimdEncoder::compressBlocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks) const
+{
+	if (!kernel)
+		return 0;
+
+	int i = 0;
+	for (; i + width <= nBlocks; i += width)
+		kernel(blockColors + i * 16, blocks + i);
+
+	return i;
+}
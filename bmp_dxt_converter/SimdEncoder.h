@@ -0,0 +1,87 @@
+/**
+SimdEncoder.h
+Purpose: Runtime dispatch of the vectorized DXT1 block encoders. Each kernel encodes 4/8/16 blocks
+at once (one block per SIMD lane) and produces the same bits as Compressor::compressDxt1Block
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include "bmp_dxt1_headers.h"
+
+// the batch kernels are x86 only, the AVX-512 one also needs a compiler with AVX-512 intrinsics
+// (Visual Studio 2017 15.3 or later), GCC/Clang builds compile each SimdEncoder<ISA>.cpp with its -m flag
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SIMD_X86
+#endif
+
+#if defined(SIMD_X86) && (defined(_M_X64) || defined(__x86_64__)) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1911))
+#define SIMD_HAS_AVX512
+#endif
+
+// fixed point luminance weights (0.2125, 0.7154 and 0.0721 scaled by 2^16) of the intensity encoder, integers
+// so the scalar encoder and the kernels pick the same end points with any compiler and floating point flags
+#define LUMINANCE_R 13926
+#define LUMINANCE_G 46884
+#define LUMINANCE_B 4725
+#define LUMINANCE_SHIFT 16
+
+// instruction sets a DXT1 batch kernel is available for, ordered from slowest to fastest
+enum SimdLevel
+{
+	SIMD_SCALAR = 0,
+	SIMD_SSE41,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+// a batch kernel compresses SimdEncoder::batchWidth() consecutive blocks, 16 colors per block
+typedef void (*Dxt1BatchKernel)(const RGBTriplet* blockColors, Dxt1Block* blocks);
+
+class SimdEncoder
+{
+private:
+	SimdLevel level;
+	Dxt1BatchKernel kernel;
+	int width; // number of blocks the kernel compresses per call
+
+public:
+	/**
+	Select the best kernel supported by the running CPU
+	*/
+	SimdEncoder();
+
+	/**
+	Detect the best instruction set supported by both the CPU and this build
+	*/
+	static SimdLevel detectLevel();
+
+	/**
+	Human readable name of an instruction set level
+	*/
+	static const char* levelName(const SimdLevel level);
+
+	/**
+	Force a specific kernel (e.g. for benchmarking). Levels not supported by the CPU fall back to
+	the best supported one.
+
+	@param level requested instruction set level
+	*/
+	void setLevel(const SimdLevel level);
+
+	SimdLevel getLevel() const { return level; }
+	int batchWidth() const { return width; }
+
+	/**
+	Compress as many whole batches of blocks as possible
+
+	@param blockColors source colors, 16 consecutive colors per block
+	@param blocks target blocks
+	@param nBlocks number of blocks available
+	@return number of blocks compressed (a multiple of batchWidth(), 0 for the scalar level),
+	the caller compresses the remaining blocks with the scalar encoder
+	*/
+	int compressBlocks(const RGBTriplet* blockColors, Dxt1Block* blocks, const int nBlocks) const;
+};
@@ -0,0 +1,44 @@
+/**
+SimdEncoderAvx2.cpp
+Purpose: AVX2 DXT1 batch kernel, compresses 8 blocks per call
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include "SimdEncoder.h"
+
+#ifdef SIMD_X86
+
+#include <immintrin.h>
+#include "SimdKernel.h"
+
+namespace
+{
+	struct Avx2Ops
+	{
+		enum { WIDTH = 8 };
+		typedef __m256i vint;
+		typedef __m256i vmask;
+
+		static inline vint load(const int* p) { return _mm256_load_si256((const __m256i*)p); }
+		static inline void store(int* p, vint v) { _mm256_store_si256((__m256i*)p, v); }
+		static inline vint set1(int x) { return _mm256_set1_epi32(x); }
+		static inline vint bitOr(vint a, vint b) { return _mm256_or_si256(a, b); }
+		static inline vint shl(vint a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+		static inline vint shr(vint a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+		static inline vmask cmpgt(vint a, vint b) { return _mm256_cmpgt_epi32(a, b); }
+		static inline vmask cmpeq(vint a, vint b) { return _mm256_cmpeq_epi32(a, b); }
+		static inline vint select(vmask m, vint a, vint b) { return _mm256_blendv_epi8(b, a, m); }
+		static inline vint add(vint a, vint b) { return _mm256_add_epi32(a, b); }
+		static inline vint sub(vint a, vint b) { return _mm256_sub_epi32(a, b); }
+		static inline vint mul(vint a, vint b) { return _mm256_mullo_epi32(a, b); }
+	};
+}
+
+void compressDxt1BatchAvx2(const RGBTriplet* blockColors, Dxt1Block* blocks)
+{
+	compressDxt1Batch<Avx2Ops>(blockColors, blocks);
+}
+
+#endif
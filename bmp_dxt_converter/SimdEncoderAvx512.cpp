@@ -0,0 +1,44 @@
+/**
+SimdEncoderAvx512.cpp
+Purpose: AVX-512 DXT1 batch kernel, compresses 16 blocks per call
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include "SimdEncoder.h"
+
+#ifdef SIMD_HAS_AVX512
+
+#include <immintrin.h>
+#include "SimdKernel.h"
+
+namespace
+{
+	struct Avx512Ops
+	{
+		enum { WIDTH = 16 };
+		typedef __m512i vint;
+		typedef __mmask16 vmask;
+
+		static inline vint load(const int* p) { return _mm512_load_si512((const void*)p); }
+		static inline void store(int* p, vint v) { _mm512_store_si512((void*)p, v); }
+		static inline vint set1(int x) { return _mm512_set1_epi32(x); }
+		static inline vint bitOr(vint a, vint b) { return _mm512_or_si512(a, b); }
+		static inline vint shl(vint a, int n) { return _mm512_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+		static inline vint shr(vint a, int n) { return _mm512_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+		static inline vmask cmpgt(vint a, vint b) { return _mm512_cmpgt_epi32_mask(a, b); }
+		static inline vmask cmpeq(vint a, vint b) { return _mm512_cmpeq_epi32_mask(a, b); }
+		static inline vint select(vmask m, vint a, vint b) { return _mm512_mask_blend_epi32(m, b, a); }
+		static inline vint add(vint a, vint b) { return _mm512_add_epi32(a, b); }
+		static inline vint sub(vint a, vint b) { return _mm512_sub_epi32(a, b); }
+		static inline vint mul(vint a, vint b) { return _mm512_mullo_epi32(a, b); }
+	};
+}
+
+void compressDxt1BatchAvx512(const RGBTriplet* blockColors, Dxt1Block* blocks)
+{
+	compressDxt1Batch<Avx512Ops>(blockColors, blocks);
+}
+
+#endif
@@ -0,0 +1,44 @@
+/**
+SimdEncoderSse41.cpp
+Purpose: SSE4.1 DXT1 batch kernel, compresses 4 blocks per call
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include "SimdEncoder.h"
+
+#ifdef SIMD_X86
+
+#include <smmintrin.h>
+#include "SimdKernel.h"
+
+namespace
+{
+	struct Sse41Ops
+	{
+		enum { WIDTH = 4 };
+		typedef __m128i vint;
+		typedef __m128i vmask;
+
+		static inline vint load(const int* p) { return _mm_load_si128((const __m128i*)p); }
+		static inline void store(int* p, vint v) { _mm_store_si128((__m128i*)p, v); }
+		static inline vint set1(int x) { return _mm_set1_epi32(x); }
+		static inline vint bitOr(vint a, vint b) { return _mm_or_si128(a, b); }
+		static inline vint shl(vint a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+		static inline vint shr(vint a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+		static inline vmask cmpgt(vint a, vint b) { return _mm_cmpgt_epi32(a, b); }
+		static inline vmask cmpeq(vint a, vint b) { return _mm_cmpeq_epi32(a, b); }
+		static inline vint select(vmask m, vint a, vint b) { return _mm_blendv_epi8(b, a, m); }
+		static inline vint add(vint a, vint b) { return _mm_add_epi32(a, b); }
+		static inline vint sub(vint a, vint b) { return _mm_sub_epi32(a, b); }
+		static inline vint mul(vint a, vint b) { return _mm_mullo_epi32(a, b); }
+	};
+}
+
+void compressDxt1BatchSse41(const RGBTriplet* blockColors, Dxt1Block* blocks)
+{
+	compressDxt1Batch<Sse41Ops>(blockColors, blocks);
+}
+
+#endif
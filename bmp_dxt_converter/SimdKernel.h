@@ -0,0 +1,152 @@
+/**
+SimdKernel.h
+Purpose: Instruction set independent body of the DXT1 batch kernels. Only included by the
+SimdEncoder<ISA>.cpp files, each one compiled for its own instruction set and providing an "Ops" struct
+wrapping the intrinsics. Every lane follows Compressor::compressDxt1Block step by step (same fixed point
+luminance, same integer c2/c3 and distances, same tie breaking) so the output blocks are bit identical.
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include "SimdEncoder.h"
+
+namespace
+{
+	// (LUMINANCE_R * r + LUMINANCE_G * g + LUMINANCE_B * b) >> LUMINANCE_SHIFT
+	template <class Ops>
+	inline typename Ops::vint luminance(typename Ops::vint r, typename Ops::vint g, typename Ops::vint b)
+	{
+		typename Ops::vint sum = Ops::add(Ops::mul(r, Ops::set1(LUMINANCE_R)), Ops::mul(g, Ops::set1(LUMINANCE_G)));
+		return Ops::shr(Ops::add(sum, Ops::mul(b, Ops::set1(LUMINANCE_B))), LUMINANCE_SHIFT);
+	}
+
+	// (2 * a + b) / 3, the division is a multiply by 0xAAAB >> 17 (exact up to 2 * 255 + 255)
+	template <class Ops>
+	inline typename Ops::vint lerp(typename Ops::vint a, typename Ops::vint b)
+	{
+		return Ops::shr(Ops::mul(Ops::add(Ops::add(a, a), b), Ops::set1(0xAAAB)), 17);
+	}
+
+	// squared distance between 2 colors
+	template <class Ops>
+	inline typename Ops::vint distance(typename Ops::vint r, typename Ops::vint g, typename Ops::vint b,
+		typename Ops::vint cr, typename Ops::vint cg, typename Ops::vint cb)
+	{
+		typename Ops::vint dr = Ops::sub(r, cr), dg = Ops::sub(g, cg), db = Ops::sub(b, cb);
+		return Ops::add(Ops::add(Ops::mul(dr, dr), Ops::mul(dg, dg)), Ops::mul(db, db));
+	}
+
+	/**
+	Compress Ops::WIDTH blocks, one block per lane
+
+	@param blockColors source colors, 16 consecutive colors per block
+	@param blocks target blocks
+	*/
+	template <class Ops>
+	inline void compressDxt1Batch(const RGBTriplet* blockColors, Dxt1Block* blocks)
+	{
+		typedef typename Ops::vint vint;
+		typedef typename Ops::vmask vmask;
+		const int W = Ops::WIDTH;
+
+		// transpose the blocks colors to SoA: channel[pixel][lane]
+		alignas(64) int r[16][W], g[16][W], b[16][W];
+		for (int k = 0; k < W; ++k)
+		{
+			const RGBTriplet* colors = blockColors + k * 16;
+			for (int i = 0; i < 16; ++i)
+			{
+				r[i][k] = colors[i].r;
+				g[i][k] = colors[i].g;
+				b[i][k] = colors[i].b;
+			}
+		}
+
+		// pick c0 (max intensity) and c1 (min intensity), colors default to black if never picked
+		vint zero = Ops::set1(0);
+		vint c1Intensity = Ops::set1(255), c0Intensity = zero;
+		vint c0r = zero, c0g = zero, c0b = zero;
+		vint c1r = zero, c1g = zero, c1b = zero;
+		for (int i = 0; i < 16; ++i)
+		{
+			vint pr = Ops::load(r[i]), pg = Ops::load(g[i]), pb = Ops::load(b[i]);
+			vint intensity = luminance<Ops>(pr, pg, pb);
+
+			vmask lt = Ops::cmpgt(c1Intensity, intensity);
+			c1Intensity = Ops::select(lt, intensity, c1Intensity);
+			c1r = Ops::select(lt, pr, c1r);
+			c1g = Ops::select(lt, pg, c1g);
+			c1b = Ops::select(lt, pb, c1b);
+
+			vmask gt = Ops::cmpgt(intensity, c0Intensity);
+			c0Intensity = Ops::select(gt, intensity, c0Intensity);
+			c0r = Ops::select(gt, pr, c0r);
+			c0g = Ops::select(gt, pg, c0g);
+			c0b = Ops::select(gt, pb, c0b);
+		}
+
+		// compress c0 and c1 to RGB565
+		vint c0 = Ops::bitOr(Ops::bitOr(Ops::shl(Ops::shr(c0r, 3), 11), Ops::shl(Ops::shr(c0g, 2), 5)), Ops::shr(c0b, 3));
+		vint c1 = Ops::bitOr(Ops::bitOr(Ops::shl(Ops::shr(c1r, 3), 11), Ops::shl(Ops::shr(c1g, 2), 5)), Ops::shr(c1b, 3));
+
+		// make sure c0 is bigger than c1
+		vmask swap = Ops::cmpgt(c1, c0);
+		vint t;
+		t = Ops::select(swap, c1, c0); c1 = Ops::select(swap, c0, c1); c0 = t;
+		t = Ops::select(swap, c1r, c0r); c1r = Ops::select(swap, c0r, c1r); c0r = t;
+		t = Ops::select(swap, c1g, c0g); c1g = Ops::select(swap, c0g, c1g); c0g = t;
+		t = Ops::select(swap, c1b, c0b); c1b = Ops::select(swap, c0b, c1b); c0b = t;
+
+		// calculating c2 and c3
+		vint c2r = lerp<Ops>(c0r, c1r), c2g = lerp<Ops>(c0g, c1g), c2b = lerp<Ops>(c0b, c1b);
+		vint c3r = lerp<Ops>(c1r, c0r), c3g = lerp<Ops>(c1g, c0g), c3b = lerp<Ops>(c1b, c0b);
+
+		// calc pixels indices, packed 2 bits per pixel (indices[0] in the lowest byte)
+		vint one = Ops::set1(1), two = Ops::set1(2), three = Ops::set1(3);
+		vint indices = zero;
+		for (int i = 0; i < 16; ++i)
+		{
+			vint pr = Ops::load(r[i]), pg = Ops::load(g[i]), pb = Ops::load(b[i]);
+
+			vint minDis = distance<Ops>(pr, pg, pb, c0r, c0g, c0b);
+			vint index = zero;
+
+			vint dis = distance<Ops>(pr, pg, pb, c1r, c1g, c1b);
+			vmask closer = Ops::cmpgt(minDis, dis);
+			minDis = Ops::select(closer, dis, minDis);
+			index = Ops::select(closer, one, index);
+
+			dis = distance<Ops>(pr, pg, pb, c2r, c2g, c2b);
+			closer = Ops::cmpgt(minDis, dis);
+			minDis = Ops::select(closer, dis, minDis);
+			index = Ops::select(closer, two, index);
+
+			dis = distance<Ops>(pr, pg, pb, c3r, c3g, c3b);
+			closer = Ops::cmpgt(minDis, dis);
+			index = Ops::select(closer, three, index);
+
+			indices = Ops::bitOr(indices, Ops::shl(index, i * 2));
+		}
+
+		// 1 color in the block: all pixels take c0 color (index 0)
+		indices = Ops::select(Ops::cmpeq(c0, c1), zero, indices);
+
+		alignas(64) int outC0[W], outC1[W], outIndices[W];
+		Ops::store(outC0, c0);
+		Ops::store(outC1, c1);
+		Ops::store(outIndices, indices);
+
+		for (int k = 0; k < W; ++k)
+		{
+			blocks[k].c0 = (unsigned short)outC0[k];
+			blocks[k].c1 = (unsigned short)outC1[k];
+			blocks[k].indices[0] = (byte)(outIndices[k]);
+			blocks[k].indices[1] = (byte)(outIndices[k] >> 8);
+			blocks[k].indices[2] = (byte)(outIndices[k] >> 16);
+			blocks[k].indices[3] = (byte)(outIndices[k] >> 24);
+		}
+	}
+}
@@ -0,0 +1,125 @@
+/**
+ThreadPool.cpp
+Purpose: Persistent worker threads running indexed tasks
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#include <algorithm>
+#include "ThreadPool.h"
+
+// slot of the pool worker running on this thread, 0 for the other threads
+static thread_local int workerSlot = 0;
+
+int ThreadPool::currentSlot()
+{
+	return workerSlot;
+}
+
+ThreadPool::ThreadPool(int nThreads) : stopping(false)
+{
+	if (nThreads <= 0)
+		nThreads = max(1, (int)thread::hardware_concurrency());
+
+	jobs.reserve(64);
+
+	// the thread calling parallelFor is the first worker (slot 0)
+	for (int slot = 1; slot < nThreads; ++slot)
+		workers.push_back(thread(&ThreadPool::workerLoop, this, slot));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(jobsMutex);
+		stopping = true;
+	}
+	jobAdded.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+void ThreadPool::workerLoop(const int slot)
+{
+	workerSlot = slot;
+	unique_lock<mutex> lock(jobsMutex);
+
+	while (true)
+	{
+		jobAdded.wait(lock, [this] { return stopping || !jobs.empty(); });
+		if (stopping)
+			return;
+
+		// oldest job first, so a job started earlier is finished first
+		Job* job = jobs.front();
+		++job->nUsers;
+		lock.unlock();
+
+		int nRun = runTasks(job, slot);
+
+		lock.lock();
+		--job->nUsers;
+		job->nDone += nRun;
+
+		// all tasks handed out: remove the job so idle workers go to the next one
+		if (!jobs.empty() && jobs.front() == job)
+			jobs.erase(jobs.begin());
+
+		if (job->nDone == job->nTasks && job->nUsers == 0)
+			jobDone.notify_all();
+	}
+}
+
+int ThreadPool::runTasks(Job* job, const int slot)
+{
+	int nRun = 0;
+	int task;
+	while ((task = job->nextTask++) < job->nTasks)
+	{
+		job->fn(job->context, task, slot);
+		++nRun;
+	}
+	return nRun;
+}
+
+void ThreadPool::run(const int nTasks, TaskFunction fn, void* context)
+{
+	if (nTasks <= 0)
+		return;
+
+	// nothing to share: run everything on the calling thread
+	if (workers.empty() || nTasks == 1)
+	{
+		for (int task = 0; task < nTasks; ++task)
+			fn(context, task, 0);
+		return;
+	}
+
+	Job job;
+	job.fn = fn;
+	job.context = context;
+	job.nTasks = nTasks;
+	job.nextTask = 0;
+	job.nDone = 0;
+	job.nUsers = 0;
+
+	{
+		lock_guard<mutex> lock(jobsMutex);
+		jobs.push_back(&job);
+	}
+	jobAdded.notify_all();
+
+	// work on our own tasks, then wait for the workers still running some
+	int nRun = runTasks(&job, 0);
+
+	unique_lock<mutex> lock(jobsMutex);
+	job.nDone += nRun;
+
+	vector<Job*>::iterator it = find(jobs.begin(), jobs.end(), &job);
+	if (it != jobs.end())
+		jobs.erase(it);
+
+	jobDone.wait(lock, [&job] { return job.nDone == job.nTasks && job.nUsers == 0; });
+}
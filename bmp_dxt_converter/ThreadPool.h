@@ -0,0 +1,103 @@
+/**
+ThreadPool.h
+Purpose: Persistent worker threads running indexed tasks. Tasks are handed out one at a time
+from a shared counter, so threads that finish early keep taking work (dynamic load balancing)
+
+@author Mahmoud Badri (mhdside@hotmail.com)
+@version 1.2 12/02/2017
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool
+{
+private:
+	// type erased task function: calls (*(Fn*)context)(task, slot)
+	typedef void (*TaskFunction)(void* context, int task, int slot);
+
+	// a parallelFor call in progress
+	struct Job
+	{
+		TaskFunction fn;
+		void* context;
+		int nTasks;
+		atomic<int> nextTask;
+		int nDone;	// finished tasks (guarded by the pool mutex)
+		int nUsers; // threads currently running tasks of this job (guarded by the pool mutex)
+	};
+
+	vector<thread> workers;
+	vector<Job*> jobs;	// jobs that still have tasks to hand out (oldest first)
+	mutex jobsMutex;
+	condition_variable jobAdded;
+	condition_variable jobDone;
+	bool stopping;
+
+	/**
+	Worker thread main loop
+
+	@param slot worker slot passed to the tasks (1..size()-1)
+	*/
+	void workerLoop(const int slot);
+
+	/**
+	Run tasks of a job until none are left
+
+	@param job the job to take tasks from
+	@param slot slot of the calling thread
+	@return number of tasks run
+	*/
+	int runTasks(Job* job, const int slot);
+
+	/**
+	Run a job and wait until all its tasks are finished (see parallelFor)
+	*/
+	void run(const int nTasks, TaskFunction fn, void* context);
+
+	template <class Fn>
+	static void invokeTask(void* context, int task, int slot)
+	{
+		(*(const Fn*)context)(task, slot);
+	}
+
+public:
+	/**
+	@param nThreads total number of threads working on a parallelFor including the calling thread,
+	0 uses one thread per hardware thread
+	*/
+	explicit ThreadPool(int nThreads = 0);
+	~ThreadPool();
+
+	/**
+	Number of threads working on a parallelFor (workers + the calling thread)
+	*/
+	int size() const { return (int)workers.size() + 1; }
+
+	/**
+	Slot of the calling thread if it is a pool worker (1..size()-1), 0 for the other threads
+	*/
+	static int currentSlot();
+
+	/**
+	Run fn(task, slot) for every task in [0, nTasks) and wait until all are finished. The calling thread
+	works on the tasks too. slot is in [0, size()) and no two threads run tasks of the same call with the same
+	slot at the same time, so it can index per thread scratch buffers. Several threads may call parallelFor
+	at once, idle workers then help with all pending calls. No memory is allocated per call.
+
+	@param nTasks number of tasks
+	@param fn task function (or lambda) taking (int task, int slot)
+	*/
+	template <class Fn>
+	void parallelFor(const int nTasks, const Fn& fn)
+	{
+		run(nTasks, &ThreadPool::invokeTask<Fn>, (void*)&fn);
+	}
+};
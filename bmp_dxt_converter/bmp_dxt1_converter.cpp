@@ -9,13 +9,223 @@ Purpose: main class. The app converts from bmp to DXT1 dds and vice versa
 #include "stdafx.h"
 #include <iostream>
 #include <string>
+#include <vector>
+#include <climits>
+#include <cstdlib>
 #include "Compressor.h"
+#include "BatchConverter.h"
+#include "Benchmark.h"
+#include "ConversionServer.h"
+#include "bmp_dxt1_converter.h"
 #include <bitset>
 
 using namespace std;
 
-int main()
+/**
+Print the command line usage of the batch mode
+*/
+void printUsage()
+{
+	cout << "usage: bmp_dxt_converter [options] <file|pattern|@manifest>..." << endl;
+	cout << "  converts .bmp files to DXT1 .dds, .dds files to .bmp and .ddz files to .dds, without arguments runs interactively" << endl << endl;
+	cout << "  -o <dir>        directory of the generated files (default: next to each input)" << endl;
+	cout << "  -t <threads>    number of threads (default: one per hardware thread)" << endl;
+	cout << "  --range-fit     use the range fit encoder (better quality, slower)" << endl;
+	cout << "  --stream        use the bounded-memory streaming encoder" << endl;
+	cout << "  --metrics       print the compression error (RMSE, PSNR, worst block) of the .bmp files" << endl;
+	cout << "  --mipmaps       save the mip levels in the .dds files" << endl;
+	cout << "  --block-cache   compress repeated 4x4 blocks once (atlases, tiled textures)" << endl;
+	cout << "  --rdo <lambda>  trade quality for smaller LZ compressed .dds files: blocks repeat parts of the blocks" << endl;
+	cout << "                  before them when the squared error added is under lambda per bit saved (e.g. 20)" << endl;
+	cout << "  --incremental   update the existing .dds files, recompressing only the blocks changed since the" << endl;
+	cout << "                  last update (block hashes are kept in <file>.dds.blockhash)" << endl;
+	cout << "  --mip-level <n> mip level extracted from the .dds files (default: 0, the full size image)" << endl;
+	cout << "  --region <x,y,w,h> pixel rectangle extracted from the .dds files, only its blocks are read" << endl;
+	cout << "  --cache <dir>   skip the .bmp files compressed before with the same options: their .dds files are kept" << endl;
+	cout << "                  in dir (keyed by the .bmp contents) and copied from there" << endl;
+	cout << "  --cache-size <MB> size limit of the cache directory, least recently used entries deleted first (default: "
+		<< CONVERSION_CACHE_DEFAULT_MB << ")" << endl;
+	cout << "  --cache-link    hard-link the cached .dds files instead of copying them (other tools must not edit them in place)" << endl;
+	cout << "  --pack          pack the .dds files into smaller .ddz files (lossless) instead of decompressing them" << endl;
+	cout << "  --profile <file|-> save the time of every stage (header, read, gather, encode, downsample, write, decode)," << endl;
+	cout << "                  the blocks, bytes and thread busy times of the run as JSON (- for stdout, the log then goes to stderr)" << endl;
+	cout << "  @manifest       text file listing one input path or pattern per line" << endl << endl;
+	cout << "usage: bmp_dxt_converter [options] --serve <socket|->" << endl;
+	cout << "  runs as a server converting the files of the requests sent to a Unix socket (or stdin with -)," << endl;
+	cout << "  keeping the threads and memory between jobs (encoder options apply to all the jobs). Requests:" << endl;
+	cout << "    compress|decompress|region <TAB>in=<path|-> <TAB>out=<path|-> [<TAB>size=<bytes>] [<TAB>mip=<n>]" << endl;
+	cout << "    [<TAB>rect=<x,y,w,h>], then the input bytes if in=-; stats; quit; shutdown" << endl;
+	cout << "  responses: ok|error <TAB><bytes> <TAB><message>, then the output file bytes if out=-" << endl << endl;
+	cout << "usage: bmp_dxt_converter --bench [-t <max threads>] [-s <seconds>] [file.bmp]..." << endl;
+	cout << "  measures the encoders and decoders speed and quality on synthetic images and the given" << endl;
+	cout << "  BMP files (test2_source.bmp if none is given and it exists)" << endl;
+}
+
+/**
+Benchmark mode: measure speed and quality and print the results
+
+@return process exit code
+*/
+int runBenchmark(int argc, char* argv[])
+{
+	Compressor compressor;
+	compressor.setVerbose(false);
+	Benchmark benchmark(compressor);
+	vector<string> files;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "-t" && i + 1 < argc)
+			benchmark.setMaxThreads(atoi(argv[++i]));
+		else if (arg == "-s" && i + 1 < argc)
+			benchmark.setMinSeconds(atof(argv[++i]));
+		else if (arg.size() > 1 && arg[0] == '-')
+		{
+			printUsage();
+			return 1;
+		}
+		else
+			files.push_back(arg);
+	}
+
+	benchmark.addSyntheticImages(1024, 1024);
+
+	if (files.empty())
+		benchmark.addImageFile("test2_source.bmp"); // the bundled sample, skipped if not found
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (!benchmark.addImageFile(files[i]))
+			return 1;
+	}
+
+	benchmark.run();
+	return 0;
+}
+
+/**
+Batch mode: convert the files given on the command line
+
+@return process exit code, 0 if all files were converted
+*/
+int runBatch(int argc, char* argv[])
+{
+	Compressor compressor;
+	BatchConverter batch(compressor);
+	vector<string> inputs;
+	string serverPath;
+	string profilePath;
+	string cacheDir;
+	long long cacheMB = CONVERSION_CACHE_DEFAULT_MB;
+	bool cacheLink = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "-o" && i + 1 < argc)
+			batch.setOutputDir(argv[++i]);
+		else if (arg == "-t" && i + 1 < argc)
+			compressor.setThreadCount(atoi(argv[++i]));
+		else if (arg == "--range-fit")
+			compressor.setEncoderTier(TIER_RANGE_FIT);
+		else if (arg == "--stream")
+			compressor.setStreamingMode(true);
+		else if (arg == "--metrics")
+			batch.setPrintMetrics(true);
+		else if (arg == "--mipmaps")
+			compressor.setMipmaps(true);
+		else if (arg == "--block-cache")
+			compressor.setBlockCache(BLOCK_CACHE_ENTRIES);
+		else if (arg == "--rdo" && i + 1 < argc)
+			compressor.setRdo(atoi(argv[++i]));
+		else if (arg == "--incremental")
+			batch.setIncremental(true);
+		else if (arg == "--pack")
+			batch.setPack(true);
+		else if (arg == "--mip-level" && i + 1 < argc)
+			batch.setMipLevel(atoi(argv[++i]));
+		else if (arg == "--cache" && i + 1 < argc)
+			cacheDir = argv[++i];
+		else if (arg == "--cache-size" && i + 1 < argc)
+		{
+			// a positive number of MB, small enough to be counted in bytes
+			unsigned long long size;
+			if (!parseNumber(argv[++i], size) || size == 0 || size > (unsigned long long)(LLONG_MAX >> 20))
+			{
+				printUsage();
+				return 1;
+			}
+			cacheMB = (long long)size;
+		}
+		else if (arg == "--cache-link")
+			cacheLink = true;
+		else if (arg == "--profile" && i + 1 < argc)
+			profilePath = argv[++i];
+		else if (arg == "--serve" && i + 1 < argc)
+			serverPath = argv[++i];
+		else if (arg == "--region" && i + 1 < argc)
+		{
+			ImageRegion region;
+			if (!parseRegion(argv[++i], region))
+			{
+				printUsage();
+				return 1;
+			}
+			batch.setRegion(region);
+		}
+		else if (arg == "-h" || arg == "--help" || (arg.size() > 1 && arg[0] == '-'))
+		{
+			printUsage();
+			return arg[1] == 'h' || arg == "--help" ? 0 : 1;
+		}
+		else
+			inputs.push_back(arg);
+	}
+
+	// stdout can't carry both the server responses and the profile
+	if (inputs.empty() == serverPath.empty() || (serverPath == SERVER_STDIO_PATH && profilePath == "-"))
+	{
+		printUsage();
+		return 1;
+	}
+
+	if (!profilePath.empty())
+		compressor.setProfiling(true);
+
+	// stdout only carries the profile JSON: the messages go to stderr
+	streambuf* coutBuffer = cout.rdbuf();
+	if (profilePath == "-")
+		cout.rdbuf(cerr.rdbuf());
+
+	if (!cacheDir.empty())
+		compressor.setConversionCache(cacheDir, cacheMB << 20, cacheLink);
+
+	bool ok;
+	if (!serverPath.empty())
+	{
+		// the jobs report errors in their responses, the server log only keeps the compressor messages
+		compressor.setVerbose(false);
+		ConversionServer server(compressor);
+		ok = server.run(serverPath);
+	}
+	else
+		ok = batch.run(inputs) == 0;
+
+	cout.rdbuf(coutBuffer);
+	if (!profilePath.empty() && !compressor.writeProfile(profilePath))
+		ok = false;
+
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
 {
+	if (argc > 1 && string(argv[1]) == "--bench")
+		return runBenchmark(argc, argv);
+
+	if (argc > 1)
+		return runBatch(argc, argv);
+
 	string filePath;
 	bool quit = false;
 	Compressor compressor;